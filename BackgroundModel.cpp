@@ -0,0 +1,252 @@
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+
+#include "BackgroundModel.h"
+
+#if defined(__SSE2__)
+#define BACKGROUNDMODEL_SSE2
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#define BACKGROUNDMODEL_NEON
+#include <arm_neon.h>
+#endif
+
+
+using namespace std;
+
+
+const char * const BackgroundModel::c_modelNames[] = {"previous", "ema", "gaussian"};
+
+
+void BackgroundModel::SetModel(eBDBackgroundModel model, int learningShift)
+{
+    learningShift = min(max(learningShift, c_minLearningShift), c_maxLearningShift);
+    if (model != m_model)
+        Reset();
+
+    m_model = model;
+    m_learningShift = learningShift;
+}
+
+void BackgroundModel::Reset()
+{
+    m_width = m_height = 0;
+    m_mean.clear();
+    m_deviation.clear();
+}
+
+int BackgroundModel::Update(const uint8_t * pLuma, size_t stride, int width, int height, uint8_t threshold,
+                            uint8_t * pDiff, size_t diffStride)
+{
+    if (m_model == BGM_PREVIOUS)
+        return 0;
+
+    if ( (width != m_width) || (height != m_height) )
+    {
+        // Seed the model with the current image.
+        m_width = width;
+        m_height = height;
+        m_mean.resize((size_t)width * height);
+        m_deviation.assign((size_t)width * height, (int16_t)(c_initDeviation << c_fracBits));
+        for (int y = 0; y < height; ++y)
+        {
+            const uint8_t * pRow = pLuma + stride * y;
+            int16_t * pMean = &m_mean[(size_t)width * y];
+            for (int x = 0; x < width; ++x)
+                pMean[x] = (int16_t)(pRow[x] << c_fracBits);
+            if (pDiff)
+                memset(pDiff + diffStride * y, 0, width);
+        }
+        return 0;
+    }
+
+    int count = 0;
+    for (int y = 0; y < height; ++y)
+    {
+        const uint8_t * pRow = pLuma + stride * y;
+        size_t offset = (size_t)width * y;
+        uint8_t * pDiffRow = (pDiff ? pDiff + diffStride * y : nullptr);
+        if (m_model == BGM_EMA)
+            count += UpdateRowEma(pRow, &m_mean[offset], pDiffRow, width, threshold);
+        else
+            count += UpdateRowGaussian(pRow, &m_mean[offset], &m_deviation[offset], pDiffRow, width, threshold);
+    }
+
+    return count;
+}
+
+int BackgroundModel::UpdateRowEma(const uint8_t * pLuma, int16_t * pMean, uint8_t * pDiff, int width,
+                                  uint8_t threshold) const
+{
+    const int shift = m_learningShift;
+    int count = 0;
+    int x = 0;
+
+#if defined(BACKGROUNDMODEL_SSE2)
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i half = _mm_set1_epi16(1 << (c_fracBits - 1));
+    const __m128i thresh = _mm_set1_epi16(threshold);
+    const __m128i bgShift = _mm_cvtsi32_si128(shift);
+    const __m128i fgShift = _mm_cvtsi32_si128(shift + c_foregroundShift);
+    for (; x + 8 <= width; x += 8)
+    {
+        __m128i value = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(pLuma + x)), zero);
+        __m128i mean = _mm_loadu_si128((const __m128i *)(pMean + x));
+
+        // Foreground where the sample is further than threshold from the rounded background.
+        __m128i diff = _mm_sub_epi16(value, _mm_srli_epi16(_mm_add_epi16(mean, half), c_fracBits));
+        diff = _mm_max_epi16(diff, _mm_sub_epi16(zero, diff));
+        __m128i fg = _mm_cmpgt_epi16(diff, thresh);
+        count += __builtin_popcount(_mm_movemask_epi8(fg)) / 2;
+        if (pDiff)
+            _mm_storel_epi64((__m128i *)(pDiff + x), _mm_packus_epi16(diff, diff));
+
+        // mean += (value - mean) * alpha, with a smaller alpha for foreground.
+        __m128i delta = _mm_sub_epi16(_mm_slli_epi16(value, c_fracBits), mean);
+        __m128i step = _mm_or_si128(_mm_and_si128(fg, _mm_sra_epi16(delta, fgShift)),
+                                    _mm_andnot_si128(fg, _mm_sra_epi16(delta, bgShift)));
+        _mm_storeu_si128((__m128i *)(pMean + x), _mm_add_epi16(mean, step));
+    }
+#elif defined(BACKGROUNDMODEL_NEON)
+    const int16x8_t thresh = vdupq_n_s16(threshold);
+    const int16x8_t bgShift = vdupq_n_s16(-shift);
+    const int16x8_t fgShift = vdupq_n_s16(-(shift + c_foregroundShift));
+    uint32x4_t acc = vdupq_n_u32(0);
+    for (; x + 8 <= width; x += 8)
+    {
+        int16x8_t value = vreinterpretq_s16_u16(vmovl_u8(vld1_u8(pLuma + x)));
+        int16x8_t mean = vld1q_s16(pMean + x);
+
+        int16x8_t diff = vabdq_s16(value, vrshrq_n_s16(mean, c_fracBits));
+        uint16x8_t fg = vcgtq_s16(diff, thresh);
+        acc = vpadalq_u16(acc, vshrq_n_u16(fg, 15));
+        if (pDiff)
+            vst1_u8(pDiff + x, vqmovun_s16(diff));
+
+        int16x8_t delta = vsubq_s16(vshlq_n_s16(value, c_fracBits), mean);
+        int16x8_t step = vbslq_s16(fg, vshlq_s16(delta, fgShift), vshlq_s16(delta, bgShift));
+        vst1q_s16(pMean + x, vaddq_s16(mean, step));
+    }
+    uint64x2_t sum = vpaddlq_u32(acc);
+    count += (int)(vgetq_lane_u64(sum, 0) + vgetq_lane_u64(sum, 1));
+#endif
+
+    for (; x < width; ++x)
+    {
+        int value = pLuma[x];
+        int mean = pMean[x];
+        int diff = abs(value - ((mean + (1 << (c_fracBits - 1))) >> c_fracBits));
+        bool fg = (diff > threshold);
+        count += fg;
+        if (pDiff)
+            pDiff[x] = (uint8_t)diff;
+        pMean[x] = (int16_t)(mean + (((value << c_fracBits) - mean) >> (fg ? shift + c_foregroundShift : shift)));
+    }
+
+    return count;
+}
+
+int BackgroundModel::UpdateRowGaussian(const uint8_t * pLuma, int16_t * pMean, int16_t * pDeviation, uint8_t * pDiff,
+                                       int width, uint8_t threshold) const
+{
+    const int shift = m_learningShift;
+    const int minDeviation = c_minDeviation << c_fracBits;
+    const int maxDeviation = c_maxDeviation << c_fracBits;
+    int count = 0;
+    int x = 0;
+
+#if defined(BACKGROUNDMODEL_SSE2)
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i half = _mm_set1_epi16(1 << (c_fracBits - 1));
+    const __m128i thresh = _mm_set1_epi16(threshold);
+    const __m128i factor = _mm_set1_epi16(c_deviationFactor);
+    const __m128i minDev = _mm_set1_epi16(minDeviation);
+    const __m128i maxDev = _mm_set1_epi16(maxDeviation);
+    const __m128i bgShift = _mm_cvtsi32_si128(shift);
+    const __m128i fgShift = _mm_cvtsi32_si128(shift + c_foregroundShift);
+    for (; x + 8 <= width; x += 8)
+    {
+        __m128i value = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(pLuma + x)), zero);
+        __m128i mean = _mm_loadu_si128((const __m128i *)(pMean + x));
+        __m128i deviation = _mm_loadu_si128((const __m128i *)(pDeviation + x));
+
+        // Foreground only if the change clears both the global threshold and this pixel's own noise level.
+        __m128i diff = _mm_sub_epi16(value, _mm_srli_epi16(_mm_add_epi16(mean, half), c_fracBits));
+        diff = _mm_max_epi16(diff, _mm_sub_epi16(zero, diff));
+        __m128i diffQ = _mm_slli_epi16(diff, c_fracBits);
+        __m128i outlier = _mm_cmpgt_epi16(diffQ, _mm_mullo_epi16(deviation, factor));
+        __m128i fg = _mm_and_si128(_mm_cmpgt_epi16(diff, thresh), outlier);
+        count += __builtin_popcount(_mm_movemask_epi8(fg)) / 2;
+        if (pDiff)
+        {
+            __m128i outlierDiff = _mm_and_si128(diff, outlier);
+            _mm_storel_epi64((__m128i *)(pDiff + x), _mm_packus_epi16(outlierDiff, outlierDiff));
+        }
+
+        __m128i delta = _mm_sub_epi16(_mm_slli_epi16(value, c_fracBits), mean);
+        __m128i step = _mm_or_si128(_mm_and_si128(fg, _mm_sra_epi16(delta, fgShift)),
+                                    _mm_andnot_si128(fg, _mm_sra_epi16(delta, bgShift)));
+        _mm_storeu_si128((__m128i *)(pMean + x), _mm_add_epi16(mean, step));
+
+        delta = _mm_sub_epi16(diffQ, deviation);
+        step = _mm_or_si128(_mm_and_si128(fg, _mm_sra_epi16(delta, fgShift)),
+                            _mm_andnot_si128(fg, _mm_sra_epi16(delta, bgShift)));
+        deviation = _mm_min_epi16(_mm_max_epi16(_mm_add_epi16(deviation, step), minDev), maxDev);
+        _mm_storeu_si128((__m128i *)(pDeviation + x), deviation);
+    }
+#elif defined(BACKGROUNDMODEL_NEON)
+    const int16x8_t thresh = vdupq_n_s16(threshold);
+    const int16x8_t minDev = vdupq_n_s16(minDeviation);
+    const int16x8_t maxDev = vdupq_n_s16(maxDeviation);
+    const int16x8_t bgShift = vdupq_n_s16(-shift);
+    const int16x8_t fgShift = vdupq_n_s16(-(shift + c_foregroundShift));
+    uint32x4_t acc = vdupq_n_u32(0);
+    for (; x + 8 <= width; x += 8)
+    {
+        int16x8_t value = vreinterpretq_s16_u16(vmovl_u8(vld1_u8(pLuma + x)));
+        int16x8_t mean = vld1q_s16(pMean + x);
+        int16x8_t deviation = vld1q_s16(pDeviation + x);
+
+        int16x8_t diff = vabdq_s16(value, vrshrq_n_s16(mean, c_fracBits));
+        int16x8_t diffQ = vshlq_n_s16(diff, c_fracBits);
+        uint16x8_t outlier = vcgtq_s16(diffQ, vmulq_n_s16(deviation, c_deviationFactor));
+        uint16x8_t fg = vandq_u16(vcgtq_s16(diff, thresh), outlier);
+        acc = vpadalq_u16(acc, vshrq_n_u16(fg, 15));
+        if (pDiff)
+            vst1_u8(pDiff + x, vqmovun_s16(vandq_s16(diff, vreinterpretq_s16_u16(outlier))));
+
+        int16x8_t delta = vsubq_s16(vshlq_n_s16(value, c_fracBits), mean);
+        int16x8_t step = vbslq_s16(fg, vshlq_s16(delta, fgShift), vshlq_s16(delta, bgShift));
+        vst1q_s16(pMean + x, vaddq_s16(mean, step));
+
+        delta = vsubq_s16(diffQ, deviation);
+        step = vbslq_s16(fg, vshlq_s16(delta, fgShift), vshlq_s16(delta, bgShift));
+        deviation = vminq_s16(vmaxq_s16(vaddq_s16(deviation, step), minDev), maxDev);
+        vst1q_s16(pDeviation + x, deviation);
+    }
+    uint64x2_t sum = vpaddlq_u32(acc);
+    count += (int)(vgetq_lane_u64(sum, 0) + vgetq_lane_u64(sum, 1));
+#endif
+
+    for (; x < width; ++x)
+    {
+        int value = pLuma[x];
+        int mean = pMean[x];
+        int deviation = pDeviation[x];
+        int diff = abs(value - ((mean + (1 << (c_fracBits - 1))) >> c_fracBits));
+        bool outlier = ((diff << c_fracBits) > c_deviationFactor * deviation);
+        bool fg = ( (diff > threshold) && outlier );
+        int learnShift = (fg ? shift + c_foregroundShift : shift);
+        count += fg;
+        if (pDiff)
+            pDiff[x] = (uint8_t)(outlier ? diff : 0);
+
+        pMean[x] = (int16_t)(mean + (((value << c_fracBits) - mean) >> learnShift));
+        deviation += ((diff << c_fracBits) - deviation) >> learnShift;
+        pDeviation[x] = (int16_t)min(max(deviation, minDeviation), maxDeviation);
+    }
+
+    return count;
+}
@@ -0,0 +1,64 @@
+#ifndef BACKGROUNDMODEL_H_
+#define BACKGROUNDMODEL_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+
+enum eBDBackgroundModel
+{
+    BGM_PREVIOUS, // Plain difference against the previous frame (handled by the motion kernel itself).
+    BGM_EMA,      // Exponential running average of luma.
+    BGM_GAUSSIAN, // Running average plus per-pixel deviation; noisy pixels need a larger change to count.
+    BGM_MAX
+};
+
+
+// Per-pixel background model over the reduced luma image.
+// State is kept in 16-bit fixed-point planes (Q7, i.e. 7 fractional bits) so a whole row fits in vector lanes.
+// The Gaussian model tracks the mean absolute deviation rather than the variance (sigma ~= 1.25 * MAD),
+// which keeps the foreground test and the update within 16 bits.
+// Samples classified as foreground are learned more slowly, so objects that stop moving fade in gradually.
+class BackgroundModel
+{
+    static constexpr int c_fracBits = 7;
+    static constexpr int c_foregroundShift = 2; // Foreground learns 4x slower than background.
+    static constexpr int c_deviationFactor = 3; // Foreground when |diff| > factor * MAD (about 2.4 sigma).
+    static constexpr int c_initDeviation = 4;
+    static constexpr int c_minDeviation = 2;
+    static constexpr int c_maxDeviation = 64;
+
+    eBDBackgroundModel m_model = BGM_PREVIOUS;
+    int m_learningShift = 0;
+    int m_width = 0;
+    int m_height = 0;
+    std::vector<int16_t> m_mean;
+    std::vector<int16_t> m_deviation;
+
+public:
+    static const char * const c_modelNames[];
+    static constexpr int c_minLearningShift = 1;
+    static constexpr int c_maxLearningShift = 10;
+
+    BackgroundModel() = default;
+
+    // Select model and learning rate (1 / 2^learningShift per frame); changing the model restarts learning.
+    void SetModel(eBDBackgroundModel model, int learningShift);
+    eBDBackgroundModel GetModel() const { return m_model; }
+    void Reset();
+
+    // Count samples of the reduced luma image that differ from the background, then fold the image into the model.
+    // The first image after a reset (or size change) seeds the model and counts nothing.
+    // If pDiff is given it receives each sample's distance from the background (zero where the Gaussian model
+    // considers the change within the pixel's own noise), for thresholding elsewhere.
+    int Update(const uint8_t * pLuma, size_t stride, int width, int height, uint8_t threshold,
+               uint8_t * pDiff = nullptr, size_t diffStride = 0);
+
+private:
+    int UpdateRowEma(const uint8_t * pLuma, int16_t * pMean, uint8_t * pDiff, int width, uint8_t threshold) const;
+    int UpdateRowGaussian(const uint8_t * pLuma, int16_t * pMean, int16_t * pDeviation, uint8_t * pDiff, int width,
+                          uint8_t threshold) const;
+};
+
+#endif /* BACKGROUNDMODEL_H_ */
@@ -0,0 +1,108 @@
+#ifndef BOUNDEDQUEUE_H_
+#define BOUNDEDQUEUE_H_
+
+#include <cstddef>
+#include <deque>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+
+
+enum eBDDropPolicy
+{
+    DP_BLOCK,       // Producer waits for room.
+    DP_DROP_OLDEST, // Oldest queued item is discarded, so the consumer always gets the newest work.
+    DP_DROP_NEWEST, // Incoming item is discarded.
+    DP_MAX
+};
+
+
+struct QueueStats
+{
+    size_t depth = 0;
+    size_t maxDepth = 0;
+    long long pushed = 0;
+    long long dropped = 0;
+};
+
+
+// Bounded multi-producer/multi-consumer queue linking two pipeline stages.
+// Waits use boost condition variables, so a blocked stage thread still responds to boost::thread::interrupt().
+template <typename T>
+class BoundedQueue
+{
+    static const char * const c_policyNames[];
+
+    mutable boost::mutex m_mutex;
+    boost::condition_variable m_notEmpty;
+    boost::condition_variable m_notFull;
+    std::deque<T> m_items;
+    size_t m_capacity;
+    eBDDropPolicy m_policy;
+    QueueStats m_stats;
+
+public:
+    BoundedQueue(size_t capacity, eBDDropPolicy policy) : m_capacity(capacity), m_policy(policy) {}
+
+    static const char * GetPolicyName(eBDDropPolicy policy) { return c_policyNames[policy]; }
+    eBDDropPolicy GetPolicy() const { return m_policy; }
+    size_t GetCapacity() const { return m_capacity; }
+
+    // Returns the item displaced by the drop policy (or the rejected item itself), so the caller can recycle it.
+    // Returns a default-constructed T if nothing was dropped.
+    T Push(T item)
+    {
+        boost::mutex::scoped_lock lock(m_mutex);
+        ++m_stats.pushed;
+
+        T dropped = T();
+        if (m_items.size() >= m_capacity)
+        {
+            if (m_policy == DP_BLOCK)
+            {
+                while (m_items.size() >= m_capacity)
+                    m_notFull.wait(lock);
+            }
+            else
+            {
+                ++m_stats.dropped;
+                if (m_policy == DP_DROP_NEWEST)
+                    return item;
+
+                dropped = std::move(m_items.front());
+                m_items.pop_front();
+            }
+        }
+
+        m_items.push_back(std::move(item));
+        if (m_items.size() > m_stats.maxDepth)
+            m_stats.maxDepth = m_items.size();
+        m_notEmpty.notify_one();
+        return dropped;
+    }
+
+    // Blocks until an item is available; interruptible.
+    T Pop()
+    {
+        boost::mutex::scoped_lock lock(m_mutex);
+        while (m_items.empty())
+            m_notEmpty.wait(lock);
+
+        T item = std::move(m_items.front());
+        m_items.pop_front();
+        m_notFull.notify_one();
+        return item;
+    }
+
+    QueueStats GetStats() const
+    {
+        boost::mutex::scoped_lock lock(m_mutex);
+        QueueStats stats = m_stats;
+        stats.depth = m_items.size();
+        return stats;
+    }
+};
+
+template <typename T>
+const char * const BoundedQueue<T>::c_policyNames[] = {"block", "drop-oldest", "drop-newest"};
+
+#endif /* BOUNDEDQUEUE_H_ */
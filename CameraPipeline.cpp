@@ -0,0 +1,927 @@
+
+#include <cmath>
+#include <cstring>
+
+#include "CameraPipeline.h"
+#include "MotionDetector.h"
+#include "NotificationMgr.h"
+#include "SocketMgr.h"
+#include "ThreadUtil.h"
+#include "Tracer.h"
+#include "VideoCaptureMgr.h"
+#include "VideoFrame.h"
+
+
+using namespace std;
+using namespace cv;
+
+
+const char * const CameraPipeline::c_imageProcStageNames[] = {"MotionDetect", "Snapshot", "Regions", "Process",
+                                                                 "Encode", "Send", "Total", "Handoff"};
+
+
+CameraPipeline::CameraPipeline(PiMgr * owner, int id, const CaptureConfig & captureConfig, const Config & config) :
+    m_owner(owner),
+    m_id(id),
+    m_captureConfig(captureConfig),
+    m_motionDetector(new MotionDetector(config.threshold)),
+    m_processQueue(c_processQueueDepth, c_processDropPolicy),
+    m_encodeQueue(c_encodeQueueDepth, c_encodeDropPolicy),
+    m_frameQueue(config.frameQueueConfig),
+    m_recorder(id, config.recordingConfig),
+    m_rateController(config.rateConfig)
+{
+    m_motionDetector->setBackgroundModel(config.backgroundModel, config.learningShift);
+    m_motionDetector->setDetectionMode(config.detectionMode);
+    m_motionDetector->getEvents().SetConfig(config.eventConfig);
+    SetProcessingChain(config.chainSpec);
+    SetCodec(config.codecSpec);
+}
+
+CameraPipeline::~CameraPipeline()
+{
+    for (boost::thread * pThread : {&m_thread, &m_processThread, &m_encodeThread, &m_sendThread})
+    {
+        if (pThread->joinable())
+            pThread->join();
+    }
+}
+
+bool CameraPipeline::Start()
+{
+    m_running = true;
+    m_thread = boost::thread(&CameraPipeline::WorkerFunc, this);
+    if (m_captureConfig.cpu >= 0)
+        SetThreadAffinity(m_thread, m_captureConfig.cpu);
+
+    // Downstream stages are left to the scheduler so they can use the cores detection is not on.
+    m_processThread = boost::thread(&CameraPipeline::ProcessWorker, this);
+    m_encodeThread = boost::thread(&CameraPipeline::EncodeWorker, this);
+    m_sendThread = boost::thread(&CameraPipeline::SendWorker, this);
+    m_recorder.Start();
+    return true;
+}
+
+void CameraPipeline::Terminate()
+{
+    m_thread.interrupt();
+    m_processThread.interrupt();
+    m_encodeThread.interrupt();
+    m_sendThread.interrupt();
+    m_recorder.Terminate();
+
+    // Worker may be blocked waiting for a frame - wake it so it notices the interruption.
+    boost::mutex::scoped_lock lock(m_vcMgrMutex);
+    if (m_vcMgr)
+        m_vcMgr->Interrupt();
+}
+
+void CameraPipeline::SetThreshold(int threshold)
+{
+    m_motionDetector->setThreshold(threshold);
+}
+
+void CameraPipeline::SetBackgroundModel(eBDBackgroundModel model, int learningShift)
+{
+    m_motionDetector->setBackgroundModel(model, learningShift);
+}
+
+void CameraPipeline::SetEventConfig(const MotionEventConfig & eventConfig)
+{
+    m_motionDetector->getEvents().SetConfig(eventConfig);
+}
+
+void CameraPipeline::SetDetectionMode(eBDDetectionMode mode)
+{
+    m_motionDetector->setDetectionMode(mode);
+}
+
+void CameraPipeline::SetProcessingChain(const string & spec)
+{
+    // Build the new chain outside the lock; the process thread only waits for the swap.
+    ProcessingChain chain;
+    if (!ProcessingChain::Parse(spec, chain))
+        return;
+
+    lock_guard<mutex> lock(m_chainMutex);
+    m_chain = move(chain);
+    m_chainFlags = m_chain.GetFlags();
+}
+
+void CameraPipeline::SetFrameQueueConfig(const FrameQueueConfig & frameQueueConfig)
+{
+    m_frameQueue.SetConfig(frameQueueConfig);
+}
+
+void CameraPipeline::SetRecordingConfig(const RecordingConfig & recordingConfig)
+{
+    m_recorder.SetConfig(recordingConfig);
+}
+
+void CameraPipeline::SetRateConfig(const RateConfig & rateConfig)
+{
+    m_rateController.SetConfig(rateConfig);
+}
+
+void CameraPipeline::SetCodec(const string & spec)
+{
+    shared_ptr<const FrameCodec> pCodec(FrameCodec::Create(spec));
+    if (!pCodec)
+        return;
+
+    lock_guard<mutex> lock(m_codecMutex);
+    m_pCodec = pCodec;
+    m_codecStats = CodecStats();
+}
+
+void CameraPipeline::OutputStatus()
+{
+    cout << endl << "Statistics (camera " << m_id << ")" << endl;
+
+    cout << "  Total Frames=" << m_status.numFrames;
+    cout << "\tDelayed Frames=" << m_status.numDroppedFrames;
+    cout << "\tMotion Events=" << m_status.numEvents;
+
+    if (m_status.numFrames == 0)
+    {
+        cout << endl;
+        return;
+    }
+
+    cout << "\tAverage FPS=" << (m_status.numFrames / m_diff.total_seconds()) << endl;
+
+    // Tails matter more than averages: an occasional slow frame is what backs the queues up and drops frames.
+    cout << "  Processing times (us), last " << LatencyHistogram::c_windowSeconds << "s and since start:" << endl;
+    for (int i = IPS_MOTIONDETECT; i < IPS_MAX; ++i)
+    {
+        const LatencyHistogram & histogram = m_status.processUs[i];
+        cout << "    " << c_imageProcStageNames[i] << ": curr=" << histogram.GetLast() << endl;
+        cout << "      window: " << histogram.GetWindow().ToString() << endl;
+        cout << "      total:  " << histogram.GetTotal().ToString() << endl;
+    }
+
+    // Queue occupancy shows which stage is the bottleneck: the one in front of a full queue.
+    cout << "  Stage queues:" << endl;
+    const char * const queueNames[] = {"Process", "Encode"};
+    const BoundedQueue<StageJobPtr> * queues[] = {&m_processQueue, &m_encodeQueue};
+    for (int i = 0; i < 2; ++i)
+    {
+        QueueStats stats = queues[i]->GetStats();
+        cout << "    " << queueNames[i] << ": depth=" << stats.depth << "/" << queues[i]->GetCapacity() <<
+                ", max=" << stats.maxDepth << ", pushed=" << stats.pushed << ", dropped=" << stats.dropped <<
+                " (" << BoundedQueue<StageJobPtr>::GetPolicyName(queues[i]->GetPolicy()) << ")" << endl;
+    }
+
+    FrameQueueStats sendStats = m_frameQueue.GetStats();
+    FrameQueueConfig sendConfig = m_frameQueue.GetConfig();
+    cout << "    Send: depth=" << sendStats.frames << "/" << sendConfig.maxFrames <<
+            ", kb=" << (sendStats.bytes + 1023) / 1024 << "/" << sendConfig.maxKB <<
+            ", max=" << sendStats.maxFrames << " (" << (sendStats.maxBytes + 1023) / 1024 << "kb)" <<
+            ", pushed=" << sendStats.pushed << ", dropped=" << sendStats.dropped <<
+            ", stale=" << sendStats.flushed << " (" << FrameQueue::c_policyNames[sendConfig.policy] << ")" << endl;
+
+    {
+        lock_guard<mutex> lock(m_codecMutex);
+        if (m_codecStats.frames)
+        {
+            cout << "  Codec " << m_pCodec->GetSpec() << ": frames=" << m_codecStats.frames <<
+                    ", avg=" << m_codecStats.totalUs / m_codecStats.frames << "us" <<
+                    ", max=" << m_codecStats.maxUs << "us" <<
+                    ", avg size=" << m_codecStats.totalBytes / m_codecStats.frames / 1024 << "kb" << endl;
+        }
+    }
+
+    RateConfig rateConfig = m_rateController.GetConfig();
+    RateStats rateStats = m_rateController.GetStats();
+    RateSettings rateSettings = m_rateController.GetSettings();
+    cout << "  Rate: sent=" << lround(rateStats.fps) << "fps, " << lround(rateStats.kbps) << "kbps" <<
+            ", dropped=" << lround(rateStats.dropsPerSecond) << "/s";
+    if (rateConfig.adapt)
+    {
+        cout << ", level=" << rateStats.level << "/" << RateController::GetNumLevels() - 1 <<
+                " (codec step " << rateSettings.codecStep << ", scale " << rateSettings.scale <<
+                ", skip " << rateSettings.skip << ")";
+    }
+    cout << endl;
+
+    if (m_recorder.IsEnabled())
+    {
+        RecorderStats recorderStats = m_recorder.GetStats();
+        cout << "  Recording: clips=" << recorderStats.clips << ", segments=" << recorderStats.segments <<
+                ", written=" << recorderStats.writtenBytes / 1024 << "kb" <<
+                ", pre-roll=" << recorderStats.preRollFrames << " (" << recorderStats.preRollBytes / 1024 << "kb)" <<
+                ", backlog=" << recorderStats.backlogBytes / 1024 << "kb" <<
+                ", dropped=" << recorderStats.droppedFrames << ", errors=" << recorderStats.writeErrors << endl;
+    }
+
+    lock_guard<mutex> lock(m_chainMutex);
+    cout << "  Processing chain \"" << m_chain.GetSpec() << "\":" << endl;
+    m_chain.OutputTimes();
+}
+
+void CameraPipeline::OutputCaptureConfig() const
+{
+    CaptureConfig captureConfig;
+    {
+        boost::mutex::scoped_lock lock(m_vcMgrMutex);
+        captureConfig = m_vcMgr ? m_vcMgr->GetConfig() : m_captureConfig;
+    }
+    cout << "  Camera " << m_id << "=" << FrameSource::c_sourceTypeNames[captureConfig.sourceType] <<
+            " " << captureConfig.path <<
+            " " << captureConfig.width << "x" << captureConfig.height <<
+            " " << FrameSource::c_pixelFormatNames[captureConfig.pixelFormat] <<
+            " @ " << captureConfig.fps << " fps";
+    if (captureConfig.cpu >= 0)
+        cout << " on CPU " << captureConfig.cpu;
+    cout << endl;
+}
+
+void CameraPipeline::OutputCaptureModes() const
+{
+    vector<CaptureMode> modes;
+    {
+        boost::mutex::scoped_lock lock(m_vcMgrMutex);
+        if (m_vcMgr)
+            modes = m_vcMgr->GetModes();
+    }
+
+    cout << endl << "Capture Modes (camera " << m_id << ")" << endl;
+    for (const auto & mode : modes)
+    {
+        cout << "  " << FrameSource::c_pixelFormatNames[mode.pixelFormat] << " " << mode.width << "x" << mode.height << " @";
+        for (size_t i = 0; i < mode.fps.size(); ++i)
+            cout << (i ? "," : " ") << mode.fps[i];
+        cout << " fps" << endl;
+    }
+}
+
+void CameraPipeline::UpdateCaptureConfig(const string & spec)
+{
+    boost::mutex::scoped_lock lock(m_vcMgrMutex);
+    if (!m_vcMgr)
+        return;
+
+    // Apply changes on top of the active configuration.
+    CaptureConfig captureConfig = m_vcMgr->GetConfig();
+    if (!CaptureConfig::Parse(spec, captureConfig))
+        return;
+
+    if ( (captureConfig.sourceType != m_vcMgr->GetConfig().sourceType) ||
+         (captureConfig.path != m_vcMgr->GetConfig().path) )
+    {
+        cerr << "Error: Frame source cannot be changed at runtime." << endl;
+        return;
+    }
+
+    if (captureConfig.cpu != m_vcMgr->GetConfig().cpu)
+    {
+        cerr << "Error: CPU assignment cannot be changed at runtime." << endl;
+        return;
+    }
+
+    m_captureConfig = captureConfig;
+    m_vcMgr->RequestReconfigure(captureConfig);
+}
+
+bool CameraPipeline::LoadZones()
+{
+    if (m_captureConfig.zoneFile.empty())
+        return true;
+
+    return m_motionDetector->getZones().Load(m_captureConfig.zoneFile);
+}
+
+void CameraPipeline::OutputZones() const
+{
+    cout << endl << "Camera " << m_id << ":";
+    m_motionDetector->getZones().Output();
+}
+
+void CameraPipeline::AddZone(const string & spec)
+{
+    MotionZone zone;
+    if (MotionZone::Parse(spec, zone))
+        m_motionDetector->getZones().Add(zone);
+}
+
+void CameraPipeline::ClearZones()
+{
+    m_motionDetector->getZones().Clear();
+}
+
+void CameraPipeline::WorkerFunc()
+{
+    Tracer::SetThreadName("camera " + to_string(m_id) + " detect");
+
+    // Initialize video.
+    {
+        boost::mutex::scoped_lock lock(m_vcMgrMutex);
+        m_vcMgr.reset(new VideoCaptureMgr(this, m_captureConfig));
+    }
+    VideoCaptureMgr & vcMgr = *m_vcMgr;
+    if (!vcMgr.Initialize())
+    {
+        cerr << "Error: Failed to open video capture for camera " << m_id << "." << endl;
+        m_errorCode = EC_CAPTUREOPENFAIL;
+        ReleaseCapture();
+        m_running = false;
+        return;
+    }
+
+    m_status.Reset();
+
+    // Continually process frames.
+    FrameLease frame;
+    int handoffUs = 0;
+    int nextFrame = c_frameSkip;
+    while (true)
+    {
+        // Retrieve frame.
+        int skippedFrames;
+        do
+        {
+            if ( (skippedFrames = vcMgr.GetLatest(frame, handoffUs)) < 0 )
+            {
+                if (m_interrupted)
+                {
+                    cout << "Camera " << m_id << " interrupted while waiting for frame - shutting down..." << endl;
+                    m_errorCode = EC_INTERRUPT;
+                }
+                else
+                {
+                    cerr << "Error: Failed to read a frame from camera " << m_id << "." << endl;
+                    m_errorCode = EC_CAPTUREGRABFAIL;
+                }
+                break;
+            }
+            nextFrame -= skippedFrames + 1;
+        } while (nextFrame > 0);
+        if (m_errorCode)
+            break;
+        nextFrame += c_frameSkip;
+        if (nextFrame < c_frameBacklogMin)
+            nextFrame = c_frameBacklogMin;
+
+        if (m_status.SuppressionProcessing())
+            m_startTime = boost::posix_time::microsec_clock::local_time();
+
+        if (!m_status.IsSuppressed())
+        {
+            if (nextFrame != c_frameSkip)
+            {
+                m_status.numDroppedFrames++;
+
+                // Not possible to "catch up" on backlog when running full speed - just move on.
+                if (c_frameSkip == 1)
+                    nextFrame = 1;
+            }
+            m_status.numFrames++;
+        }
+
+        DetectFrame(*frame, handoffUs);
+
+        m_diff = boost::posix_time::microsec_clock::local_time() - m_startTime;
+
+        try
+        {
+            boost::this_thread::interruption_point();
+        }
+        catch (boost::thread_interrupted&)
+        {
+            cout << "Camera " << m_id << " interrupted after processing frame - shutting down..." << endl;
+            m_errorCode = EC_INTERRUPT;
+            break;
+        }
+    }
+
+    frame.Release();
+    ReleaseCapture();
+    m_running = false;
+}
+
+void CameraPipeline::ReleaseCapture()
+{
+    boost::mutex::scoped_lock lock(m_vcMgrMutex);
+    m_vcMgr.reset();
+}
+
+void CameraPipeline::DetectFrame(VideoFrame & frame, int handoffUs)
+{
+    int chainFlags = m_chainFlags;
+    int processUs[IPS_MAX];
+    memset(processUs, 0, sizeof(processUs));
+    processUs[IPS_HANDOFF] = handoffUs;
+
+    TraceSpan detectSpan(c_imageProcStageNames[IPS_MOTIONDETECT]);
+    MotionEvent event = m_motionDetector->update(frame);
+    processUs[IPS_MOTIONDETECT] = detectSpan.End();
+
+    if (event.type == MET_START)
+    {
+        ++m_status.numEvents;
+        cout << "Camera " << m_id << ": motion event " << event.id << " started, score=" << event.score << endl;
+        m_owner->GetNotificationMgr().update();
+    }
+    else if (event.type == MET_END)
+    {
+        cout << "Camera " << m_id << ": motion event " << event.id << " ended after " << event.frames <<
+                " frames, peak score=" << event.peakScore << endl;
+    }
+
+    // Frames inside an event are handed on for processing and transmission. While recording, other frames are
+    // handed on at the pre-roll rate too.
+    bool inEvent = ( (event.type == MET_START) || (event.type == MET_UPDATE) );
+    bool preRoll = false;
+    boost::posix_time::ptime now = boost::posix_time::microsec_clock::universal_time();
+    if ( !inEvent && m_recorder.IsEnabled() )
+    {
+        int preRollFps = m_recorder.GetConfig().preRollFps;
+        if ( m_lastPreRollTime.is_not_a_date_time() ||
+             (now - m_lastPreRollTime >= boost::posix_time::microseconds(1000000 / preRollFps)) )
+        {
+            preRoll = true;
+            m_lastPreRollTime = now;
+        }
+    }
+
+    StageJobPtr pJob;
+    if ( inEvent || preRoll )
+    {
+        pJob = AcquireJob();
+        pJob->frameType = FRT_FULL;
+        pJob->inEvent = inEvent;
+        pJob->eventStart = (event.type == MET_START);
+        pJob->chainFlags = chainFlags;
+        pJob->timestamp = now;
+        pJob->regions.clear();
+
+        if ( inEvent && (chainFlags & ProcessingStage::SF_REGIONS) )
+        {
+            // Send a full reference frame when an event starts and every c_referenceInterval frames after that,
+            // and otherwise only the changed regions for the client to paste over it.
+            // Regions depend on detector state, so they are found here rather than in the process stage.
+            if ( (event.type == MET_START) || m_referenceRequested.exchange(false) ||
+                 (++m_framesSinceReference >= c_referenceInterval) )
+                m_framesSinceReference = 0;
+            else
+            {
+                TraceSpan regionsSpan(c_imageProcStageNames[IPS_REGIONS]);
+                m_motionDetector->findRegions(frame.GetSize(), pJob->regions);
+                pJob->frameType = FRT_REGIONS;
+                processUs[IPS_REGIONS] = regionsSpan.End();
+
+                if (pJob->regions.empty())
+                {
+                    RecycleJob(move(pJob));
+                    processUs[IPS_TOTAL] = processUs[IPS_MOTIONDETECT] + processUs[IPS_REGIONS];
+                    RecordTimes(processUs);
+                    return;
+                }
+            }
+        }
+
+        // The capture buffer goes back to the capture thread as soon as this returns, so later stages work on a
+        // snapshot. Colour conversion is left to the process stage.
+        TraceSpan snapshotSpan(c_imageProcStageNames[IPS_SNAPSHOT]);
+        if (chainFlags & ProcessingStage::SF_DETECTOR_IMAGE)
+            m_motionDetector->getFrame().copyTo(pJob->detectorImage);
+        else
+            pJob->detectorImage.release(); // Not left over from an earlier frame for a chain swapped in meanwhile.
+
+        frame.GetRaw().copyTo(pJob->raw);
+        Size size = frame.GetSize();
+        if ( !pJob->pFrame || (pJob->pFrame->GetRaw().data != pJob->raw.data) ||
+             (pJob->pFrame->GetFormat() != frame.GetFormat()) || (pJob->pFrame->GetSize() != size) )
+            pJob->pFrame.reset(new VideoFrame(frame.GetFormat(), size.width, size.height, pJob->raw.data,
+                                              pJob->raw.step));
+        else
+            pJob->pFrame->Invalidate();
+        processUs[IPS_SNAPSHOT] = snapshotSpan.End();
+    }
+
+    // Detection times are recorded now; a job's total is recorded once it has been encoded.
+    if (!pJob)
+    {
+        processUs[IPS_TOTAL] = processUs[IPS_MOTIONDETECT];
+        RecordTimes(processUs);
+        return;
+    }
+
+    RecordTimes(processUs);
+    memcpy(pJob->processUs, processUs, sizeof(processUs));
+    RecycleJob(m_processQueue.Push(move(pJob)));
+}
+
+void CameraPipeline::ProcessWorker()
+{
+    Tracer::SetThreadName("camera " + to_string(m_id) + " process");
+
+    // Run the processing chain on the newest detected frames; older ones are dropped if this falls behind.
+    try
+    {
+        while (true)
+        {
+            StageJobPtr pJob = m_processQueue.Pop();
+            int processUs[IPS_MAX];
+            memset(processUs, 0, sizeof(processUs));
+            int kernelSize = m_owner->GetConfig().kernelSize;
+
+            TraceSpan processSpan(c_imageProcStageNames[IPS_PROCESS]);
+            bool processed = false;
+            {
+                lock_guard<mutex> lock(m_chainMutex);
+
+                // A job queued before a chain change lacks the detector image if the new chain wants it.
+                if ( !(m_chain.GetFlags() & ProcessingStage::SF_DETECTOR_IMAGE) ||
+                     (pJob->chainFlags & ProcessingStage::SF_DETECTOR_IMAGE) )
+                {
+                    try
+                    {
+                        bool stageOwned;
+                        const Mat & result = m_chain.Run(*pJob->pFrame, &pJob->detectorImage, kernelSize,
+                                                         stageOwned);
+
+                        // The chain's buffers are reused for the next frame while this one is being encoded.
+                        if (stageOwned)
+                        {
+                            result.copyTo(pJob->output);
+                            pJob->pFinal = &pJob->output;
+                        }
+                        else
+                            pJob->pFinal = &result;
+                        processed = !pJob->pFinal->empty();
+                    }
+                    catch (cv::Exception & e)
+                    {
+                        // A stage that cannot handle this image costs the frame, not the process.
+                        cerr << "Error: Processing chain failed on camera " << m_id << ": " << e.what() << endl;
+                    }
+                }
+            }
+            if (!processed)
+            {
+                RecycleJob(move(pJob));
+                continue;
+            }
+
+            // Regions are in frame coordinates, so a chain that crops or scales sends whole frames instead.
+            if ( (pJob->frameType == FRT_REGIONS) && (pJob->pFinal->size() != pJob->pFrame->GetSize()) )
+                pJob->frameType = FRT_FULL;
+
+            processUs[IPS_PROCESS] = processSpan.End();
+
+            RecordTimes(processUs);
+            for (int i = 0; i < IPS_TOTAL; ++i)
+                pJob->processUs[i] += processUs[i];
+
+            RecycleJob(m_encodeQueue.Push(move(pJob)));
+        }
+    }
+    catch (boost::thread_interrupted&)
+    {
+    }
+}
+
+void CameraPipeline::EncodeWorker()
+{
+    Tracer::SetThreadName("camera " + to_string(m_id) + " encode");
+
+    try
+    {
+        while (true)
+        {
+            StageJobPtr pJob = m_encodeQueue.Pop();
+
+            shared_ptr<const FrameCodec> pCodec;
+            {
+                lock_guard<mutex> lock(m_codecMutex);
+                pCodec = m_pCodec;
+            }
+
+            // The rate controller only degrades frames while there is a client to adapt to.
+            bool clientReady = m_owner->GetSocketMgr().IsReady();
+            RateSettings rate = clientReady ? m_rateController.GetSettings() : RateSettings();
+            shared_ptr<const FrameCodec> pEncodeCodec = pCodec;
+            if (rate.codecStep)
+            {
+                if ( (pCodec != m_pReducedBase) || (rate.codecStep != m_reducedStep) )
+                {
+                    m_pReducedCodec.reset(pCodec->CreateReduced(rate.codecStep));
+                    m_pReducedBase = pCodec;
+                    m_reducedStep = rate.codecStep;
+                }
+                if (m_pReducedCodec)
+                    pEncodeCodec = m_pReducedCodec;
+            }
+
+            if (pEncodeCodec != m_pVideoCodec)
+            {
+                m_pVideoEncoder.reset(pEncodeCodec->CreateVideoEncoder());
+                m_pVideoCodec = pEncodeCodec;
+            }
+
+            // Don't spend time encoding frames nobody will see; with no client they would only go stale.
+            // Inter-frame output must reach the client whole, so pre-roll frames are sent then too.
+            bool send = ( (pJob->inEvent || m_pVideoEncoder) && clientReady );
+            bool record = m_recorder.IsEnabled();
+            if ( send && rate.skip && (m_rateSkipCount++ % (rate.skip + 1)) )
+            {
+                // An inter-frame stream cannot leave out frames it has encoded, so skipped ones go unrecorded too.
+                send = false;
+                if (m_pVideoEncoder)
+                    record = false;
+            }
+            if ( !send && !record )
+            {
+                RecycleJob(move(pJob));
+                continue;
+            }
+
+            // Regions are in full-size frame coordinates, so region jobs are never scaled. Decided by the job itself,
+            // not the current chain, which may have changed since it was queued.
+            const Mat * pImage = pJob->pFinal;
+            if ( (rate.scale < 1.0) && (m_pVideoEncoder || (pJob->frameType != FRT_REGIONS)) )
+            {
+                resize(*pJob->pFinal, pJob->scaled, Size(), rate.scale, rate.scale, INTER_AREA);
+                pImage = &pJob->scaled;
+            }
+
+            TraceSpan encodeSpan(c_imageProcStageNames[IPS_ENCODE]);
+            FrameQueue::Frame compressedFrame;
+            compressedFrame.codec = pEncodeCodec->GetId();
+            size_t encodedBytes = 0;
+            if (m_pVideoEncoder)
+            {
+                // Whole frames only: regions are ignored, as unchanged areas already cost next to nothing.
+                // Outside events, keyframes are kept frequent enough that trimming the pre-roll leaves some of it.
+                bool forceKeyframe = ( m_frameQueue.TakeKeyframeRequest() || pJob->eventStart );
+                if ( record && !pJob->inEvent && !m_lastKeyframeTime.is_not_a_date_time() &&
+                     (pJob->timestamp - m_lastKeyframeTime >=
+                      boost::posix_time::milliseconds(m_recorder.GetConfig().preRollSeconds * 500)) )
+                    forceKeyframe = true;
+
+                bool keyframe;
+                compressedFrame.pBuf = m_bufferPool.Acquire();
+                if ( !m_pVideoEncoder->Encode(*pImage, forceKeyframe, *compressedFrame.pBuf, keyframe) ||
+                     compressedFrame.pBuf->empty() )
+                {
+                    RecycleJob(move(pJob));
+                    continue;
+                }
+
+                if (keyframe)
+                    m_lastKeyframeTime = pJob->timestamp;
+                pJob->frameType = keyframe ? FRT_FULL : FRT_DELTA;
+            }
+            else if (pJob->frameType == FRT_REGIONS)
+                compressedFrame.pBuf = CompressRegions(*pEncodeCodec, *pImage, pJob->regions);
+            else
+            {
+                // Band mode sends each band as it is done; the whole frame is only built for the recorder.
+                bool sendBands = ( send && m_frameQueue.GetConfig().sendBands );
+                compressedFrame.pBuf = CompressFrame(*pEncodeCodec, pImage, sendBands, !sendBands || record,
+                                                     encodedBytes);
+                if (sendBands)
+                    send = false;
+            }
+            if (compressedFrame.pBuf)
+                encodedBytes = compressedFrame.pBuf->size();
+            compressedFrame.type = pJob->frameType;
+            int encodeUs = encodeSpan.End();
+            {
+                // Stats after a codec change only count frames from the new codec.
+                lock_guard<mutex> lock(m_codecMutex);
+                if (pCodec == m_pCodec)
+                {
+                    ++m_codecStats.frames;
+                    m_codecStats.totalUs += encodeUs;
+                    m_codecStats.totalBytes += encodedBytes;
+                    m_codecStats.maxUs = max(m_codecStats.maxUs, encodeUs);
+                }
+            }
+
+            // The recorder only queues the frame; its writer thread does the disk I/O. A frame that is also sent
+            // shares its buffer with the client's, as neither changes it.
+            if (record)
+                m_recorder.Add(pJob->frameType, compressedFrame.codec, pJob->timestamp, compressedFrame.pBuf,
+                               pJob->inEvent);
+
+            if (send)
+                m_frameQueue.Push(move(compressedFrame));
+
+            int processUs[IPS_MAX];
+            memset(processUs, 0, sizeof(processUs));
+            processUs[IPS_ENCODE] = pJob->processUs[IPS_ENCODE] = encodeUs;
+            for (int i = 0; i < IPS_TOTAL; ++i)
+                processUs[IPS_TOTAL] += pJob->processUs[i];
+            RecordTimes(processUs);
+
+            RecycleJob(move(pJob));
+        }
+    }
+    catch (boost::thread_interrupted&)
+    {
+    }
+}
+
+void CameraPipeline::SendWorker()
+{
+    Tracer::SetThreadName("camera " + to_string(m_id) + " send");
+
+    // Hand compressed frames to the socket manager one at a time, as its slot for this stream frees up. Both waits
+    // block, so with no client or nothing to send this thread sleeps.
+    SocketMgr & socketMgr = m_owner->GetSocketMgr();
+    int connectionId = 0;
+    try
+    {
+        while (true)
+        {
+            socketMgr.WaitStreamIdle(m_id);
+
+            // A new client starts from the live picture rather than frames encoded for the previous one (or while
+            // it was still authorizing), and needs a full frame before any regions. Its link gets a fresh measure.
+            if (socketMgr.GetConnectionId() != connectionId)
+            {
+                connectionId = socketMgr.GetConnectionId();
+                m_frameQueue.Flush();
+                m_referenceRequested = true;
+                m_rateController.Reset();
+            }
+
+            // A slot that stays busy shows up here as frames the queue dropped meanwhile.
+            m_rateController.Update(m_frameQueue.GetStats());
+
+            FrameQueue::Frame compressedFrame;
+            m_frameQueue.Pop(compressedFrame);
+
+            // The client may have gone while this waited; the next one starts from a flushed queue.
+            if ( !socketMgr.IsReady() || (socketMgr.GetConnectionId() != connectionId) )
+                continue;
+
+            int processUs[IPS_MAX];
+            memset(processUs, 0, sizeof(processUs));
+
+            TraceSpan sendSpan(c_imageProcStageNames[IPS_SENT]);
+            // The slot was idle and only this thread fills it, so the frame is always taken.
+            m_rateController.OnSent(compressedFrame.pBuf->size());
+            socketMgr.SendFrame(m_id, compressedFrame.type, compressedFrame.codec, move(compressedFrame.pBuf));
+            processUs[IPS_SENT] = sendSpan.End();
+            RecordTimes(processUs);
+        }
+    }
+    catch (boost::thread_interrupted&)
+    {
+    }
+}
+
+CameraPipeline::StageJobPtr CameraPipeline::AcquireJob()
+{
+    lock_guard<mutex> lock(m_freeJobsMutex);
+    if (m_freeJobs.empty())
+        return StageJobPtr(new StageJob());
+
+    StageJobPtr pJob = move(m_freeJobs.back());
+    m_freeJobs.pop_back();
+    return pJob;
+}
+
+void CameraPipeline::RecycleJob(StageJobPtr pJob)
+{
+    // Jobs keep their image buffers, so steady-state processing does not allocate.
+    if (!pJob)
+        return;
+
+    lock_guard<mutex> lock(m_freeJobsMutex);
+    m_freeJobs.push_back(move(pJob));
+}
+
+void CameraPipeline::RecordTimes(const int * processUs)
+{
+    // Stages run on different threads, so each records only the entries it measured (the nonzero ones).
+    if (m_status.IsSuppressed())
+        return;
+
+    for (int i = IPS_MOTIONDETECT; i < IPS_MAX; ++i)
+    {
+        if (processUs[i])
+            m_status.processUs[i].Record(processUs[i]);
+    }
+}
+
+CameraPipeline::CompressFramePtr CameraPipeline::CompressFrame(const FrameCodec & codec, const Mat * pFrame,
+                                                               bool sendBands, bool buildFrame, size_t & bytes)
+{
+    // Break the image into a band per encoder thread and encode them independently, the last band taking the
+    // rows left over. When sending bands, each is encoded straight into its own buffer after its header and queued
+    // for the client the moment it is done, so the first ones are on the wire while the rest are still encoding.
+    // Otherwise the top band goes straight into the frame after its length; the others can only follow once their
+    // sizes are known, so are copied in from scratch buffers.
+    int numSegments = max(1, min(m_encoderPool.GetConcurrency(), pFrame->rows / c_minSegmentRows));
+    int segmentHeight = pFrame->rows / numSegments;
+    if (m_encodeBuffers.size() < (size_t)numSegments)
+        m_encodeBuffers.resize(numSegments);
+    if (m_bandBuffers.size() < (size_t)numSegments)
+        m_bandBuffers.resize(numSegments);
+    uint32_t frameSeq = m_bandFrameSeq++;
+
+    CompressFramePtr pBuf;
+    if (buildFrame)
+        pBuf = m_bufferPool.Acquire();
+    if (!sendBands)
+        pBuf->resize(sizeof(int32_t));
+
+    m_encoderPool.Run(numSegments, [&](int i)
+    {
+        TraceSpan span("EncodeBand");
+        int top = segmentHeight * i;
+        int height = (i == numSegments - 1) ? pFrame->rows - top : segmentHeight;
+        Mat image = (*pFrame)(Rect(0, top, pFrame->cols, height));
+        if (!sendBands)
+        {
+            vector<uchar> & out = (i == 0) ? *pBuf : m_encodeBuffers[i];
+            if (i != 0)
+                out.clear();
+            codec.Encode(image, out);
+            return;
+        }
+
+        BandHeader header = {frameSeq, (uint16_t)i, (uint16_t)numSegments, (uint16_t)top, 0};
+        FrameQueue::Frame band;
+        band.type = FRT_BAND;
+        band.codec = codec.GetId();
+        band.imageSeq = frameSeq;
+        band.pBuf = m_bufferPool.Acquire();
+        band.pBuf->insert(band.pBuf->end(), (const uchar *)&header, (const uchar *)&header + sizeof(header));
+        codec.Encode(image, *band.pBuf);
+        m_bandBuffers[i] = band.pBuf;
+        m_frameQueue.Push(move(band));
+    });
+
+    // Sent bands are shared with the queue, so are only read from here on.
+    int first = 0;
+    size_t skip = sizeof(BandHeader);
+    bytes = 0;
+    if (!sendBands)
+    {
+        int32_t size = pBuf->size() - sizeof(int32_t);
+        memcpy(pBuf->data(), &size, sizeof(int32_t));
+        bytes = size;
+        first = 1;
+        skip = 0;
+    }
+    auto getBand = [&](int i) -> const vector<uchar> & { return sendBands ? *m_bandBuffers[i] : m_encodeBuffers[i]; };
+    for (int i = first; i < numSegments; ++i)
+        bytes += getBand(i).size() - skip;
+
+    // Concatenate length-value pairs of buffers.
+    if (buildFrame)
+    {
+        pBuf->reserve(numSegments * sizeof(int32_t) + bytes);
+        for (int i = first; i < numSegments; ++i)
+        {
+            const vector<uchar> & band = getBand(i);
+            int32_t size = band.size() - skip;
+            pBuf->insert(pBuf->end(), (const uchar *)&size, (const uchar *)&size + sizeof(int32_t));
+            pBuf->insert(pBuf->end(), band.begin() + skip, band.end());
+        }
+    }
+
+    // Sent bands go back to the pool once the socket manager is done with them.
+    for (int i = 0; i < numSegments; ++i)
+        m_bandBuffers[i].reset();
+    return pBuf;
+}
+
+CameraPipeline::CompressFramePtr CameraPipeline::CompressRegions(const FrameCodec & codec, const Mat & frame,
+                                                                 const vector<Rect> & regions)
+{
+    // Each region is its own image, so encode time follows the amount of motion rather than the frame size.
+    int numRegions = (int)regions.size();
+    if (m_encodeBuffers.size() < (size_t)numRegions)
+        m_encodeBuffers.resize(numRegions);
+
+    m_encoderPool.Run(numRegions, [&](int i)
+    {
+        TraceSpan span("EncodeRegion");
+        m_encodeBuffers[i].clear();
+        codec.Encode(frame(regions[i]), m_encodeBuffers[i]);
+    });
+
+    // Concatenate position-length-value triples.
+    size_t bufferSize = 0;
+    for (int i = 0; i < numRegions; ++i)
+        bufferSize += 2 * sizeof(int16_t) + sizeof(int32_t) + m_encodeBuffers[i].size();
+
+    CompressFramePtr pBuf = m_bufferPool.Acquire();
+    pBuf->reserve(bufferSize);
+    for (int i = 0; i < numRegions; ++i)
+    {
+        int16_t position[2] = {(int16_t)regions[i].x, (int16_t)regions[i].y};
+        int32_t size = m_encodeBuffers[i].size();
+        pBuf->insert(pBuf->end(), (const uchar *)position, (const uchar *)position + sizeof(position));
+        pBuf->insert(pBuf->end(), (const uchar *)&size, (const uchar *)&size + sizeof(size));
+        pBuf->insert(pBuf->end(), m_encodeBuffers[i].begin(), m_encodeBuffers[i].end());
+    }
+
+    return pBuf;
+}
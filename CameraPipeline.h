@@ -0,0 +1,178 @@
+#ifndef CAMERAPIPELINE_H_
+#define CAMERAPIPELINE_H_
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <boost/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <opencv2/opencv.hpp>
+
+#include "BoundedQueue.h"
+#include "EncoderPool.h"
+#include "FrameBufferPool.h"
+#include "FrameCodec.h"
+#include "FrameQueue.h"
+#include "FrameSource.h"
+#include "PiMgr.h"
+#include "ProcessingStage.h"
+#include "RateController.h"
+#include "Recorder.h"
+#include "SocketMgr.h"
+
+
+class MotionDetector;
+class VideoCaptureMgr;
+class VideoFrame;
+
+
+// Capture, motion detection and processing chain for a single camera.
+// Each stage runs on its own thread: capture, detect (the worker), process, encode and send. Stages after detection
+// are linked by bounded queues, so a slow encode never holds up detection; detection runs at capture rate and the
+// heavy stages take the newest frames they can keep up with. Frames are tagged with the pipeline's stream id.
+// Encoded frames go to the client and, when recording is enabled, to the recorder; to give clips a pre-roll, frames
+// outside events are also processed and encoded at the (low) pre-roll rate while recording.
+// With an inter-frame codec, every encoded frame is both sent and recorded, so both get a decodable stream; the
+// encoder makes a full frame when an event starts, when a client connects and after the frame queue drops frames.
+// While a client is connected, the rate controller may lower the codec quality, scale frames down or skip frames to
+// suit the link; the recorder then gets the same reduced frames, as each frame is only encoded once.
+class CameraPipeline
+{
+    static const char * const c_imageProcStageNames[];
+    static constexpr int c_frameSkip = 2;
+    static constexpr int c_frameBacklogMin = -5;
+    static constexpr int c_minSegmentRows = 32; // Thinner bands cost more in per-image overhead than they save.
+    static constexpr int c_referenceInterval = 30; // Event frames between full reference frames in region mode.
+    static constexpr int c_processQueueDepth = 2;
+    static constexpr eBDDropPolicy c_processDropPolicy = DP_DROP_OLDEST;
+    static constexpr int c_encodeQueueDepth = 2;
+    static constexpr eBDDropPolicy c_encodeDropPolicy = DP_DROP_OLDEST;
+
+    using CompressFramePtr = FrameQueue::FramePtr;
+
+    struct CodecStats
+    {
+        long long frames = 0;
+        long long totalUs = 0;
+        long long totalBytes = 0;
+        int maxUs = 0;
+    };
+
+    // Work carried from detection through processing and encoding. Jobs are recycled, so their images keep
+    // their allocations from frame to frame.
+    struct StageJob
+    {
+        eBDFrameType frameType;
+        bool inEvent;                       // Otherwise a pre-roll frame, only recorded.
+        bool eventStart;
+        int chainFlags;                     // Flags of the chain the job was snapshotted for.
+        boost::posix_time::ptime timestamp; // Capture time (UTC).
+        cv::Mat raw;                        // Snapshot of the capture buffer.
+        std::unique_ptr<VideoFrame> pFrame; // View of the snapshot.
+        cv::Mat detectorImage;              // Snapshot of the detector output, if the chain uses it.
+        cv::Mat output;                     // Copy of a chain result that lives in a stage buffer.
+        cv::Mat scaled;                     // Final image scaled down by the rate controller.
+        const cv::Mat * pFinal = nullptr;   // Image to encode.
+        std::vector<cv::Rect> regions;
+        int processUs[IPS_MAX];
+    };
+    using StageJobPtr = std::unique_ptr<StageJob>;
+
+    PiMgr * m_owner;
+    int m_id;
+    eBDErrorCode m_errorCode = EC_NONE;
+    CaptureConfig m_captureConfig;
+    std::unique_ptr<MotionDetector> m_motionDetector;
+    std::unique_ptr<VideoCaptureMgr> m_vcMgr;
+    mutable boost::mutex m_vcMgrMutex;
+    boost::thread m_thread;
+    boost::thread m_processThread;
+    boost::thread m_encodeThread;
+    boost::thread m_sendThread;
+    volatile bool m_running = false;
+    bool m_interrupted = false;
+    Status m_status;
+    boost::posix_time::ptime m_startTime;
+    boost::posix_time::time_duration m_diff;
+    int m_framesSinceReference = 0;
+    BoundedQueue<StageJobPtr> m_processQueue;
+    BoundedQueue<StageJobPtr> m_encodeQueue;
+    std::vector<StageJobPtr> m_freeJobs;
+    std::mutex m_freeJobsMutex;
+    FrameQueue m_frameQueue;
+    std::atomic<bool> m_referenceRequested{false}; // Next region-mode frame must be a full one.
+    Recorder m_recorder;
+    std::shared_ptr<const FrameCodec> m_pCodec;
+    CodecStats m_codecStats; // For the current codec.
+    mutable std::mutex m_codecMutex;
+    std::shared_ptr<const FrameCodec> m_pVideoCodec;  // Codec m_pVideoEncoder was made for; encode thread only.
+    std::unique_ptr<VideoEncoder> m_pVideoEncoder;     // Set while the codec is an inter-frame one.
+    boost::posix_time::ptime m_lastKeyframeTime;
+    EncoderPool m_encoderPool;
+    FrameBufferPool m_bufferPool; // Encoded frames and bands.
+    std::vector<std::vector<uchar>> m_encodeBuffers; // Per band or region; kept so encoding reuses their capacity.
+    std::vector<CompressFramePtr> m_bandBuffers;     // Bands sent while the frame is encoded.
+    uint32_t m_bandFrameSeq = 0;
+    RateController m_rateController;
+    std::shared_ptr<const FrameCodec> m_pReducedCodec; // Rate controller's variant of m_pReducedBase; encode thread only.
+    std::shared_ptr<const FrameCodec> m_pReducedBase;
+    int m_reducedStep = 0;
+    unsigned m_rateSkipCount = 0;
+    boost::posix_time::ptime m_lastPreRollTime;
+    ProcessingChain m_chain;
+    mutable std::mutex m_chainMutex;
+    std::atomic<int> m_chainFlags{0}; // Read by the detect thread to decide what to snapshot.
+
+public:
+    CameraPipeline(PiMgr * owner, int id, const CaptureConfig & captureConfig, const Config & config);
+    ~CameraPipeline();
+
+    int GetId() const { return m_id; }
+    eBDErrorCode GetErrorCode() const { return m_errorCode; }
+    bool IsRunning() const { return m_running; }
+    bool IsInterrupted() const { return m_interrupted; }
+    void SetInterrupted() { m_interrupted = true; }
+
+    bool Start();
+    void Terminate();
+
+    void SetThreshold(int threshold);
+    void SetBackgroundModel(eBDBackgroundModel model, int learningShift);
+    void SetEventConfig(const MotionEventConfig & eventConfig);
+    void SetDetectionMode(eBDDetectionMode mode);
+    void SetProcessingChain(const std::string & spec);
+    void SetFrameQueueConfig(const FrameQueueConfig & frameQueueConfig);
+    void SetRecordingConfig(const RecordingConfig & recordingConfig);
+    void SetCodec(const std::string & spec);
+    void SetRateConfig(const RateConfig & rateConfig);
+    void OutputStatus();
+    void OutputCaptureConfig() const;
+    void OutputCaptureModes() const;
+    void UpdateCaptureConfig(const std::string & spec);
+    bool LoadZones();
+    void OutputZones() const;
+    void AddZone(const std::string & spec);
+    void ClearZones();
+
+private:
+    void WorkerFunc();
+    void ReleaseCapture();
+    void DetectFrame(VideoFrame & frame, int handoffUs);
+    void ProcessWorker();
+    void EncodeWorker();
+    void SendWorker();
+    StageJobPtr AcquireJob();
+    void RecycleJob(StageJobPtr pJob);
+    void RecordTimes(const int * processUs);
+    // Whole frames are only built with buildFrame, which sending bands may leave unset (null is then returned);
+    // bytes receives the encoded size either way.
+    CompressFramePtr CompressFrame(const FrameCodec & codec, const cv::Mat * pFrame, bool sendBands, bool buildFrame,
+                                   size_t & bytes);
+    CompressFramePtr CompressRegions(const FrameCodec & codec, const cv::Mat & frame,
+                                     const std::vector<cv::Rect> & regions);
+};
+
+#endif /* CAMERAPIPELINE_H_ */
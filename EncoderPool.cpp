@@ -0,0 +1,79 @@
+
+#include <algorithm>
+
+#include "EncoderPool.h"
+#include "Tracer.h"
+
+
+using namespace std;
+
+
+EncoderPool::EncoderPool(int numThreads)
+{
+    if (numThreads <= 0)
+        numThreads = max((int)boost::thread::hardware_concurrency(), 1);
+
+    for (int i = 1; i < numThreads; ++i)
+        m_threads.emplace_back(&EncoderPool::WorkerFunc, this);
+}
+
+EncoderPool::~EncoderPool()
+{
+    {
+        boost::mutex::scoped_lock lock(m_mutex);
+        m_stopping = true;
+    }
+    m_workReady.notify_all();
+
+    for (boost::thread & thread : m_threads)
+        thread.join();
+}
+
+void EncoderPool::Run(int numTasks, const function<void(int)> & task)
+{
+    // The workers use the caller's task until the last one finishes, so an interrupt must not end the wait early.
+    boost::this_thread::disable_interruption noInterrupt;
+
+    boost::mutex::scoped_lock lock(m_mutex);
+    m_pTask = &task;
+    m_numTasks = numTasks;
+    m_nextTask = 0;
+    m_unfinished = numTasks;
+    m_workReady.notify_all();
+
+    while (m_nextTask < m_numTasks)
+    {
+        int index = m_nextTask++;
+        lock.unlock();
+        task(index);
+        lock.lock();
+        --m_unfinished;
+    }
+
+    while (m_unfinished > 0)
+        m_workDone.wait(lock);
+    m_pTask = nullptr;
+}
+
+void EncoderPool::WorkerFunc()
+{
+    Tracer::SetThreadName("encoder");
+
+    boost::mutex::scoped_lock lock(m_mutex);
+    while (true)
+    {
+        while ( !m_stopping && (m_nextTask >= m_numTasks) )
+            m_workReady.wait(lock);
+        if (m_stopping)
+            return;
+
+        int index = m_nextTask++;
+        const function<void(int)> & task = *m_pTask;
+        lock.unlock();
+        task(index);
+        lock.lock();
+
+        if (--m_unfinished == 0)
+            m_workDone.notify_one();
+    }
+}
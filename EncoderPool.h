@@ -0,0 +1,40 @@
+#ifndef ENCODERPOOL_H_
+#define ENCODERPOOL_H_
+
+#include <functional>
+#include <vector>
+#include <boost/thread.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+
+
+// Long-lived threads that share the encoding of one frame's bands or regions.
+// Threads are started once and sleep between frames, instead of a parallel region being set up for every frame.
+class EncoderPool
+{
+    std::vector<boost::thread> m_threads;
+    boost::mutex m_mutex;
+    boost::condition_variable m_workReady;
+    boost::condition_variable m_workDone;
+    const std::function<void(int)> * m_pTask = nullptr;
+    int m_numTasks = 0;
+    int m_nextTask = 0;
+    int m_unfinished = 0;
+    bool m_stopping = false;
+
+public:
+    // numThreads of 0 means one per core. The thread calling Run works too, so the pool itself has one fewer.
+    explicit EncoderPool(int numThreads = 0);
+    ~EncoderPool();
+
+    // Threads available to Run, the caller included.
+    int GetConcurrency() const { return (int)m_threads.size() + 1; }
+
+    // Call task(0) to task(numTasks - 1) spread over the pool, returning when all are done. One caller at a time.
+    void Run(int numTasks, const std::function<void(int)> & task);
+
+private:
+    void WorkerFunc();
+};
+
+#endif /* ENCODERPOOL_H_ */
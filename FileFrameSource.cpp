@@ -0,0 +1,83 @@
+
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "FileFrameSource.h"
+
+
+using namespace std;
+
+
+FileFrameSource::FileFrameSource(const CaptureConfig & config) :
+    PacedFrameSource(config)
+{
+}
+
+FileFrameSource::~FileFrameSource()
+{
+    CloseContent();
+}
+
+bool FileFrameSource::OpenContent()
+{
+    m_fileFd = open(m_config.path.c_str(), O_RDONLY);
+    if (m_fileFd == -1)
+    {
+        cout << "Error opening frame file " << m_config.path << endl;
+        return false;
+    }
+
+    struct stat st;
+    if (fstat(m_fileFd, &st) == -1)
+    {
+        cout << "Error querying frame file size" << endl;
+        return false;
+    }
+
+    m_fileSize = st.st_size;
+    m_numFrames = m_fileSize / GetBufferSize();
+    if (m_numFrames == 0)
+    {
+        cout << "Frame file smaller than a single " << m_config.width << "x" << m_config.height << " frame" << endl;
+        return false;
+    }
+    if (m_fileSize % GetBufferSize())
+        cout << "Warning: Frame file has trailing partial frame - ignoring it" << endl;
+
+    m_pData = static_cast<unsigned char *>(mmap(nullptr, m_fileSize, PROT_READ, MAP_PRIVATE, m_fileFd, 0));
+    if (m_pData == MAP_FAILED)
+    {
+        m_pData = nullptr;
+        cout << "Error mapping frame file" << endl;
+        return false;
+    }
+    madvise(m_pData, m_fileSize, MADV_SEQUENTIAL);
+
+    cout << "Replaying " << m_numFrames << " frames from " << m_config.path << endl;
+    return true;
+}
+
+void FileFrameSource::CloseContent()
+{
+    if (m_pData)
+    {
+        munmap(m_pData, m_fileSize);
+        m_pData = nullptr;
+    }
+
+    if (m_fileFd != -1)
+    {
+        close(m_fileFd);
+        m_fileFd = -1;
+    }
+}
+
+void FileFrameSource::FillFrame(unsigned char * pData, uint64_t frameNumber)
+{
+    const size_t frameSize = GetBufferSize();
+    memcpy(pData, m_pData + (frameNumber % m_numFrames) * frameSize, frameSize);
+}
@@ -0,0 +1,25 @@
+#ifndef FILEFRAMESOURCE_H_
+#define FILEFRAMESOURCE_H_
+
+#include "PacedFrameSource.h"
+
+
+// Replays a file of back-to-back raw frames (e.g. a dump of captured buffers), looping at end of file.
+class FileFrameSource : public PacedFrameSource
+{
+    int m_fileFd = -1;
+    unsigned char * m_pData = nullptr;
+    size_t m_fileSize = 0;
+    uint64_t m_numFrames = 0;
+
+public:
+    FileFrameSource(const CaptureConfig & config);
+    ~FileFrameSource();
+
+protected:
+    bool OpenContent() override;
+    void CloseContent() override;
+    void FillFrame(unsigned char * pData, uint64_t frameNumber) override;
+};
+
+#endif /* FILEFRAMESOURCE_H_ */
@@ -0,0 +1,38 @@
+
+#include "FrameBufferPool.h"
+
+
+using namespace std;
+
+
+FrameBufferPool::BufferPtr FrameBufferPool::Acquire()
+{
+    unique_ptr<vector<unsigned char>> pBuffer;
+    {
+        lock_guard<mutex> lock(m_pFree->mutex);
+        if (!m_pFree->buffers.empty())
+        {
+            // Most recently returned first, as it is the likeliest to still be in cache.
+            pBuffer = move(m_pFree->buffers.back());
+            m_pFree->buffers.pop_back();
+        }
+    }
+    if (!pBuffer)
+        pBuffer.reset(new vector<unsigned char>());
+
+    weak_ptr<FreeList> wpFree = m_pFree;
+    return BufferPtr(pBuffer.release(), [wpFree](vector<unsigned char> * pBuffer) { Release(wpFree, pBuffer); });
+}
+
+void FrameBufferPool::Release(const weak_ptr<FreeList> & wpFree, vector<unsigned char> * pBuffer)
+{
+    unique_ptr<vector<unsigned char>> pOwned(pBuffer);
+    shared_ptr<FreeList> pFree = wpFree.lock();
+    if (!pFree)
+        return;
+
+    pOwned->clear();
+    lock_guard<mutex> lock(pFree->mutex);
+    if (pFree->buffers.size() < c_maxFree)
+        pFree->buffers.push_back(move(pOwned));
+}
@@ -0,0 +1,40 @@
+#ifndef FRAMEBUFFERPOOL_H_
+#define FRAMEBUFFERPOOL_H_
+
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+
+// Recycles the buffers encoded frames are written into, so once the pool has warmed up encoding allocates nothing.
+// Buffers are handed out as shared pointers that give the buffer, capacity and all, back to the pool when its last
+// owner (frame queue, socket manager or recorder) lets go, on whichever thread that is. Buffers may outlive the
+// pool; they are then freed instead.
+class FrameBufferPool
+{
+    static constexpr size_t c_maxFree = 64; // Beyond this, returned buffers are freed rather than kept.
+
+public:
+    using BufferPtr = std::shared_ptr<std::vector<unsigned char>>;
+
+private:
+    struct FreeList
+    {
+        std::mutex mutex;
+        std::vector<std::unique_ptr<std::vector<unsigned char>>> buffers;
+    };
+
+    std::shared_ptr<FreeList> m_pFree;
+
+public:
+    FrameBufferPool() : m_pFree(std::make_shared<FreeList>()) {}
+
+    // An empty buffer, most likely with the capacity of a recent frame.
+    BufferPtr Acquire();
+
+private:
+    static void Release(const std::weak_ptr<FreeList> & wpFree, std::vector<unsigned char> * pBuffer);
+};
+
+#endif /* FRAMEBUFFERPOOL_H_ */
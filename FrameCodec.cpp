@@ -0,0 +1,291 @@
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <lz4.h>
+
+#include "FrameCodec.h"
+#include "H264Codec.h"
+
+
+using namespace std;
+using namespace cv;
+
+
+const char * const FrameCodec::c_codecNames[] = {"png", "jpeg", "qoi", "lz4", "h264"};
+
+
+// OpenCV's encoders fill a whole vector, so output going after a header passes through a per-thread scratch buffer.
+static void AppendImage(const char * ext, const Mat & image, const vector<int> & params, vector<uchar> & out)
+{
+    if (out.empty())
+    {
+        imencode(ext, image, out, params);
+        return;
+    }
+
+    thread_local vector<uchar> t_scratch;
+    imencode(ext, image, t_scratch, params);
+    out.insert(out.end(), t_scratch.begin(), t_scratch.end());
+}
+
+
+class PngCodec : public FrameCodec
+{
+    vector<int> m_params;
+    int m_level;
+
+public:
+    PngCodec(int level) : m_params({IMWRITE_PNG_COMPRESSION, level}), m_level(level) {}
+
+    eBDCodec GetId() const override { return CDC_PNG; }
+    string GetSpec() const override { return "png:" + to_string(m_level); }
+    FrameCodec * CreateReduced(int step) const override { return new PngCodec(min(m_level + 3 * step, 9)); }
+
+    void Encode(const Mat & image, vector<uchar> & out) const override
+    {
+        AppendImage(".png", image, m_params, out);
+    }
+};
+
+// Goes through OpenCV's JPEG encoder, which is libjpeg-turbo on Raspberry Pi OS.
+class JpegCodec : public FrameCodec
+{
+    vector<int> m_params;
+    int m_quality;
+
+public:
+    JpegCodec(int quality) : m_params({IMWRITE_JPEG_QUALITY, quality}), m_quality(quality) {}
+
+    eBDCodec GetId() const override { return CDC_JPEG; }
+    string GetSpec() const override { return "jpeg:" + to_string(m_quality); }
+    FrameCodec * CreateReduced(int step) const override
+    {
+        // Never above the configured quality: a low one is already as small as this codec goes.
+        int quality = min(m_quality, max(m_quality - 15 * step, 20));
+        return (quality < m_quality) ? new JpegCodec(quality) : nullptr;
+    }
+
+    void Encode(const Mat & image, vector<uchar> & out) const override
+    {
+        AppendImage(".jpg", image, m_params, out);
+    }
+};
+
+// "Quite OK Image" format (qoiformat.org): lossless, single pass, several times faster than PNG.
+// Always written as 3-channel RGB; gray images repeat the value in each channel.
+class QoiCodec : public FrameCodec
+{
+    enum eBDQoiOp
+    {
+        QOI_OP_INDEX = 0x00,
+        QOI_OP_DIFF = 0x40,
+        QOI_OP_LUMA = 0x80,
+        QOI_OP_RUN = 0xc0,
+        QOI_OP_RGB = 0xfe
+    };
+
+    static constexpr int c_headerSize = 14;
+    static constexpr int c_maxRun = 62;
+
+    template <int channels>
+    static uint8_t * EncodePixels(const Mat & image, uint8_t * p)
+    {
+        uint32_t index[64] = {};
+        int pr = 0, pg = 0, pb = 0;
+        int run = 0;
+
+        for (int y = 0; y < image.rows; ++y)
+        {
+            const uint8_t * pRow = image.ptr<uint8_t>(y);
+            for (int x = 0; x < image.cols; ++x)
+            {
+                int r, g, b;
+                if (channels == 1)
+                    r = g = b = pRow[x];
+                else
+                {
+                    b = pRow[3 * x];
+                    g = pRow[3 * x + 1];
+                    r = pRow[3 * x + 2];
+                }
+
+                if ( (r == pr) && (g == pg) && (b == pb) )
+                {
+                    if (++run == c_maxRun)
+                    {
+                        *p++ = (uint8_t)(QOI_OP_RUN | (run - 1));
+                        run = 0;
+                    }
+                    continue;
+                }
+
+                if (run)
+                {
+                    *p++ = (uint8_t)(QOI_OP_RUN | (run - 1));
+                    run = 0;
+                }
+
+                uint32_t px = r | (g << 8) | (b << 16) | 0xff000000u;
+                int hash = (r * 3 + g * 5 + b * 7 + 255 * 11) % 64;
+                if (index[hash] == px)
+                    *p++ = (uint8_t)(QOI_OP_INDEX | hash);
+                else
+                {
+                    index[hash] = px;
+
+                    int vr = (int8_t)(r - pr);
+                    int vg = (int8_t)(g - pg);
+                    int vb = (int8_t)(b - pb);
+                    int vgr = (int8_t)(vr - vg);
+                    int vgb = (int8_t)(vb - vg);
+
+                    if ( (vr >= -2) && (vr <= 1) && (vg >= -2) && (vg <= 1) && (vb >= -2) && (vb <= 1) )
+                        *p++ = (uint8_t)(QOI_OP_DIFF | ((vr + 2) << 4) | ((vg + 2) << 2) | (vb + 2));
+                    else if ( (vg >= -32) && (vg <= 31) && (vgr >= -8) && (vgr <= 7) && (vgb >= -8) && (vgb <= 7) )
+                    {
+                        *p++ = (uint8_t)(QOI_OP_LUMA | (vg + 32));
+                        *p++ = (uint8_t)(((vgr + 8) << 4) | (vgb + 8));
+                    }
+                    else
+                    {
+                        *p++ = QOI_OP_RGB;
+                        *p++ = (uint8_t)r;
+                        *p++ = (uint8_t)g;
+                        *p++ = (uint8_t)b;
+                    }
+                }
+
+                pr = r;
+                pg = g;
+                pb = b;
+            }
+        }
+
+        if (run)
+            *p++ = (uint8_t)(QOI_OP_RUN | (run - 1));
+        return p;
+    }
+
+    static uint8_t * PutBigEndian(uint8_t * p, uint32_t value)
+    {
+        *p++ = (uint8_t)(value >> 24);
+        *p++ = (uint8_t)(value >> 16);
+        *p++ = (uint8_t)(value >> 8);
+        *p++ = (uint8_t)value;
+        return p;
+    }
+
+public:
+    eBDCodec GetId() const override { return CDC_QOI; }
+    string GetSpec() const override { return "qoi"; }
+
+    void Encode(const Mat & image, vector<uchar> & out) const override
+    {
+        static const uint8_t c_padding[8] = {0, 0, 0, 0, 0, 0, 0, 1};
+
+        // Worst case is a 4-byte RGB op for every pixel.
+        size_t start = out.size();
+        out.resize(start + c_headerSize + image.total() * 4 + sizeof(c_padding));
+        uint8_t * p = out.data() + start;
+
+        *p++ = 'q';
+        *p++ = 'o';
+        *p++ = 'i';
+        *p++ = 'f';
+        p = PutBigEndian(p, image.cols);
+        p = PutBigEndian(p, image.rows);
+        *p++ = 3; // RGB
+        *p++ = 0; // sRGB with linear alpha
+
+        p = (image.channels() == 1) ? EncodePixels<1>(image, p) : EncodePixels<3>(image, p);
+
+        for (uint8_t padding : c_padding)
+            *p++ = padding;
+        out.resize(p - out.data());
+    }
+};
+
+// Raw gray pixels, LZ4 compressed; for debugging the pipeline without codec artifacts or cost.
+// Payload is uint16 width, uint16 height, then one LZ4 block.
+class Lz4Codec : public FrameCodec
+{
+public:
+    eBDCodec GetId() const override { return CDC_LZ4; }
+    string GetSpec() const override { return "lz4"; }
+
+    void Encode(const Mat & image, vector<uchar> & out) const override
+    {
+        Mat gray;
+        if (image.channels() == 3)
+            cvtColor(image, gray, COLOR_BGR2GRAY);
+        else if (!image.isContinuous())
+            gray = image.clone();
+        else
+            gray = image;
+
+        int size = (int)gray.total();
+        uint16_t dims[2] = {(uint16_t)gray.cols, (uint16_t)gray.rows};
+        size_t start = out.size();
+        int bound = LZ4_compressBound(size);
+        out.resize(start + sizeof(dims) + bound);
+        memcpy(out.data() + start, dims, sizeof(dims));
+
+        int compressedSize = LZ4_compress_default((const char *)gray.data, (char *)out.data() + start + sizeof(dims),
+                                                  size, bound);
+        out.resize(start + sizeof(dims) + max(compressedSize, 0));
+    }
+};
+
+
+FrameCodec * FrameCodec::Create(const string & spec)
+{
+    size_t pos = spec.find(':');
+    string name = spec.substr(0, pos);
+
+    if (name == "h264")
+        return H264Codec::Create((pos == string::npos) ? string() : spec.substr(pos + 1));
+
+    bool hasArg = (pos != string::npos);
+    int arg = 0;
+    if (hasArg)
+    {
+        string value = spec.substr(pos + 1);
+        char * pEnd;
+        arg = (int)strtol(value.c_str(), &pEnd, 10);
+        if ( value.empty() || (*pEnd != '\0') )
+        {
+            cerr << "Error: Invalid codec argument '" << value << "'." << endl;
+            return nullptr;
+        }
+    }
+
+    if (name == "png")
+    {
+        if ( hasArg && ((arg < 0) || (arg > 9)) )
+        {
+            cerr << "Error: PNG compression level must be 0-9." << endl;
+            return nullptr;
+        }
+        return new PngCodec(hasArg ? arg : 1);
+    }
+    else if (name == "jpeg")
+    {
+        if ( hasArg && ((arg < 1) || (arg > 100)) )
+        {
+            cerr << "Error: JPEG quality must be 1-100." << endl;
+            return nullptr;
+        }
+        return new JpegCodec(hasArg ? arg : 80);
+    }
+    else if ( (name == "qoi") && !hasArg )
+        return new QoiCodec();
+    else if ( (name == "lz4") && !hasArg )
+        return new Lz4Codec();
+
+    cerr << "Error: Unknown codec '" << spec << "'; expected png[:<level>], jpeg[:<quality>], qoi, lz4 or "
+            "h264[:<options>]." << endl;
+    return nullptr;
+}
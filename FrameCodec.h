@@ -0,0 +1,47 @@
+#ifndef FRAMECODEC_H_
+#define FRAMECODEC_H_
+
+#include <string>
+#include <vector>
+#include <opencv2/opencv.hpp>
+
+#include "SocketMgr.h"
+
+
+// Stateful whole-frame encoder for inter-frame codecs. Frames must be passed in order, from a single thread.
+class VideoEncoder
+{
+public:
+    virtual ~VideoEncoder() = default;
+
+    // Encode the next frame. Output may be empty if the encoder holds the frame back. keyframe is set if the output
+    // decodes on its own; forceKeyframe asks for one, e.g. for a newly connected client.
+    virtual bool Encode(const cv::Mat & frame, bool forceKeyframe, std::vector<uchar> & out, bool & keyframe) = 0;
+};
+
+
+// Image encoder for transmitted and recorded frames. Frames are split into bands (and region frames into regions),
+// each encoded separately on the camera's EncoderPool, so Encode must be safe to call concurrently.
+// Inter-frame codecs instead provide a VideoEncoder for whole frames, and their Encode is unused.
+class FrameCodec
+{
+public:
+    static const char * const c_codecNames[];
+
+    virtual ~FrameCodec() = default;
+
+    virtual eBDCodec GetId() const = 0;
+    virtual std::string GetSpec() const = 0;
+    // Append the encoded image to out, so it can go straight after a header in the buffer that is sent.
+    virtual void Encode(const cv::Mat & image, std::vector<uchar> & out) const = 0;
+    virtual VideoEncoder * CreateVideoEncoder() const { return nullptr; }
+    // Variant giving smaller output at some cost in quality (step 1 the mildest), for a congested link; null if the
+    // codec has no such setting or is already at its smallest.
+    virtual FrameCodec * CreateReduced(int) const { return nullptr; }
+
+    // Create a codec from e.g. "png:1", "jpeg:80", "qoi", "lz4" or "h264:preset=veryfast,gop=60,crf=26", or return
+    // null if the spec is invalid.
+    static FrameCodec * Create(const std::string & spec);
+};
+
+#endif /* FRAMECODEC_H_ */
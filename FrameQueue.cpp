@@ -0,0 +1,254 @@
+
+#include <algorithm>
+#include <cstdlib>
+#include <iostream>
+#include <sstream>
+
+#include "FrameQueue.h"
+
+
+using namespace std;
+
+
+const char * const FrameQueue::c_policyNames[] = {"drop-oldest", "drop-newest", "keep-latest"};
+
+
+bool FrameQueueConfig::Parse(const string & spec, FrameQueueConfig & config)
+{
+    FrameQueueConfig newConfig = config;
+
+    stringstream ss(spec);
+    string item;
+    while (getline(ss, item, ','))
+    {
+        size_t pos = item.find('=');
+        if (pos == string::npos)
+        {
+            cerr << "Error: Malformed queue option '" << item << "'." << endl;
+            return false;
+        }
+
+        string key = item.substr(0, pos);
+        string value = item.substr(pos + 1);
+
+        if (key == "policy")
+        {
+            int policy = 0;
+            while ( (policy < FQP_MAX) && (value != FrameQueue::c_policyNames[policy]) )
+                ++policy;
+            if (policy == FQP_MAX)
+            {
+                cerr << "Error: Unknown queue policy '" << value << "'." << endl;
+                return false;
+            }
+            newConfig.policy = (eBDFrameQueuePolicy)policy;
+            continue;
+        }
+
+        if (key == "send")
+        {
+            if ( (value != "frames") && (value != "bands") )
+            {
+                cerr << "Error: Unknown queue send mode '" << value << "'; expected frames or bands." << endl;
+                return false;
+            }
+            newConfig.sendBands = (value == "bands");
+            continue;
+        }
+
+        int * pField;
+        if (key == "frames")
+            pField = &newConfig.maxFrames;
+        else if (key == "kb")
+            pField = &newConfig.maxKB;
+        else if (key == "latest")
+            pField = &newConfig.keepLatest;
+        else
+        {
+            cerr << "Error: Unknown queue option '" << key << "'." << endl;
+            return false;
+        }
+
+        int n = atoi(value.c_str());
+        if ( (n < 1) || (value.find_first_not_of("0123456789") != string::npos) )
+        {
+            cerr << "Error: Invalid queue " << key << " '" << value << "'." << endl;
+            return false;
+        }
+        *pField = n;
+    }
+
+    config = newConfig;
+    return true;
+}
+
+string FrameQueueConfig::ToString() const
+{
+    stringstream ss;
+    ss << "policy=" << FrameQueue::c_policyNames[policy] << ",frames=" << maxFrames << ",kb=" << maxKB;
+    if (policy == FQP_KEEP_LATEST)
+        ss << ",latest=" << keepLatest;
+    ss << ",send=" << (sendBands ? "bands" : "frames");
+    return ss.str();
+}
+
+
+void FrameQueue::SetConfig(const FrameQueueConfig & config)
+{
+    boost::mutex::scoped_lock lock(m_mutex);
+    m_config = config;
+    Trim();
+}
+
+FrameQueueConfig FrameQueue::GetConfig() const
+{
+    boost::mutex::scoped_lock lock(m_mutex);
+    return m_config;
+}
+
+bool FrameQueue::Push(Frame frame)
+{
+    {
+        boost::mutex::scoped_lock lock(m_mutex);
+        ++m_stats.pushed;
+
+        size_t size = frame.pBuf->size();
+        size_t maxBytes = (size_t)m_config.maxKB * 1024;
+        bool full = ( (m_frames.size() >= (size_t)m_config.maxFrames) || (m_bytes + size > maxBytes) );
+        if (frame.type == FRT_FULL)
+            m_brokenChain = false;
+        if ( (size > maxBytes) || (full && (m_config.policy == FQP_DROP_NEWEST)) ||
+             (m_brokenChain && (frame.type == FRT_DELTA)) )
+        {
+            ++m_stats.dropped;
+            BreakChain();
+            return false;
+        }
+
+        m_frames.push_back(move(frame));
+        m_bytes += size;
+        Trim();
+
+        m_stats.maxFrames = max(m_stats.maxFrames, m_frames.size());
+        m_stats.maxBytes = max(m_stats.maxBytes, m_bytes);
+    }
+
+    m_notEmpty.notify_one();
+    return true;
+}
+
+void FrameQueue::Pop(Frame & frame)
+{
+    boost::mutex::scoped_lock lock(m_mutex);
+    while (m_frames.empty())
+        m_notEmpty.wait(lock);
+
+    frame = move(m_frames.front());
+    m_frames.pop_front();
+    m_bytes -= frame.pBuf->size();
+}
+
+void FrameQueue::Flush()
+{
+    boost::mutex::scoped_lock lock(m_mutex);
+    m_stats.flushed += m_frames.size();
+    m_frames.clear();
+    m_bytes = 0;
+    BreakChain();
+}
+
+bool FrameQueue::TakeKeyframeRequest()
+{
+    boost::mutex::scoped_lock lock(m_mutex);
+    bool requested = m_keyframeRequested;
+    m_keyframeRequested = false;
+    return requested;
+}
+
+FrameQueueStats FrameQueue::GetStats() const
+{
+    boost::mutex::scoped_lock lock(m_mutex);
+    FrameQueueStats stats = m_stats;
+    stats.frames = m_frames.size();
+    stats.bytes = m_bytes;
+    return stats;
+}
+
+void FrameQueue::Trim()
+{
+    if (m_config.policy == FQP_KEEP_LATEST)
+    {
+        // Region frames are useless without the full image before them, so that one stays too. Delta frames also
+        // need every frame in between, so with those only the frames before the full frame can go. Images are
+        // counted rather than frames, so the bands of the image being sent are not dropped for the next one's.
+        size_t keyIndex = m_frames.size();
+        size_t keepFrom = m_frames.size();
+        int images = 0;
+        size_t i = m_frames.size();
+        while ( (i > 0) && ((images < m_config.keepLatest) || (keyIndex == m_frames.size())) )
+        {
+            i = GetImageStart(i - 1);
+            if (images < m_config.keepLatest)
+            {
+                keepFrom = i;
+                ++images;
+            }
+            if ( (keyIndex == m_frames.size()) && ((m_frames[i].type == FRT_FULL) || (m_frames[i].type == FRT_BAND)) )
+                keyIndex = i;
+        }
+
+        size_t keyEnd = keyIndex;
+        while ( (keyEnd < m_frames.size()) && (GetImageStart(keyEnd) == keyIndex) )
+            ++keyEnd;
+
+        if ( !m_frames.empty() && (m_frames.back().type == FRT_DELTA) )
+            keepFrom = (keyIndex < m_frames.size()) ? min(keepFrom, keyIndex) : 0;
+        for (i = keepFrom; i-- > 0; )
+        {
+            if ( (i < keyIndex) || (i >= keyEnd) )
+                DropAt(i);
+        }
+    }
+
+    // The newest frame always fits; Push rejects frames larger than the whole budget.
+    size_t maxBytes = (size_t)m_config.maxKB * 1024;
+    while ( (m_frames.size() > 1) && ((m_frames.size() > (size_t)m_config.maxFrames) || (m_bytes > maxBytes)) )
+        DropAt(0);
+}
+
+size_t FrameQueue::GetImageStart(size_t index) const
+{
+    // Bands of an image are queued back to back, as it is only encoded once the previous one is done.
+    const Frame & frame = m_frames[index];
+    if (frame.type != FRT_BAND)
+        return index;
+
+    while ( (index > 0) && (m_frames[index - 1].type == FRT_BAND) && (m_frames[index - 1].imageSeq == frame.imageSeq) )
+        --index;
+    return index;
+}
+
+void FrameQueue::DropAt(size_t index)
+{
+    // Delta frames after the dropped one have lost a frame they depend on, so they go too.
+    size_t end = index + 1;
+    while ( (end < m_frames.size()) && (m_frames[end].type == FRT_DELTA) )
+        ++end;
+    bool delta = ( (m_frames[index].type == FRT_DELTA) || (end > index + 1) );
+    bool atBack = (end == m_frames.size());
+
+    for (size_t i = index; i < end; ++i)
+        m_bytes -= m_frames[i].pBuf->size();
+    m_frames.erase(m_frames.begin() + index, m_frames.begin() + end);
+    m_stats.dropped += end - index;
+
+    // If no full frame followed, neither will the next deltas decode.
+    if ( delta && atBack )
+        BreakChain();
+}
+
+void FrameQueue::BreakChain()
+{
+    m_brokenChain = true;
+    m_keyframeRequested = true;
+}
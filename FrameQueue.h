@@ -0,0 +1,106 @@
+#ifndef FRAMEQUEUE_H_
+#define FRAMEQUEUE_H_
+
+#include <cstddef>
+#include <deque>
+#include <memory>
+#include <string>
+#include <vector>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+
+#include "FrameBufferPool.h"
+#include "SocketMgr.h"
+
+
+enum eBDFrameQueuePolicy
+{
+    FQP_DROP_OLDEST, // Oldest frames make room for the new one.
+    FQP_DROP_NEWEST, // New frame is discarded while the queue is full.
+    FQP_KEEP_LATEST, // Only the newest images are kept, plus the full one their region frames are pasted over.
+                     // The bands of an image count as one.
+    FQP_MAX
+};
+
+
+struct FrameQueueConfig
+{
+    eBDFrameQueuePolicy policy = FQP_DROP_OLDEST;
+    int maxFrames = 8; // Each band counts as a frame.
+    int maxKB = 4096;
+    int keepLatest = 2; // Images kept by the keep-latest policy, besides the full one.
+    bool sendBands = false; // Whole images go out band by band as each is encoded, rather than as one frame.
+
+    // Parse e.g. "policy=keep-latest,latest=3,frames=8,kb=2048,send=bands", updating only the keys given.
+    static bool Parse(const std::string & spec, FrameQueueConfig & config);
+    std::string ToString() const;
+};
+
+
+struct FrameQueueStats
+{
+    size_t frames = 0;
+    size_t bytes = 0;
+    size_t maxFrames = 0;
+    size_t maxBytes = 0;
+    long long pushed = 0;
+    long long dropped = 0;  // Discarded by the policy or the byte budget.
+    long long flushed = 0;  // Discarded as stale when a client connected.
+};
+
+
+// Compressed frames waiting for the socket manager.
+// Bounded by both a frame count and a byte budget, so a long motion event the client cannot keep up with costs a
+// fixed amount of memory; the policy decides which frames give way.
+// Delta frames depend on every frame before them back to the last full one, so dropping a frame also drops the delta
+// frames after it, and further deltas are refused until the next full frame; the encoder is asked for one.
+class FrameQueue
+{
+public:
+    using FramePtr = FrameBufferPool::BufferPtr;
+
+    struct Frame
+    {
+        eBDFrameType type = FRT_FULL;
+        eBDCodec codec = CDC_PNG;
+        uint32_t imageSeq = 0; // For band frames, the BandHeader frameSeq of their image.
+        FramePtr pBuf;
+    };
+
+    static const char * const c_policyNames[];
+
+private:
+    mutable boost::mutex m_mutex;
+    boost::condition_variable m_notEmpty;
+    std::deque<Frame> m_frames;
+    size_t m_bytes = 0;
+    FrameQueueConfig m_config;
+    FrameQueueStats m_stats;
+    bool m_brokenChain = false;       // Delta frames are refused until the next full frame.
+    bool m_keyframeRequested = false;
+
+public:
+    FrameQueue(const FrameQueueConfig & config) : m_config(config) {}
+
+    void SetConfig(const FrameQueueConfig & config);
+    FrameQueueConfig GetConfig() const;
+
+    // Returns false if the frame itself was dropped.
+    bool Push(Frame frame);
+    // Blocks until a frame is available; interruptible, like BoundedQueue.
+    void Pop(Frame & frame);
+    // Discard everything queued, e.g. frames encoded before the current client connected.
+    void Flush();
+    // True (once) if a drop or flush means the encoder should make its next frame a full one.
+    bool TakeKeyframeRequest();
+
+    FrameQueueStats GetStats() const;
+
+private:
+    void Trim();
+    size_t GetImageStart(size_t index) const;
+    void DropAt(size_t index);
+    void BreakChain();
+};
+
+#endif /* FRAMEQUEUE_H_ */
@@ -0,0 +1,170 @@
+
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <sstream>
+
+#include "FrameSource.h"
+#include "FileFrameSource.h"
+#include "SyntheticFrameSource.h"
+#include "V4L2FrameSource.h"
+
+
+using namespace std;
+
+
+const char * const FrameSource::c_sourceTypeNames[] = {"v4l2", "file", "synthetic"};
+const char * const FrameSource::c_pixelFormatNames[] = {"bgr24", "yuyv", "nv12", "native"};
+
+
+bool CaptureConfig::Parse(const string & spec, CaptureConfig & config)
+{
+    stringstream ss(spec);
+    string item;
+    while (getline(ss, item, ','))
+    {
+        size_t pos = item.find('=');
+        if (pos == string::npos)
+        {
+            cerr << "Error: Malformed capture option '" << item << "'." << endl;
+            return false;
+        }
+
+        string key = item.substr(0, pos);
+        string value = item.substr(pos + 1);
+
+        if (key == "source")
+        {
+            int i;
+            for (i = 0; i < FST_MAX; ++i)
+            {
+                if (value == FrameSource::c_sourceTypeNames[i])
+                    break;
+            }
+            if (i == FST_MAX)
+            {
+                cerr << "Error: Unknown frame source '" << value << "'." << endl;
+                return false;
+            }
+            config.sourceType = (eBDFrameSourceType)i;
+        }
+        else if (key == "path")
+            config.path = value;
+        else if (key == "format")
+        {
+            int i;
+            for (i = 0; i < PXF_MAX; ++i)
+            {
+                if (value == FrameSource::c_pixelFormatNames[i])
+                    break;
+            }
+            if (i == PXF_MAX)
+            {
+                cerr << "Error: Unknown pixel format '" << value << "'." << endl;
+                return false;
+            }
+            config.pixelFormat = (eBDPixelFormat)i;
+        }
+        else if (key == "size")
+        {
+            if ( (sscanf(value.c_str(), "%dx%d", &config.width, &config.height) != 2) ||
+                 (config.width <= 0) || (config.height <= 0) )
+            {
+                cerr << "Error: Invalid frame size '" << value << "'." << endl;
+                return false;
+            }
+        }
+        else if (key == "fps")
+        {
+            config.fps = atoi(value.c_str());
+            if (config.fps < 0)
+            {
+                cerr << "Error: Invalid frame rate '" << value << "'." << endl;
+                return false;
+            }
+        }
+        else if (key == "zones")
+            config.zoneFile = value;
+        else if (key == "cpu")
+        {
+            config.cpu = atoi(value.c_str());
+            if (config.cpu < 0)
+            {
+                cerr << "Error: Invalid CPU '" << value << "'." << endl;
+                return false;
+            }
+        }
+        else
+        {
+            cerr << "Error: Unknown capture option '" << key << "'." << endl;
+            return false;
+        }
+    }
+
+    if ( (config.sourceType == FST_V4L2) && (config.fps == 0) )
+    {
+        cerr << "Error: Video device requires a nonzero frame rate." << endl;
+        return false;
+    }
+
+    if ( (config.sourceType != FST_V4L2) && (config.pixelFormat == PXF_NATIVE) )
+    {
+        cerr << "Error: Native pixel format is only meaningful for a video device." << endl;
+        return false;
+    }
+
+    if ( (config.pixelFormat != PXF_BGR24) && ((config.width % 2) || (config.height % 2)) )
+    {
+        cerr << "Error: YUV formats require even frame dimensions." << endl;
+        return false;
+    }
+
+    return true;
+}
+
+int FrameSource::GetDefaultStride(eBDPixelFormat format, int width)
+{
+    switch (format)
+    {
+    case PXF_BGR24:
+        return width * 3;
+
+    case PXF_YUYV:
+        return width * 2;
+
+    default:
+        return width;
+    }
+}
+
+size_t FrameSource::GetFrameSize(eBDPixelFormat format, int stride, int height)
+{
+    // NV12 is a full resolution Y plane followed by an interleaved, half resolution UV plane.
+    if (format == PXF_NV12)
+        return (size_t)stride * height * 3 / 2;
+
+    return (size_t)stride * height;
+}
+
+void FrameSource::EnumerateModes(vector<CaptureMode> & modes) const
+{
+    modes.push_back({m_config.pixelFormat, m_config.width, m_config.height, {m_config.fps}});
+}
+
+unique_ptr<FrameSource> FrameSource::Create(const CaptureConfig & config)
+{
+    switch (config.sourceType)
+    {
+    case FST_V4L2:
+        return make_unique<V4L2FrameSource>(config);
+
+    case FST_FILE:
+        return make_unique<FileFrameSource>(config);
+
+    case FST_SYNTHETIC:
+        return make_unique<SyntheticFrameSource>(config);
+
+    default:
+        return nullptr;
+    }
+}
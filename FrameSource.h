@@ -0,0 +1,108 @@
+#ifndef FRAMESOURCE_H_
+#define FRAMESOURCE_H_
+
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <vector>
+
+
+struct RawBuffer
+{
+    void * start;
+    size_t length;
+};
+
+enum eBDFrameSourceType
+{
+    FST_V4L2,
+    FST_FILE,
+    FST_SYNTHETIC,
+    FST_MAX
+};
+
+enum eBDPixelFormat
+{
+    PXF_BGR24,
+    PXF_YUYV,
+    PXF_NV12,
+    PXF_NATIVE, // Request only - resolved by the source to the best non-emulated YUV format.
+    PXF_MAX
+};
+
+struct CaptureConfig
+{
+    eBDFrameSourceType sourceType = FST_V4L2;
+    std::string path = "/dev/video0"; // Video device or raw frame file.
+    eBDPixelFormat pixelFormat = PXF_BGR24;
+    int width = 640;
+    int height = 480;
+    int fps = 30; // Zero delivers frames as fast as possible (file and synthetic sources only).
+    int cpu = -1; // Core to pin this camera's capture and processing threads to; -1 leaves placement to the scheduler.
+    std::string zoneFile; // Motion zone definitions for this camera; empty watches the whole frame.
+
+    // Parse comma-separated key=value list, e.g. "source=file,path=/tmp/frames.raw,format=nv12,size=640x480,fps=0,cpu=1".
+    static bool Parse(const std::string & spec, CaptureConfig & config);
+};
+
+// A format/size combination a source can deliver and the frame rates available for it.
+struct CaptureMode
+{
+    eBDPixelFormat pixelFormat;
+    int width;
+    int height;
+    std::vector<int> fps;
+};
+
+
+// Abstract producer of frames into a fixed set of indexed buffers.
+// Buffers cycle between the source (being filled) and the caller (dequeued) exactly like V4L2 mmap buffers.
+// All methods other than GetBuffer are called from the capture thread only.
+class FrameSource
+{
+protected:
+    CaptureConfig m_config;
+    int m_stride; // Bytes per line of the (first) image plane.
+
+public:
+    static const char * const c_sourceTypeNames[];
+    static const char * const c_pixelFormatNames[];
+
+    static std::unique_ptr<FrameSource> Create(const CaptureConfig & config);
+    static int GetDefaultStride(eBDPixelFormat format, int width);
+    static size_t GetFrameSize(eBDPixelFormat format, int stride, int height);
+
+    FrameSource(const CaptureConfig & config) :
+        m_config(config), m_stride(GetDefaultStride(config.pixelFormat, config.width)) {}
+    virtual ~FrameSource() = default;
+
+    const CaptureConfig & GetConfig() const { return m_config; }
+    eBDPixelFormat GetPixelFormat() const { return m_config.pixelFormat; }
+    int GetWidth() const { return m_config.width; }
+    int GetHeight() const { return m_config.height; }
+    int GetStride() const { return m_stride; }
+
+    // Open underlying device or file, negotiate format, and allocate the requested number of buffers.
+    virtual bool Open(int numBuffers) = 0;
+    virtual void Close() = 0;
+
+    // List supported modes. Only valid while open. Default reports the active mode only.
+    virtual void EnumerateModes(std::vector<CaptureMode> & modes) const;
+
+    // Hand all buffers to the source and begin producing frames.
+    virtual bool Start() = 0;
+
+    // Descriptor that becomes readable when a frame may be available for Dequeue.
+    virtual int GetFd() const = 0;
+
+    virtual const RawBuffer & GetBuffer(int index) const = 0;
+
+    // Non-blocking: retrieve index of next filled buffer.
+    // Returns false with errno set to EAGAIN if no frame is ready yet.
+    virtual bool Dequeue(int & index) = 0;
+
+    // Return buffer to the source for filling.
+    virtual bool Enqueue(int index) = 0;
+};
+
+#endif /* FRAMESOURCE_H_ */
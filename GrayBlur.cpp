@@ -0,0 +1,355 @@
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstring>
+#include <omp.h>
+
+#include "GrayBlur.h"
+
+#if defined(__SSE2__)
+#define GRAYBLUR_SSE2
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#define GRAYBLUR_NEON
+#include <arm_neon.h>
+#endif
+
+
+using namespace std;
+using namespace cv;
+
+
+static constexpr int c_stripRows = 32;
+
+// BT.601 luma weights in 8-bit fixed point, as used by the motion kernel.
+static constexpr int c_lumaB = 29;
+static constexpr int c_lumaG = 150;
+static constexpr int c_lumaR = 77;
+
+
+// Border handling matches OpenCV's default (BORDER_REFLECT_101): dcb|abcd|cba.
+static inline int Reflect(int i, int n)
+{
+    if (n == 1)
+        return 0;
+    while ( (i < 0) || (i >= n) )
+        i = (i < 0) ? -i : 2 * n - 2 - i;
+    return i;
+}
+
+static void LumaRow(const uint8_t * pSrc, int channels, uint8_t * pDst, int width)
+{
+    if (channels == 1)
+        memcpy(pDst, pSrc, width);
+    else if (channels == 2)
+    {
+        for (int x = 0; x < width; ++x)
+            pDst[x] = pSrc[2 * x];
+    }
+    else
+    {
+        for (int x = 0; x < width; ++x)
+        {
+            const uint8_t * p = pSrc + 3 * x;
+            pDst[x] = (uint8_t)((c_lumaB * p[0] + c_lumaG * p[1] + c_lumaR * p[2] + 128) >> 8);
+        }
+    }
+}
+
+// Pad a row held at pRow[radius .. radius + width) with reflected samples on both sides.
+static void PadRow(uint8_t * pRow, int width, int radius)
+{
+    for (int i = 1; i <= radius; ++i)
+    {
+        pRow[radius - i] = pRow[radius + Reflect(-i, width)];
+        pRow[radius + width - 1 + i] = pRow[radius + Reflect(width - 1 + i, width)];
+    }
+}
+
+// pDst[x] = sum of pWeights[k] * ppSrc[k][x] for a symmetric kernel, weights in 8-bit fixed point summing to 256.
+// Used both down columns (ppSrc are rows) and along a row (ppSrc are the same row, offset by one sample each).
+// Mirrored taps are added before multiplying, halving the multiplies.
+static void SymmetricSum(const uint8_t * const * ppSrc, const uint16_t * pWeights, int taps, uint8_t * pDst, int width)
+{
+    int radius = taps / 2;
+    int x = 0;
+
+    // 16-bit accumulators cannot overflow: the total is at most 255 * 256 + 128, and no outer weight exceeds 128.
+#if defined(GRAYBLUR_SSE2)
+    const __m128i zero = _mm_setzero_si128();
+    for (; x + 16 <= width; x += 16)
+    {
+        __m128i centre = _mm_loadu_si128((const __m128i *)(ppSrc[radius] + x));
+        __m128i weight = _mm_set1_epi16(pWeights[radius]);
+        __m128i lo = _mm_add_epi16(_mm_set1_epi16(128), _mm_mullo_epi16(_mm_unpacklo_epi8(centre, zero), weight));
+        __m128i hi = _mm_add_epi16(_mm_set1_epi16(128), _mm_mullo_epi16(_mm_unpackhi_epi8(centre, zero), weight));
+        for (int k = 0; k < radius; ++k)
+        {
+            __m128i a = _mm_loadu_si128((const __m128i *)(ppSrc[k] + x));
+            __m128i b = _mm_loadu_si128((const __m128i *)(ppSrc[taps - 1 - k] + x));
+            weight = _mm_set1_epi16(pWeights[k]);
+            __m128i pairLo = _mm_add_epi16(_mm_unpacklo_epi8(a, zero), _mm_unpacklo_epi8(b, zero));
+            __m128i pairHi = _mm_add_epi16(_mm_unpackhi_epi8(a, zero), _mm_unpackhi_epi8(b, zero));
+            lo = _mm_add_epi16(lo, _mm_mullo_epi16(pairLo, weight));
+            hi = _mm_add_epi16(hi, _mm_mullo_epi16(pairHi, weight));
+        }
+        _mm_storeu_si128((__m128i *)(pDst + x), _mm_packus_epi16(_mm_srli_epi16(lo, 8), _mm_srli_epi16(hi, 8)));
+    }
+#elif defined(GRAYBLUR_NEON)
+    for (; x + 16 <= width; x += 16)
+    {
+        uint8x16_t centre = vld1q_u8(ppSrc[radius] + x);
+        uint16x8_t lo = vmlaq_n_u16(vdupq_n_u16(128), vmovl_u8(vget_low_u8(centre)), pWeights[radius]);
+        uint16x8_t hi = vmlaq_n_u16(vdupq_n_u16(128), vmovl_u8(vget_high_u8(centre)), pWeights[radius]);
+        for (int k = 0; k < radius; ++k)
+        {
+            uint8x16_t a = vld1q_u8(ppSrc[k] + x);
+            uint8x16_t b = vld1q_u8(ppSrc[taps - 1 - k] + x);
+            lo = vmlaq_n_u16(lo, vaddl_u8(vget_low_u8(a), vget_low_u8(b)), pWeights[k]);
+            hi = vmlaq_n_u16(hi, vaddl_u8(vget_high_u8(a), vget_high_u8(b)), pWeights[k]);
+        }
+        vst1q_u8(pDst + x, vcombine_u8(vshrn_n_u16(lo, 8), vshrn_n_u16(hi, 8)));
+    }
+#endif
+
+    for (; x < width; ++x)
+    {
+        int sum = 128 + pWeights[radius] * ppSrc[radius][x];
+        for (int k = 0; k < radius; ++k)
+            sum += pWeights[k] * (ppSrc[k][x] + ppSrc[taps - 1 - k][x]);
+        pDst[x] = (uint8_t)(sum >> 8);
+    }
+}
+
+// One step of a vertical running box sum: write the rounded mean of pSums (scale is 1 / box size in 16-bit fixed
+// point, half is half the box size), then slide the window by adding pAdd and removing pRemove (either may be null).
+static void BoxSumRow(uint16_t * pSums, const uint8_t * pAdd, const uint8_t * pRemove, uint16_t scale, uint16_t half,
+                      uint8_t * pDst, int width)
+{
+    int x = 0;
+
+#if defined(GRAYBLUR_SSE2)
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i scales = _mm_set1_epi16(scale);
+    const __m128i halves = _mm_set1_epi16(half);
+    for (; x + 16 <= width; x += 16)
+    {
+        __m128i lo = _mm_loadu_si128((const __m128i *)(pSums + x));
+        __m128i hi = _mm_loadu_si128((const __m128i *)(pSums + x + 8));
+        __m128i meanLo = _mm_mulhi_epu16(_mm_add_epi16(lo, halves), scales);
+        __m128i meanHi = _mm_mulhi_epu16(_mm_add_epi16(hi, halves), scales);
+        _mm_storeu_si128((__m128i *)(pDst + x), _mm_packus_epi16(meanLo, meanHi));
+
+        if (pAdd)
+        {
+            __m128i add = _mm_loadu_si128((const __m128i *)(pAdd + x));
+            __m128i remove = _mm_loadu_si128((const __m128i *)(pRemove + x));
+            lo = _mm_sub_epi16(_mm_add_epi16(lo, _mm_unpacklo_epi8(add, zero)), _mm_unpacklo_epi8(remove, zero));
+            hi = _mm_sub_epi16(_mm_add_epi16(hi, _mm_unpackhi_epi8(add, zero)), _mm_unpackhi_epi8(remove, zero));
+            _mm_storeu_si128((__m128i *)(pSums + x), lo);
+            _mm_storeu_si128((__m128i *)(pSums + x + 8), hi);
+        }
+    }
+#elif defined(GRAYBLUR_NEON)
+    const uint16x4_t scales = vdup_n_u16(scale);
+    const uint16x8_t halves = vdupq_n_u16(half);
+    for (; x + 16 <= width; x += 16)
+    {
+        uint16x8_t sums[2] = {vld1q_u16(pSums + x), vld1q_u16(pSums + x + 8)};
+        uint8x8_t means[2];
+        for (int i = 0; i < 2; ++i)
+        {
+            uint16x8_t rounded = vaddq_u16(sums[i], halves);
+            uint32x4_t low = vmull_u16(vget_low_u16(rounded), scales);
+            uint32x4_t high = vmull_u16(vget_high_u16(rounded), scales);
+            means[i] = vmovn_u16(vcombine_u16(vshrn_n_u32(low, 16), vshrn_n_u32(high, 16)));
+        }
+        vst1q_u8(pDst + x, vcombine_u8(means[0], means[1]));
+
+        if (pAdd)
+        {
+            uint8x16_t add = vld1q_u8(pAdd + x);
+            uint8x16_t remove = vld1q_u8(pRemove + x);
+            vst1q_u16(pSums + x, vsubq_u16(vaddw_u8(sums[0], vget_low_u8(add)), vmovl_u8(vget_low_u8(remove))));
+            vst1q_u16(pSums + x + 8, vsubq_u16(vaddw_u8(sums[1], vget_high_u8(add)), vmovl_u8(vget_high_u8(remove))));
+        }
+    }
+#endif
+
+    for (; x < width; ++x)
+    {
+        pDst[x] = (uint8_t)(((uint32_t)(pSums[x] + half) * scale) >> 16);
+        if (pAdd)
+            pSums[x] += pAdd[x] - pRemove[x];
+    }
+}
+
+
+GrayBlur::GrayBlur(eBDBlurMethod method, int kernelSize) :
+    m_method(method),
+    m_kernelSize(kernelSize)
+{
+    assert( (kernelSize >= 1) && (kernelSize <= c_maxKernelSize) && (kernelSize % 2) );
+
+    // Sigma as GaussianBlur picks it for a sigma of 0.
+    double sigma = 0.3 * ((kernelSize - 1) * 0.5 - 1) + 0.8;
+
+    if (m_method == BLM_BOX)
+    {
+        // Three passes of a box of width 2r + 1 have variance r * (r + 1); pick the r that comes closest to sigma.
+        // Small kernels have no box wider than one sample to match them, so those stay Gaussian.
+        m_boxRadius = (int)lround((sqrt(4 * sigma * sigma + 1) - 1) / 2);
+        if (m_boxRadius == 0)
+            m_method = BLM_GAUSSIAN;
+
+        // A full box of 255s, plus rounding, must fit the 16-bit sums in BoxSumRow.
+        assert(2 * m_boxRadius + 1 <= 256);
+    }
+
+    if (m_method == BLM_GAUSSIAN)
+    {
+        int radius = kernelSize / 2;
+        vector<double> taps(kernelSize);
+        double total = 0.0;
+        for (int i = 0; i < kernelSize; ++i)
+        {
+            taps[i] = exp(-(i - radius) * (i - radius) / (2 * sigma * sigma));
+            total += taps[i];
+        }
+
+        // Rounding leaves the sum a little off 256; the centre tap takes up the difference.
+        m_weights.resize(kernelSize);
+        int sum = 0;
+        for (int i = 0; i < kernelSize; ++i)
+        {
+            m_weights[i] = (uint16_t)lround(taps[i] / total * 256);
+            sum += m_weights[i];
+        }
+        m_weights[radius] += 256 - sum;
+    }
+}
+
+void GrayBlur::Apply(const Mat & src, Mat & dst)
+{
+    dst.create(src.size(), CV_8UC1);
+    if (m_scratch.size() < (size_t)omp_get_max_threads())
+        m_scratch.resize(omp_get_max_threads());
+
+    int numStrips = (src.rows + c_stripRows - 1) / c_stripRows;
+
+    #pragma omp parallel for schedule(dynamic)
+    for (int i = 0; i < numStrips; ++i)
+    {
+        int y0 = i * c_stripRows;
+        int y1 = min(y0 + c_stripRows, src.rows);
+        Scratch & scratch = m_scratch[omp_get_thread_num()];
+        if ( (m_method == BLM_GAUSSIAN) && (m_kernelSize == 1) )
+        {
+            for (int y = y0; y < y1; ++y)
+                LumaRow(src.ptr<uint8_t>(y), src.channels(), dst.ptr<uint8_t>(y), src.cols);
+        }
+        else if (m_method == BLM_GAUSSIAN)
+            GaussianStrip(src, dst, y0, y1, scratch);
+        else
+            BoxStrip(src, dst, y0, y1, scratch);
+    }
+}
+
+void GrayBlur::GaussianStrip(const Mat & src, Mat & dst, int y0, int y1, Scratch & scratch) const
+{
+    int width = src.cols;
+    int radius = m_kernelSize / 2;
+    int taps = m_kernelSize;
+    int lumaRows = y1 - y0 + 2 * radius;
+
+    scratch.luma.resize((size_t)lumaRows * width);
+    scratch.row.resize(width + 2 * radius);
+    for (int i = 0; i < lumaRows; ++i)
+        LumaRow(src.ptr<uint8_t>(Reflect(y0 - radius + i, src.rows)), src.channels(), &scratch.luma[(size_t)i * width],
+                width);
+
+    vector<const uint8_t *> & sources = scratch.sources;
+    sources.resize(taps);
+    for (int y = y0; y < y1; ++y)
+    {
+        // Down the columns into the middle of the padded row buffer, then along it.
+        for (int k = 0; k < taps; ++k)
+            sources[k] = &scratch.luma[(size_t)(y - y0 + k) * width];
+        SymmetricSum(sources.data(), m_weights.data(), taps, &scratch.row[radius], width);
+        PadRow(scratch.row.data(), width, radius);
+
+        for (int k = 0; k < taps; ++k)
+            sources[k] = &scratch.row[k];
+        SymmetricSum(sources.data(), m_weights.data(), taps, dst.ptr<uint8_t>(y), width);
+    }
+}
+
+// Three box passes down the columns of a rows x width image, each a running sum that leaves radius fewer rows at
+// either end. pIn and pTemp are swapped between passes; returns whichever holds the result.
+static uint8_t * BoxPasses(uint8_t * pIn, uint8_t * pTemp, uint16_t * pSums, int rows, int width, int radius)
+{
+    static constexpr int c_passes = 3;
+
+    int boxSize = 2 * radius + 1;
+    uint16_t scale = (uint16_t)((65536 + boxSize / 2) / boxSize); // 1 / boxSize in 16-bit fixed point.
+    uint16_t half = (uint16_t)(boxSize / 2);
+
+    for (int pass = 0; pass < c_passes; ++pass, rows -= 2 * radius)
+    {
+        memset(pSums, 0, width * sizeof(uint16_t));
+        for (int k = 0; k < boxSize; ++k)
+        {
+            const uint8_t * pRow = pIn + (size_t)k * width;
+            for (int x = 0; x < width; ++x)
+                pSums[x] += pRow[x];
+        }
+
+        for (int i = 0; i < rows - 2 * radius; ++i)
+        {
+            bool slide = (i + boxSize < rows);
+            BoxSumRow(pSums, slide ? pIn + (size_t)(i + boxSize) * width : nullptr, pIn + (size_t)i * width, scale,
+                      half, pTemp + (size_t)i * width, width);
+        }
+        swap(pIn, pTemp);
+    }
+    return pIn;
+}
+
+void GrayBlur::BoxStrip(const Mat & src, Mat & dst, int y0, int y1, Scratch & scratch) const
+{
+    int width = src.cols;
+    int rows = y1 - y0;
+    int reach = 3 * m_boxRadius; // Of all three passes together.
+    int lumaRows = rows + 2 * reach;
+    int paddedWidth = width + 2 * reach;
+
+    scratch.luma.resize((size_t)lumaRows * width);
+    scratch.temp.resize((size_t)lumaRows * width);
+    scratch.columns.resize((size_t)paddedWidth * rows);
+    scratch.columns2.resize((size_t)paddedWidth * rows);
+    scratch.sums.resize(max(width, rows));
+    for (int i = 0; i < lumaRows; ++i)
+        LumaRow(src.ptr<uint8_t>(Reflect(y0 - reach + i, src.rows)), src.channels(), &scratch.luma[(size_t)i * width],
+                width);
+
+    const uint8_t * pBlurred = BoxPasses(scratch.luma.data(), scratch.temp.data(), scratch.sums.data(), lumaRows,
+                                         width, m_boxRadius);
+
+    // The horizontal passes would be serial along each row; transposed, they run down columns like the vertical ones.
+    uint8_t * pColumns = scratch.columns.data();
+    for (int x = 0; x < paddedWidth; ++x)
+    {
+        const uint8_t * pSrc = pBlurred + Reflect(x - reach, width);
+        for (int i = 0; i < rows; ++i)
+            pColumns[(size_t)x * rows + i] = pSrc[(size_t)i * width];
+    }
+
+    pBlurred = BoxPasses(pColumns, scratch.columns2.data(), scratch.sums.data(), paddedWidth, rows, m_boxRadius);
+    for (int i = 0; i < rows; ++i)
+    {
+        uint8_t * pDst = dst.ptr<uint8_t>(y0 + i);
+        for (int x = 0; x < width; ++x)
+            pDst[x] = pBlurred[(size_t)x * rows + i];
+    }
+}
@@ -0,0 +1,59 @@
+#ifndef GRAYBLUR_H_
+#define GRAYBLUR_H_
+
+#include <cstdint>
+#include <vector>
+#include <opencv2/opencv.hpp>
+
+
+enum eBDBlurMethod
+{
+    BLM_GAUSSIAN, // Separable Gaussian in 8-bit fixed point, close to GaussianBlur with sigma 0.
+    BLM_BOX,      // Three box blurs from running sums; cost does not grow with the kernel size. Small kernels stay
+                  // Gaussian, as no box is narrow enough to match them.
+    BLM_MAX
+};
+
+
+// Fused luma conversion and blur.
+// The image is worked through in strips of rows, spread over OpenMP threads. Each strip converts just the source
+// rows it needs (plus the kernel's reach above and below) to luma in a small buffer that stays in cache, then blurs
+// vertically and horizontally from there, so the frame is read once and no full-size intermediate is written.
+// Input is gray, packed YUYV (luma from the even bytes) or BGR; output is a gray image of the same size.
+class GrayBlur
+{
+    struct Scratch
+    {
+        std::vector<uint8_t> luma;
+        std::vector<uint8_t> temp;
+        std::vector<uint8_t> row;
+        std::vector<uint8_t> columns; // Transposed strip.
+        std::vector<uint8_t> columns2;
+        std::vector<uint16_t> sums;
+        std::vector<const uint8_t *> sources;
+    };
+
+    eBDBlurMethod m_method;
+    int m_kernelSize;
+    std::vector<uint16_t> m_weights; // Gaussian taps in 8-bit fixed point, summing to 256.
+    int m_boxRadius = 0;
+    std::vector<Scratch> m_scratch;  // One per OpenMP thread.
+
+public:
+    // Keeps the box width well inside what the 16-bit running sums hold (256 samples), and the strip buffers small.
+    static constexpr int c_maxKernelSize = 99;
+
+    // kernelSize is odd, 1 to c_maxKernelSize.
+    GrayBlur(eBDBlurMethod method, int kernelSize);
+
+    eBDBlurMethod GetMethod() const { return m_method; } // As applied, after any fallback to Gaussian.
+    int GetKernelSize() const { return m_kernelSize; }
+
+    void Apply(const cv::Mat & src, cv::Mat & dst);
+
+private:
+    void GaussianStrip(const cv::Mat & src, cv::Mat & dst, int y0, int y1, Scratch & scratch) const;
+    void BoxStrip(const cv::Mat & src, cv::Mat & dst, int y0, int y1, Scratch & scratch) const;
+};
+
+#endif /* GRAYBLUR_H_ */
@@ -0,0 +1,200 @@
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+#include <x264.h>
+
+#include "H264Codec.h"
+
+
+using namespace std;
+using namespace cv;
+
+
+H264Codec * H264Codec::Create(const string & options)
+{
+    H264Config config;
+
+    stringstream ss(options);
+    string item;
+    while (getline(ss, item, ','))
+    {
+        size_t pos = item.find('=');
+        if (pos == string::npos)
+        {
+            cerr << "Error: Malformed h264 option '" << item << "'." << endl;
+            return nullptr;
+        }
+
+        string key = item.substr(0, pos);
+        string value = item.substr(pos + 1);
+
+        if (key == "preset")
+        {
+            bool known = false;
+            for (int i = 0; x264_preset_names[i]; ++i)
+                known |= (value == x264_preset_names[i]);
+            if (!known)
+            {
+                cerr << "Error: Unknown x264 preset '" << value << "'." << endl;
+                return nullptr;
+            }
+            config.preset = value;
+            continue;
+        }
+
+        int * pField;
+        int minValue, maxValue;
+        if (key == "gop")
+        {
+            pField = &config.gop;
+            minValue = 1;
+            maxValue = 1000;
+        }
+        else if (key == "crf")
+        {
+            pField = &config.crf;
+            minValue = 0;
+            maxValue = 51;
+        }
+        else
+        {
+            cerr << "Error: Unknown h264 option '" << key << "'." << endl;
+            return nullptr;
+        }
+
+        int n = atoi(value.c_str());
+        if ( value.empty() || (value.find_first_not_of("0123456789") != string::npos) || (n < minValue) ||
+             (n > maxValue) )
+        {
+            cerr << "Error: Invalid h264 " << key << " '" << value << "'." << endl;
+            return nullptr;
+        }
+        *pField = n;
+    }
+
+    return new H264Codec(config);
+}
+
+string H264Codec::GetSpec() const
+{
+    stringstream ss;
+    ss << "h264:preset=" << m_config.preset << ",gop=" << m_config.gop << ",crf=" << m_config.crf;
+    return ss.str();
+}
+
+VideoEncoder * H264Codec::CreateVideoEncoder() const
+{
+    return new H264Encoder(m_config);
+}
+
+FrameCodec * H264Codec::CreateReduced(int step) const
+{
+    H264Config config = m_config;
+    config.crf = min(config.crf + 4 * step, 51);
+    return new H264Codec(config);
+}
+
+
+H264Encoder::~H264Encoder()
+{
+    Close();
+}
+
+bool H264Encoder::Encode(const Mat & frame, bool forceKeyframe, vector<uchar> & out, bool & keyframe)
+{
+    out.clear();
+    keyframe = false;
+
+    // I420 needs even dimensions; an odd last row or column is dropped.
+    Size size(frame.cols & ~1, frame.rows & ~1);
+    if ( (size != m_size) && !Open(size) )
+        return false;
+
+    // Reopening on a size change starts with a keyframe anyway.
+    Mat image = frame(Rect(0, 0, size.width, size.height));
+    if (image.channels() == 3)
+        cvtColor(image, m_yuv, COLOR_BGR2YUV_I420);
+    else
+    {
+        m_yuv.create(size.height * 3 / 2, size.width, CV_8UC1);
+        Mat yPlane = m_yuv(Rect(0, 0, size.width, size.height));
+        image.copyTo(yPlane);
+        m_yuv(Rect(0, size.height, size.width, size.height / 2)).setTo(Scalar(128));
+    }
+
+    x264_picture_t picture;
+    x264_picture_init(&picture);
+    picture.img.i_csp = X264_CSP_I420;
+    picture.img.i_plane = 3;
+    picture.img.plane[0] = m_yuv.data;
+    picture.img.plane[1] = m_yuv.data + size.area();
+    picture.img.plane[2] = picture.img.plane[1] + size.area() / 4;
+    picture.img.i_stride[0] = size.width;
+    picture.img.i_stride[1] = picture.img.i_stride[2] = size.width / 2;
+    picture.i_pts = m_pts++;
+    picture.i_type = forceKeyframe ? X264_TYPE_IDR : X264_TYPE_AUTO;
+
+    x264_nal_t * pNals;
+    int numNals;
+    x264_picture_t outPicture;
+    int bytes = x264_encoder_encode(m_pEncoder, &pNals, &numNals, &picture, &outPicture);
+    if (bytes < 0)
+    {
+        cerr << "Error: H.264 encoding failed." << endl;
+        Close();
+        return false;
+    }
+
+    // The payloads of one call are contiguous, start codes included.
+    if (bytes > 0)
+    {
+        out.assign(pNals[0].p_payload, pNals[0].p_payload + bytes);
+        keyframe = outPicture.b_keyframe;
+    }
+    return true;
+}
+
+bool H264Encoder::Open(Size size)
+{
+    Close();
+
+    x264_param_t param;
+    if (x264_param_default_preset(&param, m_config.preset.c_str(), "zerolatency") < 0)
+    {
+        cerr << "Error: Invalid x264 preset '" << m_config.preset << "'." << endl;
+        return false;
+    }
+
+    param.i_width = size.width;
+    param.i_height = size.height;
+    param.i_csp = X264_CSP_I420;
+    param.i_keyint_max = m_config.gop;
+    param.rc.i_rc_method = X264_RC_CRF;
+    param.rc.f_rf_constant = (float)m_config.crf;
+    param.b_repeat_headers = 1;
+    param.b_annexb = 1;
+    param.i_log_level = X264_LOG_ERROR;
+    x264_param_apply_profile(&param, "high");
+
+    m_pEncoder = x264_encoder_open(&param);
+    if (!m_pEncoder)
+    {
+        cerr << "Error: Cannot open H.264 encoder for " << size.width << "x" << size.height << "." << endl;
+        return false;
+    }
+
+    m_size = size;
+    m_pts = 0;
+    return true;
+}
+
+void H264Encoder::Close()
+{
+    if (m_pEncoder)
+        x264_encoder_close(m_pEncoder);
+    m_pEncoder = nullptr;
+    m_size = Size();
+}
@@ -0,0 +1,62 @@
+#ifndef H264CODEC_H_
+#define H264CODEC_H_
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <opencv2/opencv.hpp>
+
+#include "FrameCodec.h"
+
+
+struct x264_t;
+
+
+struct H264Config
+{
+    std::string preset = "veryfast"; // x264 speed preset, ultrafast to placebo.
+    int gop = 60;                    // Most frames between keyframes.
+    int crf = 26;                    // Constant rate factor; lower is better quality and more bits.
+};
+
+
+// H.264 through libx264, tuned for latency: no B-frames or lookahead, so every frame is output as it is encoded.
+// Keyframes repeat the SPS/PPS headers, so a client can start decoding at any of them.
+class H264Codec : public FrameCodec
+{
+    H264Config m_config;
+
+public:
+    H264Codec(const H264Config & config) : m_config(config) {}
+
+    // Parse e.g. "preset=ultrafast,gop=30,crf=28", or return null if invalid.
+    static H264Codec * Create(const std::string & options);
+
+    eBDCodec GetId() const override { return CDC_H264; }
+    std::string GetSpec() const override;
+    void Encode(const cv::Mat &, std::vector<uchar> & out) const override { out.clear(); }
+    VideoEncoder * CreateVideoEncoder() const override;
+    FrameCodec * CreateReduced(int step) const override;
+};
+
+
+class H264Encoder : public VideoEncoder
+{
+    H264Config m_config;
+    x264_t * m_pEncoder = nullptr;
+    cv::Size m_size;
+    cv::Mat m_yuv; // I420 input picture.
+    int64_t m_pts = 0;
+
+public:
+    H264Encoder(const H264Config & config) : m_config(config) {}
+    ~H264Encoder();
+
+    bool Encode(const cv::Mat & frame, bool forceKeyframe, std::vector<uchar> & out, bool & keyframe) override;
+
+private:
+    bool Open(cv::Size size);
+    void Close();
+};
+
+#endif /* H264CODEC_H_ */
@@ -0,0 +1,144 @@
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <sstream>
+
+#include "LatencyHistogram.h"
+
+
+using namespace std;
+
+
+string LatencySummary::ToString() const
+{
+    stringstream ss;
+    ss << "n=" << count << ", avg=" << meanUs << ", p50=" << p50 << ", p90=" << p90 << ", p99=" << p99 <<
+          ", p99.9=" << p999 << ", max=" << maxUs;
+    return ss.str();
+}
+
+
+void LatencyHistogram::Counts::Clear()
+{
+    for (int i = 0; i < c_numBuckets; ++i)
+        buckets[i].store(0, memory_order_relaxed);
+    count.store(0, memory_order_relaxed);
+    sumUs.store(0, memory_order_relaxed);
+    maxUs.store(0, memory_order_relaxed);
+}
+
+void LatencyHistogram::Counts::Add(int bucket, int us)
+{
+    buckets[bucket].fetch_add(1, memory_order_relaxed);
+    count.fetch_add(1, memory_order_relaxed);
+    sumUs.fetch_add(us, memory_order_relaxed);
+
+    int prevMax = maxUs.load(memory_order_relaxed);
+    while ( (us > prevMax) && !maxUs.compare_exchange_weak(prevMax, us, memory_order_relaxed) )
+        ;
+}
+
+
+void LatencyHistogram::Reset()
+{
+    m_total.Clear();
+    for (int i = 0; i < c_numSlots; ++i)
+        m_slots[i].Clear();
+    m_slot.store(GetCurrentSlot(), memory_order_release);
+    m_lastUs.store(0, memory_order_relaxed);
+}
+
+void LatencyHistogram::Record(int us)
+{
+    us = max(us, 0);
+    int bucket = GetBucket(us);
+    m_lastUs.store(us, memory_order_relaxed);
+    m_total.Add(bucket, us);
+
+    // Whichever thread first sees the clock pass into a new slot clears it (and any skipped while nothing was
+    // recorded) for reuse.
+    long long slot = GetCurrentSlot();
+    long long filling = m_slot.load(memory_order_acquire);
+    if ( (slot > filling) && m_slot.compare_exchange_strong(filling, slot, memory_order_acq_rel) )
+    {
+        for (long long i = max(filling + 1, slot - c_numSlots + 1); i <= slot; ++i)
+            m_slots[i % c_numSlots].Clear();
+    }
+
+    // A thread that read the clock just before a rotation still lands in a slot within the window.
+    if (slot > filling - c_numSlots)
+        m_slots[slot % c_numSlots].Add(bucket, us);
+}
+
+LatencySummary LatencyHistogram::GetTotal() const
+{
+    const Counts * pCounts = &m_total;
+    return Summarize(&pCounts, 1);
+}
+
+LatencySummary LatencyHistogram::GetWindow() const
+{
+    // Slots are only rotated by Record, so after a quiet spell some have aged out without being cleared.
+    long long filling = m_slot.load(memory_order_acquire);
+    long long oldest = max(filling, GetCurrentSlot()) - c_numSlots + 1;
+
+    const Counts * counts[c_numSlots];
+    int num = 0;
+    for (long long i = oldest; i <= filling; ++i)
+        counts[num++] = &m_slots[i % c_numSlots];
+    return Summarize(counts, num);
+}
+
+int LatencyHistogram::GetBucket(int us)
+{
+    // Buckets are 2^shift wide: 1 up to 64us, then doubling each time the value doubles.
+    int bits = 32 - __builtin_clz((unsigned int)us | 1);
+    int shift = max(0, bits - c_subBucketBits - 1);
+    return (shift << c_subBucketBits) + (us >> shift);
+}
+
+int LatencyHistogram::GetBucketTop(int bucket)
+{
+    int shift = max(0, (bucket >> c_subBucketBits) - 1);
+    return ((bucket - (shift << c_subBucketBits)) << shift) + ((1 << shift) - 1);
+}
+
+long long LatencyHistogram::GetCurrentSlot()
+{
+    return chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now().time_since_epoch()).count() /
+           c_slotMs;
+}
+
+LatencySummary LatencyHistogram::Summarize(const Counts * const * ppCounts, int num)
+{
+    // Counters are read one by one while others may be adding to them, so the figures are only consistent to
+    // within the samples recorded meanwhile.
+    LatencySummary summary;
+    long long buckets[c_numBuckets] = {};
+    for (int i = 0; i < num; ++i)
+    {
+        for (int b = 0; b < c_numBuckets; ++b)
+            buckets[b] += ppCounts[i]->buckets[b].load(memory_order_relaxed);
+        summary.count += ppCounts[i]->count.load(memory_order_relaxed);
+        summary.meanUs += ppCounts[i]->sumUs.load(memory_order_relaxed);
+        summary.maxUs = max(summary.maxUs, ppCounts[i]->maxUs.load(memory_order_relaxed));
+    }
+    if (summary.count == 0)
+        return summary;
+    summary.meanUs /= summary.count;
+
+    // Each percentile is reported as the top of its bucket, but never above the largest sample.
+    const double fractions[] = {0.5, 0.9, 0.99, 0.999};
+    int * percentiles[] = {&summary.p50, &summary.p90, &summary.p99, &summary.p999};
+    long long seen = 0;
+    int bucket = 0;
+    for (int i = 0; i < 4; ++i)
+    {
+        long long rank = max(1LL, (long long)ceil(fractions[i] * summary.count));
+        while ( (bucket < c_numBuckets - 1) && (seen + buckets[bucket] < rank) )
+            seen += buckets[bucket++];
+        *percentiles[i] = min(GetBucketTop(bucket), summary.maxUs);
+    }
+    return summary;
+}
@@ -0,0 +1,73 @@
+#ifndef LATENCYHISTOGRAM_H_
+#define LATENCYHISTOGRAM_H_
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+
+struct LatencySummary
+{
+    long long count = 0;
+    long long meanUs = 0;
+    int p50 = 0;
+    int p90 = 0;
+    int p99 = 0;
+    int p999 = 0;
+    int maxUs = 0;
+
+    std::string ToString() const;
+};
+
+
+// Latencies in microseconds, bucketed logarithmically as in HdrHistogram: exact below 64us, then 32 buckets per
+// doubling, so any percentile is within about 3% of the true value whatever the range.
+// Record is lock-free and may be called from any number of threads. Besides the counts since start (or the last
+// Reset), samples go into one of a ring of short slots, which together cover the recent window. The first sample
+// after a slot ends rotates the ring; a sample racing that rotation may be lost from the window, but never from
+// the total.
+class LatencyHistogram
+{
+    static constexpr int c_subBucketBits = 5;
+    static constexpr int c_numBuckets = (32 - c_subBucketBits) << c_subBucketBits; // Covers all of int.
+    static constexpr int c_slotMs = 10000;
+    static constexpr int c_numSlots = 6;
+
+    struct Counts
+    {
+        std::atomic<uint32_t> buckets[c_numBuckets];
+        std::atomic<long long> count;
+        std::atomic<long long> sumUs;
+        std::atomic<int> maxUs;
+
+        void Clear();
+        void Add(int bucket, int us);
+    };
+
+    Counts m_total;
+    Counts m_slots[c_numSlots];
+    std::atomic<long long> m_slot{0}; // Index of the slot being filled, counted from the clock's epoch.
+    std::atomic<int> m_lastUs{0};
+
+public:
+    static constexpr int c_windowSeconds = c_slotMs * c_numSlots / 1000;
+
+    LatencyHistogram() { Reset(); }
+
+    // Samples recorded concurrently may be partly cleared.
+    void Reset();
+    void Record(int us);
+
+    int GetLast() const { return m_lastUs.load(std::memory_order_relaxed); }
+    LatencySummary GetTotal() const;
+    // Over the last c_windowSeconds (up to one slot less, while the current slot fills).
+    LatencySummary GetWindow() const;
+
+private:
+    static int GetBucket(int us);
+    static int GetBucketTop(int bucket);
+    static long long GetCurrentSlot();
+    static LatencySummary Summarize(const Counts * const * ppCounts, int num);
+};
+
+#endif /* LATENCYHISTOGRAM_H_ */
@@ -8,31 +8,137 @@ using namespace cv;
 MotionDetector::MotionDetector(int defaultThreshold) :
     threshold(defaultThreshold)
 {
+    cout << "Motion kernel: " << MotionKernel::c_isaNames[kernel.GetIsa()] << endl;
 }
 
-bool MotionDetector::update(Mat & frame)
+MotionEvent MotionDetector::update(VideoFrame & frame)
 {
-    // Trivial diff between current and previous image for now.
-    // TODO: Improve algorithm.
+    // Switching resolution mode restarts detection, since neither path's history matches the other's.
+    if (detectionMode != activeMode)
+    {
+        activeMode = detectionMode;
+        background.Reset();
+        pyramid.Reset();
+        framePrevious.release();
+    }
+
+    // Feed the kernel the cheapest representation: the luma plane where the format has one, else the packed frame.
+    const Mat * pSrc;
+    eBDMotionKernelInput input;
+    switch (frame.GetFormat())
+    {
+    case PXF_NV12:
+        pSrc = &frame.GetGray();
+        input = MKI_GRAY;
+        break;
+
+    case PXF_YUYV:
+        pSrc = &frame.GetRaw();
+        input = MKI_YUYV;
+        break;
+
+    default:
+        pSrc = &frame.GetRaw();
+        input = MKI_BGR;
+        break;
+    }
 
-    // Reduced, grayscale image for efficiency.
-    resize(frame, frameCurrent, Size(), 0.5, 0.5);
-    cvtColor(frameCurrent, frameCurrent, COLOR_BGR2GRAY);
+    Size size = frame.GetSize();
+    bool zoned = !zones.IsEmpty();
+    int voteCount;
+    bool motion;
 
-    int voteCount = 0;
-    if (!framePrevious.empty())
+    if (activeMode != DTM_HALF)
     {
-        Mat frameDiff;
-        absdiff(framePrevious, frameCurrent, frameDiff);
-        cv::threshold(frameDiff, frameDiff, threshold, 255, THRESH_BINARY);
+        // Coarse-to-fine: only the parts of the frame that changed at 1/8 scale are looked at in detail.
+        voteCount = pyramid.Process(input, pSrc->data, pSrc->step, size.width, size.height,
+                                    (activeMode == DTM_PYRAMID_FULL) ? 0 : 1, backgroundModel, learningShift,
+                                    (uint8_t)threshold);
+        motion = (zoned ? zones.Evaluate(pyramid.GetDiff(), nullptr, threshold, voteCount) : (voteCount > 0));
+        return events.Update(motion ? voteCount : 0);
+    }
+
+    // Compare against the previous image, or against a learned background model.
+    background.SetModel(backgroundModel, learningShift);
+    bool useBackground = (background.GetModel() != BGM_PREVIOUS);
+
+    // Recycle the previous frame's buffer for the new reduced image.
+    swap(frameCurrent, framePrevious);
+
+    // Reduce, convert to luma, diff, threshold and count in a single pass.
+    // With a background model or zones the kernel only reduces, and classification happens afterwards.
+    frameCurrent.create(size.height / 2, size.width / 2, CV_8UC1);
+    bool havePrevious = (!useBackground && !framePrevious.empty() && (framePrevious.size() == frameCurrent.size()));
+    voteCount = kernel.Process(input, pSrc->data, pSrc->step, size.width, size.height,
+                               (havePrevious && !zoned) ? framePrevious.data : nullptr, framePrevious.step,
+                               frameCurrent.data, frameCurrent.step, (uint8_t)threshold);
+    motion = (voteCount > 0);
 
-        voteCount = countNonZero(frameDiff);
-        if (voteCount)
+    if (useBackground)
+    {
+        // Zones apply their own thresholds to the distance from the background.
+        uint8_t * pDiff = nullptr;
+        if (zoned)
         {
-            cout << "COUNT: " << voteCount << endl;
+            frameDiff.create(frameCurrent.size(), CV_8UC1);
+            pDiff = frameDiff.data;
         }
+
+        voteCount = background.Update(frameCurrent.data, frameCurrent.step, frameCurrent.cols, frameCurrent.rows,
+                                      (uint8_t)threshold, pDiff, frameDiff.step);
+        motion = (zoned ? zones.Evaluate(frameDiff, nullptr, threshold, voteCount) : (voteCount > 0));
+    }
+    else if (zoned && havePrevious)
+        motion = zones.Evaluate(frameCurrent, &framePrevious, threshold, voteCount);
+
+    // A single frame decides nothing by itself; the tracker applies hysteresis over recent frames.
+    return events.Update(motion ? voteCount : 0);
+}
+
+void MotionDetector::findRegions(Size frameSize, vector<Rect> & regions)
+{
+    regions.clear();
+
+    // Changed samples: the refined difference plane in pyramid modes, else the difference between the last two
+    // reduced images (the kernel itself keeps no difference plane).
+    if (activeMode != DTM_HALF)
+        compare(pyramid.GetDiff(), Scalar(threshold), regionMask, CMP_GT);
+    else if (framePrevious.size() == frameCurrent.size())
+    {
+        absdiff(frameCurrent, framePrevious, regionMask);
+        compare(regionMask, Scalar(threshold), regionMask, CMP_GT);
+    }
+    else
+        return;
+
+    zones.MaskOut(regionMask);
+
+    // Close small gaps so one moving object comes out as one region.
+    dilate(regionMask, regionMask, Mat(), Point(-1, -1), 2);
+    int numLabels = connectedComponentsWithStats(regionMask, regionLabels, regionStats, regionCentroids, 8, CV_32S);
+
+    int scaleX = frameSize.width / regionMask.cols;
+    int scaleY = frameSize.height / regionMask.rows;
+    Rect frameRect(0, 0, frameSize.width, frameSize.height);
+    Rect bounds;
+    for (int i = 1; i < numLabels; ++i)
+    {
+        const int * pStats = regionStats.ptr<int>(i);
+        if (pStats[CC_STAT_AREA] < c_minRegionArea)
+            continue;
+
+        Rect region(pStats[CC_STAT_LEFT] * scaleX - c_regionMargin, pStats[CC_STAT_TOP] * scaleY - c_regionMargin,
+                    pStats[CC_STAT_WIDTH] * scaleX + 2 * c_regionMargin,
+                    pStats[CC_STAT_HEIGHT] * scaleY + 2 * c_regionMargin);
+        region &= frameRect;
+        regions.push_back(region);
+        bounds |= region;
     }
-    framePrevious = frameCurrent;
 
-    return (voteCount > 0);
+    // Scattered motion is cheaper to send as one box than as many small images.
+    if ((int)regions.size() > c_maxRegions)
+    {
+        regions.clear();
+        regions.push_back(bounds);
+    }
 }
@@ -1,15 +1,40 @@
 #ifndef MOTIONDETECTOR_H_
 #define MOTIONDETECTOR_H_
 
-//#include <boost/circular_buffer.hpp>
+#include <vector>
 #include <opencv2/opencv.hpp>
 
+#include "BackgroundModel.h"
+#include "MotionEvent.h"
+#include "MotionKernel.h"
+#include "MotionPyramid.h"
+#include "MotionZones.h"
+#include "VideoFrame.h"
+
 
 class MotionDetector
 {
+    static constexpr int c_maxRegions = 16;
+    static constexpr int c_minRegionArea = 4; // In mask samples; smaller specks are noise.
+    static constexpr int c_regionMargin = 8;  // Full-resolution pixels added around each region.
+
+    MotionKernel kernel;
+    BackgroundModel background;
+    MotionPyramid pyramid;
+    MotionZones zones;
+    MotionEventTracker events;
     cv::Mat frameCurrent;
     cv::Mat framePrevious;
+    cv::Mat frameDiff;
+    cv::Mat regionMask;
+    cv::Mat regionLabels;
+    cv::Mat regionStats;
+    cv::Mat regionCentroids;
     int threshold;
+    eBDBackgroundModel backgroundModel = BGM_GAUSSIAN;
+    int learningShift = 5;
+    eBDDetectionMode detectionMode = DTM_HALF;
+    eBDDetectionMode activeMode = DTM_HALF;
 
 public:
     MotionDetector(int defaultThreshold);
@@ -18,12 +43,34 @@ public:
     {
         threshold = _threshold;
     }
-    cv::Mat& getFrame()
+    void setBackgroundModel(eBDBackgroundModel _model, int _learningShift)
+    {
+        backgroundModel = _model;
+        learningShift = _learningShift;
+    }
+    void setDetectionMode(eBDDetectionMode _mode)
+    {
+        detectionMode = _mode;
+    }
+    // Reduced luma image in half mode, or the refined difference plane in the pyramid modes.
+    const cv::Mat& getFrame() const
     {
-        return frameCurrent;
+        return (activeMode == DTM_HALF) ? frameCurrent : pyramid.GetDiff();
     }
+    MotionZones& getZones()
+    {
+        return zones;
+    }
+    MotionEventTracker& getEvents()
+    {
+        return events;
+    }
+
+    // Detect motion in the frame and advance the event state machine; callers act on the returned transition.
+    MotionEvent update(VideoFrame & frame);
 
-    bool update(cv::Mat & frame);
+    // Bounding boxes (in full frame coordinates) of the connected changed areas of the last frame updated.
+    void findRegions(cv::Size frameSize, std::vector<cv::Rect> & regions);
 };
 
 #endif /* MOTIONDETECTOR_H_ */
@@ -0,0 +1,167 @@
+
+#include <cstdlib>
+#include <iostream>
+#include <sstream>
+
+#include "MotionEvent.h"
+
+
+using namespace std;
+
+
+const char * const MotionEventTracker::c_eventNames[] = {"None", "EventStart", "EventUpdate", "EventEnd"};
+
+
+bool MotionEventConfig::Parse(const string & spec, MotionEventConfig & config)
+{
+    MotionEventConfig newConfig = config;
+
+    stringstream ss(spec);
+    string item;
+    while (getline(ss, item, ','))
+    {
+        size_t pos = item.find('=');
+        if (pos == string::npos)
+        {
+            cerr << "Error: Malformed event option '" << item << "'." << endl;
+            return false;
+        }
+
+        string key = item.substr(0, pos);
+        string value = item.substr(pos + 1);
+        int n = atoi(value.c_str());
+
+        int * pField;
+        int minValue = 1;
+        if (key == "window")
+            pField = &newConfig.window;
+        else if (key == "enter")
+            pField = &newConfig.enterVotes;
+        else if (key == "exit")
+            pField = &newConfig.exitScore;
+        else if (key == "duration")
+            pField = &newConfig.minFrames;
+        else if (key == "cooldown")
+        {
+            pField = &newConfig.cooldownFrames;
+            minValue = 0;
+        }
+        else
+        {
+            cerr << "Error: Unknown event option '" << key << "'." << endl;
+            return false;
+        }
+
+        if ( (n < minValue) || (value.find_first_not_of("0123456789") != string::npos) )
+        {
+            cerr << "Error: Invalid event " << key << " '" << value << "'." << endl;
+            return false;
+        }
+        *pField = n;
+    }
+
+    config = newConfig;
+    return true;
+}
+
+string MotionEventConfig::ToString() const
+{
+    stringstream ss;
+    ss << "enter=" << enterVotes << ",exit=" << exitScore << ",window=" << window <<
+          ",duration=" << minFrames << ",cooldown=" << cooldownFrames;
+    return ss.str();
+}
+
+
+MotionEventTracker::MotionEventTracker() :
+    m_votes(m_config.window)
+{
+}
+
+void MotionEventTracker::SetConfig(const MotionEventConfig & config)
+{
+    boost::mutex::scoped_lock lock(m_mutex);
+    if (config.window != m_config.window)
+    {
+        m_votes.set_capacity(config.window);
+        m_votes.clear();
+        m_voteSum = 0;
+    }
+    m_config = config;
+}
+
+MotionEventConfig MotionEventTracker::GetConfig() const
+{
+    boost::mutex::scoped_lock lock(m_mutex);
+    return m_config;
+}
+
+void MotionEventTracker::Reset()
+{
+    boost::mutex::scoped_lock lock(m_mutex);
+    m_votes.clear();
+    m_voteSum = 0;
+    m_state = ST_IDLE;
+    m_runFrames = 0;
+    m_cooldownFrames = 0;
+}
+
+MotionEvent MotionEventTracker::Update(int votes)
+{
+    boost::mutex::scoped_lock lock(m_mutex);
+
+    // Keep a running sum over the ring so the score costs nothing per frame.
+    if (m_votes.full())
+        m_voteSum -= m_votes.front();
+    m_votes.push_back(votes);
+    m_voteSum += votes;
+    int score = m_voteSum / (int)m_votes.size();
+
+    MotionEvent event = m_event;
+    event.type = MET_NONE;
+    event.score = score;
+
+    if (m_state == ST_ACTIVE)
+    {
+        ++m_event.frames;
+        m_event.score = score;
+        m_event.peakScore = max(m_event.peakScore, score);
+        if (score < m_config.exitScore)
+        {
+            m_event.type = MET_END;
+            m_state = ST_COOLDOWN;
+            m_cooldownFrames = m_config.cooldownFrames;
+            m_runFrames = 0;
+        }
+        else
+            m_event.type = MET_UPDATE;
+
+        return m_event;
+    }
+
+    // Count the run of qualifying frames even while cooling down, so sustained motion restarts promptly.
+    m_runFrames = (votes >= m_config.enterVotes) ? m_runFrames + 1 : 0;
+
+    if (m_state == ST_COOLDOWN)
+    {
+        if (m_cooldownFrames > 0)
+        {
+            --m_cooldownFrames;
+            return event;
+        }
+        m_state = ST_IDLE;
+    }
+
+    if (m_runFrames >= m_config.minFrames)
+    {
+        m_state = ST_ACTIVE;
+        m_event.type = MET_START;
+        ++m_event.id;
+        m_event.score = score;
+        m_event.peakScore = score;
+        m_event.frames = 0;
+        return m_event;
+    }
+
+    return event;
+}
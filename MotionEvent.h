@@ -0,0 +1,78 @@
+#ifndef MOTIONEVENT_H_
+#define MOTIONEVENT_H_
+
+#include <string>
+#include <boost/circular_buffer.hpp>
+#include <boost/thread/mutex.hpp>
+
+
+enum eBDMotionEventType
+{
+    MET_NONE,   // No event in progress (or still waiting out the minimum duration).
+    MET_START,
+    MET_UPDATE,
+    MET_END,
+    MET_MAX
+};
+
+struct MotionEvent
+{
+    eBDMotionEventType type = MET_NONE;
+    int id = 0;
+    int score = 0;     // Mean vote count over the recent window.
+    int peakScore = 0; // Highest score seen during the event.
+    int frames = 0;    // Frames since the event started.
+};
+
+
+// Hysteresis settings for turning per-frame vote counts into motion events. Counts are in frames.
+struct MotionEventConfig
+{
+    int window = 4;         // Frames averaged into the score.
+    int enterVotes = 1;     // Votes a frame needs to count towards starting an event.
+    int exitScore = 1;      // The event ends once the score drops below this.
+    int minFrames = 2;      // Consecutive qualifying frames needed to start an event.
+    int cooldownFrames = 15; // Quiet frames after an event before another may start.
+
+    // Parse e.g. "enter=20,exit=5,window=8,duration=3,cooldown=30", updating only the keys given.
+    static bool Parse(const std::string & spec, MotionEventConfig & config);
+    std::string ToString() const;
+};
+
+
+// Motion event state machine for one detector.
+// A lone noisy frame no longer counts as motion: an event starts after minFrames consecutive frames with at least
+// enterVotes votes, and lasts until the windowed score falls below exitScore. After it ends, new events are held off
+// for the cool-down period.
+class MotionEventTracker
+{
+    enum eBDState
+    {
+        ST_IDLE,
+        ST_ACTIVE,
+        ST_COOLDOWN
+    };
+
+    mutable boost::mutex m_mutex;
+    MotionEventConfig m_config;
+    boost::circular_buffer<int> m_votes;
+    int m_voteSum = 0;
+    eBDState m_state = ST_IDLE;
+    int m_runFrames = 0;
+    int m_cooldownFrames = 0;
+    MotionEvent m_event;
+
+public:
+    static const char * const c_eventNames[];
+
+    MotionEventTracker();
+
+    void SetConfig(const MotionEventConfig & config);
+    MotionEventConfig GetConfig() const;
+    void Reset();
+
+    // Feed one frame's result; votes should be zero when the detector did not trigger.
+    MotionEvent Update(int votes);
+};
+
+#endif /* MOTIONEVENT_H_ */
@@ -0,0 +1,522 @@
+
+#include <iostream>
+
+#include "MotionKernel.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define MOTIONKERNEL_X86
+#include <immintrin.h>
+#elif defined(__ARM_NEON)
+#define MOTIONKERNEL_NEON
+#include <arm_neon.h>
+#if !defined(__aarch64__)
+#include <asm/hwcap.h>
+#include <sys/auxv.h>
+#endif
+#endif
+
+
+using namespace std;
+
+
+const char * const MotionKernel::c_isaNames[] = {"scalar", "ssse3", "avx2", "neon"};
+
+
+// BT.601 luma weights in 8-bit fixed point (sum to 256).
+static constexpr int c_lumaB = 29;
+static constexpr int c_lumaG = 150;
+static constexpr int c_lumaR = 77;
+
+
+// Scalar reference implementation - also finishes the tail of each row for the SIMD variants.
+
+static inline int DiffCountScalar(const uint8_t * pPrev, const uint8_t * pCurr, int begin, int end, uint8_t threshold)
+{
+    int count = 0;
+    if (pPrev)
+    {
+        for (int x = begin; x < end; ++x)
+        {
+            int diff = pCurr[x] - pPrev[x];
+            count += ((diff > threshold) || (-diff > threshold));
+        }
+    }
+    return count;
+}
+
+static void ReduceGrayScalar(const uint8_t * pSrc0, const uint8_t * pSrc1, uint8_t * pCurr, int begin, int end)
+{
+    for (int x = begin; x < end; ++x)
+        pCurr[x] = (uint8_t)((pSrc0[2 * x] + pSrc0[2 * x + 1] + pSrc1[2 * x] + pSrc1[2 * x + 1] + 2) >> 2);
+}
+
+static void ReduceYuyvScalar(const uint8_t * pSrc0, const uint8_t * pSrc1, uint8_t * pCurr, int begin, int end)
+{
+    // Each reduced sample covers exactly one Y0 U Y1 V macropixel on each of the two rows.
+    for (int x = begin; x < end; ++x)
+        pCurr[x] = (uint8_t)((pSrc0[4 * x] + pSrc0[4 * x + 2] + pSrc1[4 * x] + pSrc1[4 * x + 2] + 2) >> 2);
+}
+
+static void ReduceBgrScalar(const uint8_t * pSrc0, const uint8_t * pSrc1, uint8_t * pCurr, int begin, int end)
+{
+    // Average each channel over the block first, then convert - luma is linear so the result is the same.
+    for (int x = begin; x < end; ++x)
+    {
+        const uint8_t * p0 = pSrc0 + 6 * x;
+        const uint8_t * p1 = pSrc1 + 6 * x;
+        int b = (p0[0] + p0[3] + p1[0] + p1[3] + 2) >> 2;
+        int g = (p0[1] + p0[4] + p1[1] + p1[4] + 2) >> 2;
+        int r = (p0[2] + p0[5] + p1[2] + p1[5] + 2) >> 2;
+        pCurr[x] = (uint8_t)((c_lumaB * b + c_lumaG * g + c_lumaR * r + 128) >> 8);
+    }
+}
+
+static int GrayRowScalar(const uint8_t * pSrc0, const uint8_t * pSrc1, const uint8_t * pPrev, uint8_t * pCurr,
+                         int width, uint8_t threshold)
+{
+    ReduceGrayScalar(pSrc0, pSrc1, pCurr, 0, width);
+    return DiffCountScalar(pPrev, pCurr, 0, width, threshold);
+}
+
+static int YuyvRowScalar(const uint8_t * pSrc0, const uint8_t * pSrc1, const uint8_t * pPrev, uint8_t * pCurr,
+                         int width, uint8_t threshold)
+{
+    ReduceYuyvScalar(pSrc0, pSrc1, pCurr, 0, width);
+    return DiffCountScalar(pPrev, pCurr, 0, width, threshold);
+}
+
+static int BgrRowScalar(const uint8_t * pSrc0, const uint8_t * pSrc1, const uint8_t * pPrev, uint8_t * pCurr,
+                        int width, uint8_t threshold)
+{
+    ReduceBgrScalar(pSrc0, pSrc1, pCurr, 0, width);
+    return DiffCountScalar(pPrev, pCurr, 0, width, threshold);
+}
+
+
+#ifdef MOTIONKERNEL_X86
+
+// SSSE3: 16 reduced samples per iteration.
+
+__attribute__((target("ssse3")))
+static inline int DiffCountSsse3(const uint8_t * pPrev, __m128i curr, __m128i threshold)
+{
+    __m128i prev = _mm_loadu_si128((const __m128i *)pPrev);
+    __m128i diff = _mm_or_si128(_mm_subs_epu8(curr, prev), _mm_subs_epu8(prev, curr));
+    __m128i still = _mm_cmpeq_epi8(_mm_subs_epu8(diff, threshold), _mm_setzero_si128());
+    return __builtin_popcount(~_mm_movemask_epi8(still) & 0xFFFF);
+}
+
+__attribute__((target("ssse3")))
+static inline __m128i PairSumSsse3(const uint8_t * pSrc0, const uint8_t * pSrc1)
+{
+    // Horizontal pair sums of 16 bytes on each row, added vertically: eight 2x2 block sums.
+    const __m128i ones = _mm_set1_epi8(1);
+    return _mm_add_epi16(_mm_maddubs_epi16(_mm_loadu_si128((const __m128i *)pSrc0), ones),
+                         _mm_maddubs_epi16(_mm_loadu_si128((const __m128i *)pSrc1), ones));
+}
+
+__attribute__((target("ssse3")))
+static int GrayRowSsse3(const uint8_t * pSrc0, const uint8_t * pSrc1, const uint8_t * pPrev, uint8_t * pCurr,
+                        int width, uint8_t threshold)
+{
+    const __m128i two = _mm_set1_epi16(2);
+    const __m128i thresh = _mm_set1_epi8((char)threshold);
+    int count = 0;
+    int x = 0;
+    for (; x + 16 <= width; x += 16)
+    {
+        __m128i lo = _mm_srli_epi16(_mm_add_epi16(PairSumSsse3(pSrc0 + 2 * x, pSrc1 + 2 * x), two), 2);
+        __m128i hi = _mm_srli_epi16(_mm_add_epi16(PairSumSsse3(pSrc0 + 2 * x + 16, pSrc1 + 2 * x + 16), two), 2);
+        __m128i curr = _mm_packus_epi16(lo, hi);
+        _mm_storeu_si128((__m128i *)(pCurr + x), curr);
+        if (pPrev)
+            count += DiffCountSsse3(pPrev + x, curr, thresh);
+    }
+
+    ReduceGrayScalar(pSrc0, pSrc1, pCurr, x, width);
+    return count + DiffCountScalar(pPrev, pCurr, x, width, threshold);
+}
+
+__attribute__((target("ssse3")))
+static inline __m128i YuyvPairSumSsse3(const uint8_t * pSrc)
+{
+    // Mask off chroma, then add Y0 + Y1 of each macropixel: eight sums from 32 bytes.
+    const __m128i lumaMask = _mm_set1_epi16(0x00FF);
+    return _mm_hadd_epi16(_mm_and_si128(_mm_loadu_si128((const __m128i *)pSrc), lumaMask),
+                          _mm_and_si128(_mm_loadu_si128((const __m128i *)(pSrc + 16)), lumaMask));
+}
+
+__attribute__((target("ssse3")))
+static int YuyvRowSsse3(const uint8_t * pSrc0, const uint8_t * pSrc1, const uint8_t * pPrev, uint8_t * pCurr,
+                        int width, uint8_t threshold)
+{
+    const __m128i two = _mm_set1_epi16(2);
+    const __m128i thresh = _mm_set1_epi8((char)threshold);
+    int count = 0;
+    int x = 0;
+    for (; x + 16 <= width; x += 16)
+    {
+        const uint8_t * p0 = pSrc0 + 4 * x;
+        const uint8_t * p1 = pSrc1 + 4 * x;
+        __m128i lo = _mm_add_epi16(YuyvPairSumSsse3(p0), YuyvPairSumSsse3(p1));
+        __m128i hi = _mm_add_epi16(YuyvPairSumSsse3(p0 + 32), YuyvPairSumSsse3(p1 + 32));
+        lo = _mm_srli_epi16(_mm_add_epi16(lo, two), 2);
+        hi = _mm_srli_epi16(_mm_add_epi16(hi, two), 2);
+        __m128i curr = _mm_packus_epi16(lo, hi);
+        _mm_storeu_si128((__m128i *)(pCurr + x), curr);
+        if (pPrev)
+            count += DiffCountSsse3(pPrev + x, curr, thresh);
+    }
+
+    ReduceYuyvScalar(pSrc0, pSrc1, pCurr, x, width);
+    return count + DiffCountScalar(pPrev, pCurr, x, width, threshold);
+}
+
+__attribute__((target("ssse3")))
+static inline void DeinterleaveBgrSsse3(const uint8_t * pSrc, __m128i & b, __m128i & g, __m128i & r)
+{
+    // Split 16 packed BGR pixels (48 bytes) into planar B, G and R vectors.
+    __m128i v0 = _mm_loadu_si128((const __m128i *)pSrc);
+    __m128i v1 = _mm_loadu_si128((const __m128i *)(pSrc + 16));
+    __m128i v2 = _mm_loadu_si128((const __m128i *)(pSrc + 32));
+
+    b = _mm_or_si128(_mm_or_si128(
+            _mm_shuffle_epi8(v0, _mm_setr_epi8(0, 3, 6, 9, 12, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1)),
+            _mm_shuffle_epi8(v1, _mm_setr_epi8(-1, -1, -1, -1, -1, -1, 2, 5, 8, 11, 14, -1, -1, -1, -1, -1))),
+            _mm_shuffle_epi8(v2, _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 1, 4, 7, 10, 13)));
+    g = _mm_or_si128(_mm_or_si128(
+            _mm_shuffle_epi8(v0, _mm_setr_epi8(1, 4, 7, 10, 13, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1)),
+            _mm_shuffle_epi8(v1, _mm_setr_epi8(-1, -1, -1, -1, -1, 0, 3, 6, 9, 12, 15, -1, -1, -1, -1, -1))),
+            _mm_shuffle_epi8(v2, _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 2, 5, 8, 11, 14)));
+    r = _mm_or_si128(_mm_or_si128(
+            _mm_shuffle_epi8(v0, _mm_setr_epi8(2, 5, 8, 11, 14, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1)),
+            _mm_shuffle_epi8(v1, _mm_setr_epi8(-1, -1, -1, -1, -1, 1, 4, 7, 10, 13, -1, -1, -1, -1, -1, -1))),
+            _mm_shuffle_epi8(v2, _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 0, 3, 6, 9, 12, 15)));
+}
+
+__attribute__((target("ssse3")))
+static inline __m128i BgrLumaSsse3(const uint8_t * pSrc0, const uint8_t * pSrc1)
+{
+    // Eight reduced luma samples (16-bit) from 16 pixels on each of two rows.
+    const __m128i ones = _mm_set1_epi8(1);
+    const __m128i two = _mm_set1_epi16(2);
+    __m128i b0, g0, r0, b1, g1, r1;
+    DeinterleaveBgrSsse3(pSrc0, b0, g0, r0);
+    DeinterleaveBgrSsse3(pSrc1, b1, g1, r1);
+
+    __m128i b = _mm_add_epi16(_mm_maddubs_epi16(b0, ones), _mm_maddubs_epi16(b1, ones));
+    __m128i g = _mm_add_epi16(_mm_maddubs_epi16(g0, ones), _mm_maddubs_epi16(g1, ones));
+    __m128i r = _mm_add_epi16(_mm_maddubs_epi16(r0, ones), _mm_maddubs_epi16(r1, ones));
+    b = _mm_srli_epi16(_mm_add_epi16(b, two), 2);
+    g = _mm_srli_epi16(_mm_add_epi16(g, two), 2);
+    r = _mm_srli_epi16(_mm_add_epi16(r, two), 2);
+
+    // Weighted sum peaks at 255 * 256 so it fits unsigned 16-bit lanes.
+    __m128i luma = _mm_add_epi16(_mm_add_epi16(
+            _mm_mullo_epi16(b, _mm_set1_epi16(c_lumaB)),
+            _mm_mullo_epi16(g, _mm_set1_epi16(c_lumaG))),
+            _mm_add_epi16(_mm_mullo_epi16(r, _mm_set1_epi16(c_lumaR)), _mm_set1_epi16(128)));
+    return _mm_srli_epi16(luma, 8);
+}
+
+__attribute__((target("ssse3")))
+static int BgrRowSsse3(const uint8_t * pSrc0, const uint8_t * pSrc1, const uint8_t * pPrev, uint8_t * pCurr,
+                       int width, uint8_t threshold)
+{
+    const __m128i thresh = _mm_set1_epi8((char)threshold);
+    int count = 0;
+    int x = 0;
+    for (; x + 16 <= width; x += 16)
+    {
+        const uint8_t * p0 = pSrc0 + 6 * x;
+        const uint8_t * p1 = pSrc1 + 6 * x;
+        __m128i curr = _mm_packus_epi16(BgrLumaSsse3(p0, p1), BgrLumaSsse3(p0 + 48, p1 + 48));
+        _mm_storeu_si128((__m128i *)(pCurr + x), curr);
+        if (pPrev)
+            count += DiffCountSsse3(pPrev + x, curr, thresh);
+    }
+
+    ReduceBgrScalar(pSrc0, pSrc1, pCurr, x, width);
+    return count + DiffCountScalar(pPrev, pCurr, x, width, threshold);
+}
+
+
+// AVX2: 32 reduced samples per iteration. Packed BGR keeps the SSSE3 path, since three-way deinterleave
+// cannot cross 128-bit lanes cheaply.
+
+__attribute__((target("avx2")))
+static inline int DiffCountAvx2(const uint8_t * pPrev, __m256i curr, __m256i threshold)
+{
+    __m256i prev = _mm256_loadu_si256((const __m256i *)pPrev);
+    __m256i diff = _mm256_or_si256(_mm256_subs_epu8(curr, prev), _mm256_subs_epu8(prev, curr));
+    __m256i still = _mm256_cmpeq_epi8(_mm256_subs_epu8(diff, threshold), _mm256_setzero_si256());
+    return __builtin_popcount(~(unsigned int)_mm256_movemask_epi8(still));
+}
+
+__attribute__((target("avx2")))
+static inline __m256i PairSumAvx2(const uint8_t * pSrc0, const uint8_t * pSrc1)
+{
+    const __m256i ones = _mm256_set1_epi8(1);
+    return _mm256_add_epi16(_mm256_maddubs_epi16(_mm256_loadu_si256((const __m256i *)pSrc0), ones),
+                            _mm256_maddubs_epi16(_mm256_loadu_si256((const __m256i *)pSrc1), ones));
+}
+
+__attribute__((target("avx2")))
+static int GrayRowAvx2(const uint8_t * pSrc0, const uint8_t * pSrc1, const uint8_t * pPrev, uint8_t * pCurr,
+                       int width, uint8_t threshold)
+{
+    const __m256i two = _mm256_set1_epi16(2);
+    const __m256i thresh = _mm256_set1_epi8((char)threshold);
+    int count = 0;
+    int x = 0;
+    for (; x + 32 <= width; x += 32)
+    {
+        __m256i lo = _mm256_srli_epi16(_mm256_add_epi16(PairSumAvx2(pSrc0 + 2 * x, pSrc1 + 2 * x), two), 2);
+        __m256i hi = _mm256_srli_epi16(_mm256_add_epi16(PairSumAvx2(pSrc0 + 2 * x + 32, pSrc1 + 2 * x + 32), two), 2);
+
+        // Pack works within 128-bit lanes - restore sample order afterwards.
+        __m256i curr = _mm256_permute4x64_epi64(_mm256_packus_epi16(lo, hi), 0xD8);
+        _mm256_storeu_si256((__m256i *)(pCurr + x), curr);
+        if (pPrev)
+            count += DiffCountAvx2(pPrev + x, curr, thresh);
+    }
+
+    return count + GrayRowSsse3(pSrc0 + 2 * x, pSrc1 + 2 * x, pPrev ? pPrev + x : nullptr, pCurr + x, width - x, threshold);
+}
+
+__attribute__((target("avx2")))
+static inline __m256i YuyvPairSumAvx2(const uint8_t * pSrc)
+{
+    const __m256i lumaMask = _mm256_set1_epi16(0x00FF);
+    return _mm256_hadd_epi16(_mm256_and_si256(_mm256_loadu_si256((const __m256i *)pSrc), lumaMask),
+                             _mm256_and_si256(_mm256_loadu_si256((const __m256i *)(pSrc + 32)), lumaMask));
+}
+
+__attribute__((target("avx2")))
+static int YuyvRowAvx2(const uint8_t * pSrc0, const uint8_t * pSrc1, const uint8_t * pPrev, uint8_t * pCurr,
+                       int width, uint8_t threshold)
+{
+    const __m256i two = _mm256_set1_epi16(2);
+    const __m256i thresh = _mm256_set1_epi8((char)threshold);
+    const __m256i order = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+    int count = 0;
+    int x = 0;
+    for (; x + 32 <= width; x += 32)
+    {
+        const uint8_t * p0 = pSrc0 + 4 * x;
+        const uint8_t * p1 = pSrc1 + 4 * x;
+        __m256i lo = _mm256_add_epi16(YuyvPairSumAvx2(p0), YuyvPairSumAvx2(p1));
+        __m256i hi = _mm256_add_epi16(YuyvPairSumAvx2(p0 + 64), YuyvPairSumAvx2(p1 + 64));
+        lo = _mm256_srli_epi16(_mm256_add_epi16(lo, two), 2);
+        hi = _mm256_srli_epi16(_mm256_add_epi16(hi, two), 2);
+
+        // Per-lane hadd and pack leave groups of four samples interleaved across lanes.
+        __m256i curr = _mm256_permutevar8x32_epi32(_mm256_packus_epi16(lo, hi), order);
+        _mm256_storeu_si256((__m256i *)(pCurr + x), curr);
+        if (pPrev)
+            count += DiffCountAvx2(pPrev + x, curr, thresh);
+    }
+
+    return count + YuyvRowSsse3(pSrc0 + 4 * x, pSrc1 + 4 * x, pPrev ? pPrev + x : nullptr, pCurr + x, width - x, threshold);
+}
+
+#endif // MOTIONKERNEL_X86
+
+
+#ifdef MOTIONKERNEL_NEON
+
+// NEON: 16 reduced samples per iteration.
+
+static inline uint32x4_t DiffCountNeon(uint32x4_t acc, const uint8_t * pPrev, uint8x16_t curr, uint8x16_t threshold)
+{
+    uint8x16_t moved = vshrq_n_u8(vcgtq_u8(vabdq_u8(curr, vld1q_u8(pPrev)), threshold), 7);
+    return vpadalq_u16(acc, vpaddlq_u8(moved));
+}
+
+static inline int SumLanesNeon(uint32x4_t acc)
+{
+    uint64x2_t sum = vpaddlq_u32(acc);
+    return (int)(vgetq_lane_u64(sum, 0) + vgetq_lane_u64(sum, 1));
+}
+
+static int GrayRowNeon(const uint8_t * pSrc0, const uint8_t * pSrc1, const uint8_t * pPrev, uint8_t * pCurr,
+                       int width, uint8_t threshold)
+{
+    const uint8x16_t thresh = vdupq_n_u8(threshold);
+    uint32x4_t acc = vdupq_n_u32(0);
+    int x = 0;
+    for (; x + 16 <= width; x += 16)
+    {
+        const uint8_t * p0 = pSrc0 + 2 * x;
+        const uint8_t * p1 = pSrc1 + 2 * x;
+        uint16x8_t lo = vpadalq_u8(vpaddlq_u8(vld1q_u8(p0)), vld1q_u8(p1));
+        uint16x8_t hi = vpadalq_u8(vpaddlq_u8(vld1q_u8(p0 + 16)), vld1q_u8(p1 + 16));
+        uint8x16_t curr = vcombine_u8(vrshrn_n_u16(lo, 2), vrshrn_n_u16(hi, 2));
+        vst1q_u8(pCurr + x, curr);
+        if (pPrev)
+            acc = DiffCountNeon(acc, pPrev + x, curr, thresh);
+    }
+
+    ReduceGrayScalar(pSrc0, pSrc1, pCurr, x, width);
+    return SumLanesNeon(acc) + DiffCountScalar(pPrev, pCurr, x, width, threshold);
+}
+
+static int YuyvRowNeon(const uint8_t * pSrc0, const uint8_t * pSrc1, const uint8_t * pPrev, uint8_t * pCurr,
+                       int width, uint8_t threshold)
+{
+    const uint8x16_t thresh = vdupq_n_u8(threshold);
+    uint32x4_t acc = vdupq_n_u32(0);
+    int x = 0;
+    for (; x + 16 <= width; x += 16)
+    {
+        // De-interleave Y0 U Y1 V for 16 macropixels per row.
+        uint8x16x4_t m0 = vld4q_u8(pSrc0 + 4 * x);
+        uint8x16x4_t m1 = vld4q_u8(pSrc1 + 4 * x);
+        uint16x8_t lo = vaddq_u16(vaddl_u8(vget_low_u8(m0.val[0]), vget_low_u8(m0.val[2])),
+                                  vaddl_u8(vget_low_u8(m1.val[0]), vget_low_u8(m1.val[2])));
+        uint16x8_t hi = vaddq_u16(vaddl_u8(vget_high_u8(m0.val[0]), vget_high_u8(m0.val[2])),
+                                  vaddl_u8(vget_high_u8(m1.val[0]), vget_high_u8(m1.val[2])));
+        uint8x16_t curr = vcombine_u8(vrshrn_n_u16(lo, 2), vrshrn_n_u16(hi, 2));
+        vst1q_u8(pCurr + x, curr);
+        if (pPrev)
+            acc = DiffCountNeon(acc, pPrev + x, curr, thresh);
+    }
+
+    ReduceYuyvScalar(pSrc0, pSrc1, pCurr, x, width);
+    return SumLanesNeon(acc) + DiffCountScalar(pPrev, pCurr, x, width, threshold);
+}
+
+static inline uint8x8_t BgrLumaNeon(const uint8_t * pSrc0, const uint8_t * pSrc1)
+{
+    // Eight reduced luma samples from 16 pixels on each of two rows.
+    uint8x16x3_t v0 = vld3q_u8(pSrc0);
+    uint8x16x3_t v1 = vld3q_u8(pSrc1);
+    uint16x8_t b = vrshrq_n_u16(vpadalq_u8(vpaddlq_u8(v0.val[0]), v1.val[0]), 2);
+    uint16x8_t g = vrshrq_n_u16(vpadalq_u8(vpaddlq_u8(v0.val[1]), v1.val[1]), 2);
+    uint16x8_t r = vrshrq_n_u16(vpadalq_u8(vpaddlq_u8(v0.val[2]), v1.val[2]), 2);
+    uint16x8_t luma = vmlaq_n_u16(vmlaq_n_u16(vmulq_n_u16(b, c_lumaB), g, c_lumaG), r, c_lumaR);
+    return vrshrn_n_u16(luma, 8);
+}
+
+static int BgrRowNeon(const uint8_t * pSrc0, const uint8_t * pSrc1, const uint8_t * pPrev, uint8_t * pCurr,
+                      int width, uint8_t threshold)
+{
+    const uint8x16_t thresh = vdupq_n_u8(threshold);
+    uint32x4_t acc = vdupq_n_u32(0);
+    int x = 0;
+    for (; x + 16 <= width; x += 16)
+    {
+        const uint8_t * p0 = pSrc0 + 6 * x;
+        const uint8_t * p1 = pSrc1 + 6 * x;
+        uint8x16_t curr = vcombine_u8(BgrLumaNeon(p0, p1), BgrLumaNeon(p0 + 48, p1 + 48));
+        vst1q_u8(pCurr + x, curr);
+        if (pPrev)
+            acc = DiffCountNeon(acc, pPrev + x, curr, thresh);
+    }
+
+    ReduceBgrScalar(pSrc0, pSrc1, pCurr, x, width);
+    return SumLanesNeon(acc) + DiffCountScalar(pPrev, pCurr, x, width, threshold);
+}
+
+#endif // MOTIONKERNEL_NEON
+
+
+MotionKernel::MotionKernel() :
+    MotionKernel(GetBestIsa())
+{
+}
+
+MotionKernel::MotionKernel(eBDMotionKernelIsa isa) :
+    m_isa(IsSupported(isa) ? isa : MKS_SCALAR)
+{
+    m_rowFuncs[MKI_GRAY] = GrayRowScalar;
+    m_rowFuncs[MKI_YUYV] = YuyvRowScalar;
+    m_rowFuncs[MKI_BGR] = BgrRowScalar;
+
+    switch (m_isa)
+    {
+#ifdef MOTIONKERNEL_X86
+    case MKS_SSSE3:
+        m_rowFuncs[MKI_GRAY] = GrayRowSsse3;
+        m_rowFuncs[MKI_YUYV] = YuyvRowSsse3;
+        m_rowFuncs[MKI_BGR] = BgrRowSsse3;
+        break;
+
+    case MKS_AVX2:
+        m_rowFuncs[MKI_GRAY] = GrayRowAvx2;
+        m_rowFuncs[MKI_YUYV] = YuyvRowAvx2;
+        m_rowFuncs[MKI_BGR] = BgrRowSsse3;
+        break;
+#endif
+
+#ifdef MOTIONKERNEL_NEON
+    case MKS_NEON:
+        m_rowFuncs[MKI_GRAY] = GrayRowNeon;
+        m_rowFuncs[MKI_YUYV] = YuyvRowNeon;
+        m_rowFuncs[MKI_BGR] = BgrRowNeon;
+        break;
+#endif
+
+    default:
+        break;
+    }
+}
+
+bool MotionKernel::IsSupported(eBDMotionKernelIsa isa)
+{
+    switch (isa)
+    {
+    case MKS_SCALAR:
+        return true;
+
+#ifdef MOTIONKERNEL_X86
+    case MKS_SSSE3:
+        return __builtin_cpu_supports("ssse3");
+
+    case MKS_AVX2:
+        return (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("ssse3"));
+#endif
+
+#ifdef MOTIONKERNEL_NEON
+    case MKS_NEON:
+#ifdef __aarch64__
+        return true; // Mandatory on AArch64.
+#else
+        return ((getauxval(AT_HWCAP) & HWCAP_NEON) != 0);
+#endif
+#endif
+
+    default:
+        return false;
+    }
+}
+
+eBDMotionKernelIsa MotionKernel::GetBestIsa()
+{
+    for (int isa = MKS_MAX - 1; isa > MKS_SCALAR; --isa)
+    {
+        if (IsSupported((eBDMotionKernelIsa)isa))
+            return (eBDMotionKernelIsa)isa;
+    }
+
+    return MKS_SCALAR;
+}
+
+int MotionKernel::Process(eBDMotionKernelInput input, const uint8_t * pSrc, size_t srcStride, int width, int height,
+                          const uint8_t * pPrev, size_t prevStride, uint8_t * pCurr, size_t currStride,
+                          uint8_t threshold) const
+{
+    RowFunc rowFunc = m_rowFuncs[input];
+    int reducedWidth = width / 2;
+    int reducedHeight = height / 2;
+    int count = 0;
+
+    for (int y = 0; y < reducedHeight; ++y)
+    {
+        const uint8_t * pSrc0 = pSrc + srcStride * (2 * y);
+        count += rowFunc(pSrc0, pSrc0 + srcStride, pPrev ? pPrev + prevStride * y : nullptr,
+                         pCurr + currStride * y, reducedWidth, threshold);
+    }
+
+    return count;
+}
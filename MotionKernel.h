@@ -0,0 +1,59 @@
+#ifndef MOTIONKERNEL_H_
+#define MOTIONKERNEL_H_
+
+#include <cstddef>
+#include <cstdint>
+
+
+enum eBDMotionKernelInput
+{
+    MKI_GRAY, // 8-bit luma plane (NV12 Y plane, or any grayscale image).
+    MKI_YUYV, // Packed 4:2:2, luma in even bytes.
+    MKI_BGR,  // Packed BGR24.
+    MKI_MAX
+};
+
+enum eBDMotionKernelIsa
+{
+    MKS_SCALAR,
+    MKS_SSSE3,
+    MKS_AVX2,
+    MKS_NEON,
+    MKS_MAX
+};
+
+
+// Fused motion detection kernel.
+// In a single streaming pass over the source it reduces each 2x2 block to one luma sample,
+// stores the reduced image, differences it against the previous reduced image and counts
+// the samples whose absolute difference exceeds the threshold.
+// The instruction set is picked once at construction from what the CPU supports.
+class MotionKernel
+{
+public:
+    // Processes one reduced row from two source rows; pPrev may be null (reduce only, returns 0).
+    using RowFunc = int (*)(const uint8_t * pSrc0, const uint8_t * pSrc1, const uint8_t * pPrev, uint8_t * pCurr,
+                            int width, uint8_t threshold);
+
+    static const char * const c_isaNames[];
+
+private:
+    eBDMotionKernelIsa m_isa;
+    RowFunc m_rowFuncs[MKI_MAX];
+
+public:
+    MotionKernel();
+    explicit MotionKernel(eBDMotionKernelIsa isa);
+
+    static bool IsSupported(eBDMotionKernelIsa isa);
+    static eBDMotionKernelIsa GetBestIsa();
+
+    eBDMotionKernelIsa GetIsa() const { return m_isa; }
+
+    // Source is width x height pixels; reduced images are (width / 2) x (height / 2).
+    // Returns the number of changed samples, or 0 if pPrev is null.
+    int Process(eBDMotionKernelInput input, const uint8_t * pSrc, size_t srcStride, int width, int height,
+                const uint8_t * pPrev, size_t prevStride, uint8_t * pCurr, size_t currStride, uint8_t threshold) const;
+};
+
+#endif /* MOTIONKERNEL_H_ */
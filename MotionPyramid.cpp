@@ -0,0 +1,222 @@
+
+#include <cstdlib>
+#include <cstring>
+
+#include "MotionPyramid.h"
+
+
+using namespace std;
+using namespace cv;
+
+
+const char * const MotionPyramid::c_modeNames[] = {"half", "pyramid-half", "pyramid-full"};
+
+
+// BT.601 luma weights in 8-bit fixed point, as used by the motion kernel.
+static constexpr int c_lumaB = 29;
+static constexpr int c_lumaG = 150;
+static constexpr int c_lumaR = 77;
+
+
+template <eBDMotionKernelInput input>
+static inline int Luma(const uint8_t * pRow, int x)
+{
+    if (input == MKI_GRAY)
+        return pRow[x];
+    if (input == MKI_YUYV)
+        return pRow[2 * x];
+
+    const uint8_t * p = pRow + 3 * x;
+    return (c_lumaB * p[0] + c_lumaG * p[1] + c_lumaR * p[2] + 128) >> 8;
+}
+
+template <eBDMotionKernelInput input>
+static void SampleCoarse(const uint8_t * pSrc, size_t srcStride, Mat & coarse, int cellSize)
+{
+    // Four samples per cell, one in each quadrant, so thin horizontal or vertical edges are not missed entirely.
+    int nearOffset = cellSize / 4;
+    int farOffset = cellSize - 1 - nearOffset;
+    for (int cy = 0; cy < coarse.rows; ++cy)
+    {
+        const uint8_t * pRow0 = pSrc + srcStride * (cy * cellSize + nearOffset);
+        const uint8_t * pRow1 = pSrc + srcStride * (cy * cellSize + farOffset);
+        uint8_t * pCoarse = coarse.ptr<uint8_t>(cy);
+        for (int cx = 0; cx < coarse.cols; ++cx)
+        {
+            int x0 = cx * cellSize + nearOffset;
+            int x1 = cx * cellSize + farOffset;
+            pCoarse[cx] = (uint8_t)((Luma<input>(pRow0, x0) + Luma<input>(pRow0, x1) +
+                                     Luma<input>(pRow1, x0) + Luma<input>(pRow1, x1) + 2) >> 2);
+        }
+    }
+}
+
+// Refine a horizontal run of cells [begin, end) in one cell row: compute the fine samples, diff them against the
+// reference and take them as the new reference. Refresh-only runs write zero differences and count nothing.
+template <eBDMotionKernelInput input>
+static int RefineCells(const uint8_t * pSrc, size_t srcStride, int fineShift, int cellSize, int cy, int begin, int end,
+                       Mat & reference, Mat & diff, uint8_t threshold, bool refreshOnly)
+{
+    int fineCell = cellSize >> fineShift;
+    int xBegin = begin * fineCell;
+    int xEnd = end * fineCell;
+    int count = 0;
+
+    for (int y = cy * fineCell; y < (cy + 1) * fineCell; ++y)
+    {
+        const uint8_t * pRow0 = pSrc + srcStride * (y << fineShift);
+        const uint8_t * pRow1 = pRow0 + (fineShift ? srcStride : 0);
+        uint8_t * pRef = reference.ptr<uint8_t>(y);
+        uint8_t * pDiff = diff.ptr<uint8_t>(y);
+
+        for (int x = xBegin; x < xEnd; ++x)
+        {
+            int value;
+            if (fineShift)
+                value = (Luma<input>(pRow0, 2 * x) + Luma<input>(pRow0, 2 * x + 1) +
+                         Luma<input>(pRow1, 2 * x) + Luma<input>(pRow1, 2 * x + 1) + 2) >> 2;
+            else
+                value = Luma<input>(pRow0, x);
+
+            int d = abs(value - pRef[x]);
+            pRef[x] = (uint8_t)value;
+            pDiff[x] = (uint8_t)(refreshOnly ? 0 : d);
+            count += (d > threshold);
+        }
+    }
+
+    return (refreshOnly ? 0 : count);
+}
+
+template <eBDMotionKernelInput input>
+static int RefineRow(const uint8_t * pSrc, size_t srcStride, int fineShift, int cellSize, int cy,
+                     const uint8_t * pActive, const uint8_t * pActivePrevious, int cells, bool refresh,
+                     Mat & reference, Mat & diff, uint8_t threshold)
+{
+    int fineCell = cellSize >> fineShift;
+    int count = 0;
+    int cx = 0;
+    while (cx < cells)
+    {
+        if ( !pActive[cx] && !refresh )
+        {
+            // Clear what the cell reported last time it was refined.
+            if (pActivePrevious[cx])
+            {
+                for (int y = cy * fineCell; y < (cy + 1) * fineCell; ++y)
+                    memset(diff.ptr<uint8_t>(y) + cx * fineCell, 0, fineCell);
+            }
+            ++cx;
+            continue;
+        }
+
+        // Refine runs of cells together; in a refresh band the idle runs only update the reference.
+        int end = cx + 1;
+        while ( (end < cells) && ((pActive[end] != 0) == (pActive[cx] != 0)) && (pActive[end] || refresh) )
+            ++end;
+
+        count += RefineCells<input>(pSrc, srcStride, fineShift, cellSize, cy, cx, end, reference, diff, threshold,
+                                    !pActive[cx]);
+        cx = end;
+    }
+
+    return count;
+}
+
+
+void MotionPyramid::Reset()
+{
+    m_background.Reset();
+    m_coarse.release();
+    m_coarsePrevious.release();
+    m_fineShift = -1;
+    m_primed = false;
+}
+
+int MotionPyramid::Process(eBDMotionKernelInput input, const uint8_t * pSrc, size_t srcStride, int width, int height,
+                           int fineShift, eBDBackgroundModel model, int learningShift, uint8_t threshold)
+{
+    int cellsX = width >> c_coarseShift;
+    int cellsY = height >> c_coarseShift;
+    Size fineSize(width >> fineShift, height >> fineShift);
+
+    if ( (fineShift != m_fineShift) || (m_diff.size() != fineSize) )
+    {
+        Reset();
+        m_fineShift = fineShift;
+        m_fineReference.create(fineSize, CV_8UC1);
+        m_diff = Mat::zeros(fineSize, CV_8UC1);
+        m_activePrevious = Mat::zeros(cellsY, cellsX, CV_8UC1);
+    }
+
+    // Coarse level.
+    swap(m_coarse, m_coarsePrevious);
+    m_coarse.create(cellsY, cellsX, CV_8UC1);
+    switch (input)
+    {
+    case MKI_GRAY:
+        SampleCoarse<MKI_GRAY>(pSrc, srcStride, m_coarse, c_cellSize);
+        break;
+
+    case MKI_YUYV:
+        SampleCoarse<MKI_YUYV>(pSrc, srcStride, m_coarse, c_cellSize);
+        break;
+
+    default:
+        SampleCoarse<MKI_BGR>(pSrc, srcStride, m_coarse, c_cellSize);
+        break;
+    }
+
+    m_background.SetModel(model, learningShift);
+    m_coarseDiff.create(m_coarse.size(), CV_8UC1);
+    if (model != BGM_PREVIOUS)
+        m_background.Update(m_coarse.data, m_coarse.step, m_coarse.cols, m_coarse.rows, threshold,
+                            m_coarseDiff.data, m_coarseDiff.step);
+    else if (m_coarsePrevious.size() == m_coarse.size())
+        absdiff(m_coarse, m_coarsePrevious, m_coarseDiff);
+    else
+        m_coarseDiff.setTo(Scalar(0));
+
+    // Changed cells and their neighbours get refined, since motion near a cell edge may show in the next cell first.
+    compare(m_coarseDiff, Scalar(threshold), m_changed, CMP_GT);
+    dilate(m_changed, m_active, Mat());
+    m_activeCells = countNonZero(m_active);
+
+    // Fine level. The first frame only seeds the reference.
+    bool refreshAll = !m_primed;
+    int refreshPhase = m_refreshPhase;
+    m_refreshPhase = (m_refreshPhase + 1) % c_refreshInterval;
+    if (refreshAll)
+        m_active.setTo(Scalar(0));
+
+    int count = 0;
+    #pragma omp parallel for reduction(+:count) schedule(dynamic)
+    for (int cy = 0; cy < cellsY; ++cy)
+    {
+        bool refresh = ( refreshAll || ((cy % c_refreshInterval) == refreshPhase) );
+        const uint8_t * pActive = m_active.ptr<uint8_t>(cy);
+        const uint8_t * pActivePrevious = m_activePrevious.ptr<uint8_t>(cy);
+        switch (input)
+        {
+        case MKI_GRAY:
+            count += RefineRow<MKI_GRAY>(pSrc, srcStride, fineShift, c_cellSize, cy, pActive, pActivePrevious,
+                                         cellsX, refresh, m_fineReference, m_diff, threshold);
+            break;
+
+        case MKI_YUYV:
+            count += RefineRow<MKI_YUYV>(pSrc, srcStride, fineShift, c_cellSize, cy, pActive, pActivePrevious,
+                                         cellsX, refresh, m_fineReference, m_diff, threshold);
+            break;
+
+        default:
+            count += RefineRow<MKI_BGR>(pSrc, srcStride, fineShift, c_cellSize, cy, pActive, pActivePrevious,
+                                        cellsX, refresh, m_fineReference, m_diff, threshold);
+            break;
+        }
+    }
+
+    swap(m_active, m_activePrevious);
+    m_primed = true;
+
+    return count;
+}
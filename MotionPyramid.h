@@ -0,0 +1,65 @@
+#ifndef MOTIONPYRAMID_H_
+#define MOTIONPYRAMID_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <opencv2/opencv.hpp>
+
+#include "BackgroundModel.h"
+#include "MotionKernel.h"
+
+
+enum eBDDetectionMode
+{
+    DTM_HALF,         // Whole frame at half resolution through the fused kernel.
+    DTM_PYRAMID_HALF, // 1/8 scale first, then half resolution only where the coarse level changed.
+    DTM_PYRAMID_FULL, // As above, refined at full resolution.
+    DTM_MAX
+};
+
+
+// Coarse-to-fine motion detection.
+// Each 8x8 block of the source becomes one coarse cell, sampled from four spread-out pixels, so the coarse level
+// reads 1/16 of the frame. Cells that changed (against the previous coarse image or a coarse background model),
+// plus their neighbours, are then refined at the output resolution against a fine reference image, and produce
+// the difference plane used for votes and zones. Everything else stays untouched except for one band of cell rows
+// per frame, which is read only to keep the fine reference from going stale.
+// Objects smaller than a cell can slip between the coarse samples.
+class MotionPyramid
+{
+    static constexpr int c_coarseShift = 3;
+    static constexpr int c_cellSize = 1 << c_coarseShift;
+    static constexpr int c_refreshInterval = 16; // Frames to refresh the whole fine reference.
+
+    BackgroundModel m_background;
+    cv::Mat m_coarse;
+    cv::Mat m_coarsePrevious;
+    cv::Mat m_coarseDiff;
+    cv::Mat m_changed;
+    cv::Mat m_active;
+    cv::Mat m_activePrevious;
+    cv::Mat m_fineReference;
+    cv::Mat m_diff;
+    int m_fineShift = -1;
+    int m_refreshPhase = 0;
+    bool m_primed = false;
+    int m_activeCells = 0;
+
+public:
+    static const char * const c_modeNames[];
+
+    MotionPyramid() = default;
+
+    void Reset();
+
+    // Detect motion in a source frame, refining at 1 / 2^fineShift of the source resolution (0 or 1).
+    // Returns the number of refined samples whose difference exceeds the threshold.
+    int Process(eBDMotionKernelInput input, const uint8_t * pSrc, size_t srcStride, int width, int height,
+                int fineShift, eBDBackgroundModel model, int learningShift, uint8_t threshold);
+
+    // Absolute difference at the output resolution; zero outside the refined cells.
+    const cv::Mat & GetDiff() const { return m_diff; }
+    int GetActiveCells() const { return m_activeCells; }
+};
+
+#endif /* MOTIONPYRAMID_H_ */
@@ -0,0 +1,387 @@
+
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+#include "MotionZones.h"
+
+
+using namespace std;
+using namespace cv;
+
+
+static bool ParseCoordinates(const string & value, vector<float> & coords)
+{
+    stringstream ss(value);
+    string item;
+    while (getline(ss, item, ','))
+    {
+        char * pEnd;
+        float coord = strtof(item.c_str(), &pEnd);
+        if ( (pEnd == item.c_str()) || (*pEnd != '\0') || (coord < 0.0f) || (coord > 1.0f) )
+            return false;
+        coords.push_back(coord);
+    }
+    return true;
+}
+
+bool MotionZone::Parse(const string & spec, MotionZone & zone)
+{
+    zone = MotionZone();
+
+    stringstream ss(spec);
+    string item;
+    if (!(ss >> item))
+    {
+        cerr << "Error: Empty zone definition." << endl;
+        return false;
+    }
+
+    if (item == "ignore")
+        zone.ignore = true;
+    else if (item != "include")
+    {
+        cerr << "Error: Unknown zone type '" << item << "'." << endl;
+        return false;
+    }
+
+    while (ss >> item)
+    {
+        size_t pos = item.find('=');
+        if (pos == string::npos)
+        {
+            cerr << "Error: Malformed zone option '" << item << "'." << endl;
+            return false;
+        }
+
+        string key = item.substr(0, pos);
+        string value = item.substr(pos + 1);
+
+        if (key == "name")
+            zone.name = value;
+        else if (key == "threshold")
+        {
+            zone.threshold = atoi(value.c_str());
+            if ( (zone.threshold < 0) || (zone.threshold > 254) )
+            {
+                cerr << "Error: Invalid zone threshold '" << value << "'." << endl;
+                return false;
+            }
+        }
+        else if (key == "votes")
+        {
+            zone.minVotes = atoi(value.c_str());
+            if (zone.minVotes < 1)
+            {
+                cerr << "Error: Invalid zone vote count '" << value << "'." << endl;
+                return false;
+            }
+        }
+        else if ( (key == "rect") || (key == "poly") )
+        {
+            vector<float> coords;
+            if ( !ParseCoordinates(value, coords) ||
+                 ((key == "rect") && (coords.size() != 4)) ||
+                 ((key == "poly") && ((coords.size() < 6) || (coords.size() % 2))) )
+            {
+                cerr << "Error: Invalid zone " << key << " '" << value << "'." << endl;
+                return false;
+            }
+
+            zone.polygon.clear();
+            if (key == "rect")
+            {
+                float x0 = coords[0], y0 = coords[1], x1 = coords[0] + coords[2], y1 = coords[1] + coords[3];
+                zone.polygon = {Point2f(x0, y0), Point2f(x1, y0), Point2f(x1, y1), Point2f(x0, y1)};
+            }
+            else
+            {
+                for (size_t i = 0; i < coords.size(); i += 2)
+                    zone.polygon.push_back(Point2f(coords[i], coords[i + 1]));
+            }
+        }
+        else
+        {
+            cerr << "Error: Unknown zone option '" << key << "'." << endl;
+            return false;
+        }
+    }
+
+    if (zone.polygon.empty())
+    {
+        cerr << "Error: Zone needs a rect or poly." << endl;
+        return false;
+    }
+
+    return true;
+}
+
+bool MotionZones::Load(const string & path)
+{
+    ifstream ifs(path);
+    if (!ifs.is_open())
+    {
+        cerr << "Error: Cannot open zone file '" << path << "'." << endl;
+        return false;
+    }
+
+    string line;
+    int lineNumber = 0;
+    while (getline(ifs, line))
+    {
+        ++lineNumber;
+        if ( (line.find_first_not_of(" \t\r") == string::npos) || (line[line.find_first_not_of(" \t")] == '#') )
+            continue;
+
+        MotionZone zone;
+        if (!MotionZone::Parse(line, zone) || !Add(zone))
+        {
+            cerr << "Error: Bad zone at " << path << ":" << lineNumber << "." << endl;
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool MotionZones::Add(const MotionZone & zone)
+{
+    boost::mutex::scoped_lock lock(m_mutex);
+    if ((int)m_zones.size() >= c_maxZones)
+    {
+        cerr << "Error: Too many zones." << endl;
+        return false;
+    }
+
+    m_zones.push_back(zone);
+    if (m_zones.back().name.empty())
+        m_zones.back().name = to_string(m_zones.size());
+    m_dirty = true;
+    return true;
+}
+
+void MotionZones::Clear()
+{
+    boost::mutex::scoped_lock lock(m_mutex);
+    m_zones.clear();
+    m_dirty = true;
+}
+
+bool MotionZones::IsEmpty() const
+{
+    boost::mutex::scoped_lock lock(m_mutex);
+    return m_zones.empty();
+}
+
+void MotionZones::Output() const
+{
+    boost::mutex::scoped_lock lock(m_mutex);
+
+    cout << endl << "Motion Zones" << endl;
+    if (m_zones.empty())
+        cout << "  (whole frame)" << endl;
+
+    for (size_t i = 0; i < m_zones.size(); ++i)
+    {
+        const MotionZone & zone = m_zones[i];
+        cout << "  " << zone.name << ": " << (zone.ignore ? "ignore" : "include");
+        if (!zone.ignore)
+        {
+            cout << ", threshold=";
+            if (zone.threshold < 0)
+                cout << "default";
+            else
+                cout << zone.threshold;
+            cout << ", votes=" << zone.minVotes;
+            if (i < m_lastVotes.size())
+                cout << ", last=" << m_lastVotes[i];
+            if ((int)i == m_lastTriggered)
+                cout << " (triggered)";
+        }
+        cout << endl;
+    }
+
+    if ( !m_zones.empty() && !HasIncludeZones() )
+    {
+        size_t i = m_zones.size();
+        cout << "  (rest of frame): include, threshold=default, votes=1";
+        if (i < m_lastVotes.size())
+            cout << ", last=" << m_lastVotes[i];
+        if ((int)i == m_lastTriggered)
+            cout << " (triggered)";
+        cout << endl;
+    }
+}
+
+void MotionZones::MaskOut(Mat & mask) const
+{
+    boost::mutex::scoped_lock lock(m_mutex);
+    if ( m_zones.empty() || m_dirty || (mask.size() != m_size) )
+        return;
+
+    for (int y = 0; y < mask.rows; ++y)
+    {
+        uchar * pMask = mask.ptr<uchar>(y);
+        const uchar * pZone = m_mask.ptr<uchar>(y);
+        for (int x = 0; x < mask.cols; ++x)
+        {
+            if (!pZone[x])
+                pMask[x] = 0;
+        }
+    }
+}
+
+bool MotionZones::HasIncludeZones() const
+{
+    for (const auto & zone : m_zones)
+    {
+        if (!zone.ignore)
+            return true;
+    }
+    return false;
+}
+
+void MotionZones::Rasterize(Size size)
+{
+    m_size = size;
+    m_dirty = false;
+    m_wholeFrame = !HasIncludeZones();
+    m_mask = Mat(size, CV_8UC1, Scalar(m_wholeFrame ? (double)(m_zones.size() + 1) : 0.0));
+
+    // Include zones first (later ones win where they overlap), then cut out the ignored areas.
+    for (int pass = 0; pass < 2; ++pass)
+    {
+        for (size_t i = 0; i < m_zones.size(); ++i)
+        {
+            const MotionZone & zone = m_zones[i];
+            if (zone.ignore != (pass == 1))
+                continue;
+
+            vector<vector<Point> > polygons(1);
+            for (const auto & point : zone.polygon)
+                polygons[0].push_back(Point(cvRound(point.x * size.width), cvRound(point.y * size.height)));
+            fillPoly(m_mask, polygons, Scalar(zone.ignore ? 0 : (double)(i + 1)));
+        }
+    }
+
+    // Classify tiles so uniform ones can skip the per-sample zone lookup.
+    int tilesX = (size.width + c_tileSize - 1) / c_tileSize;
+    int tilesY = (size.height + c_tileSize - 1) / c_tileSize;
+    m_tileZones.assign(tilesX * tilesY, 0);
+    for (int ty = 0; ty < tilesY; ++ty)
+    {
+        for (int tx = 0; tx < tilesX; ++tx)
+        {
+            Rect tile = Rect(tx * c_tileSize, ty * c_tileSize, c_tileSize, c_tileSize) & Rect(0, 0, size.width, size.height);
+            short tileZone = m_mask.ptr<uchar>(tile.y)[tile.x];
+            for (int y = tile.y; (y < tile.y + tile.height) && (tileZone != c_mixedTile); ++y)
+            {
+                const uchar * pMask = m_mask.ptr<uchar>(y);
+                for (int x = tile.x; x < tile.x + tile.width; ++x)
+                {
+                    if (pMask[x] != tileZone)
+                    {
+                        tileZone = c_mixedTile;
+                        break;
+                    }
+                }
+            }
+            m_tileZones[ty * tilesX + tx] = tileZone;
+        }
+    }
+
+    m_lastVotes.assign(m_zones.size() + (m_wholeFrame ? 1 : 0), 0);
+    m_lastTriggered = -1;
+}
+
+bool MotionZones::Evaluate(const Mat & image, const Mat * pReference, int defaultThreshold, int & voteCount)
+{
+    boost::mutex::scoped_lock lock(m_mutex);
+    if ( m_dirty || (image.size() != m_size) )
+        Rasterize(image.size());
+
+    int numZones = (int)m_zones.size() + (m_wholeFrame ? 1 : 0);
+    int thresholds[c_maxZones + 2];
+    int minVotes[c_maxZones + 2];
+    int votes[c_maxZones + 2];
+    for (int i = 0; i < numZones; ++i)
+    {
+        bool implicit = (i == (int)m_zones.size());
+        thresholds[i + 1] = (implicit || (m_zones[i].threshold < 0)) ? defaultThreshold : m_zones[i].threshold;
+        minVotes[i + 1] = implicit ? 1 : m_zones[i].minVotes;
+        votes[i + 1] = 0;
+    }
+
+    int tilesX = (m_size.width + c_tileSize - 1) / c_tileSize;
+    int numTiles = (int)m_tileZones.size();
+    atomic<int> triggered(0);
+
+    #pragma omp parallel for schedule(dynamic)
+    for (int t = 0; t < numTiles; ++t)
+    {
+        // Early exit: once any zone has triggered the remaining tiles cannot change the outcome.
+        short tileZone = m_tileZones[t];
+        if ( triggered.load(memory_order_relaxed) || (tileZone == 0) )
+            continue;
+
+        Rect tile = Rect((t % tilesX) * c_tileSize, (t / tilesX) * c_tileSize, c_tileSize, c_tileSize) &
+                    Rect(0, 0, m_size.width, m_size.height);
+        int localVotes[c_maxZones + 2];
+        if (tileZone > 0)
+            localVotes[tileZone] = 0;
+        else
+            memset(localVotes, 0, sizeof(localVotes));
+
+        for (int y = tile.y; y < tile.y + tile.height; ++y)
+        {
+            const uchar * pImage = image.ptr<uchar>(y);
+            const uchar * pRef = (pReference ? pReference->ptr<uchar>(y) : nullptr);
+            const uchar * pMask = m_mask.ptr<uchar>(y);
+            if (tileZone > 0)
+            {
+                int threshold = thresholds[tileZone];
+                int count = 0;
+                for (int x = tile.x; x < tile.x + tile.width; ++x)
+                    count += ((pRef ? abs(pImage[x] - pRef[x]) : pImage[x]) > threshold);
+                localVotes[tileZone] += count;
+            }
+            else
+            {
+                for (int x = tile.x; x < tile.x + tile.width; ++x)
+                {
+                    int zone = pMask[x];
+                    if ( zone && ((pRef ? abs(pImage[x] - pRef[x]) : pImage[x]) > thresholds[zone]) )
+                        ++localVotes[zone];
+                }
+            }
+        }
+
+        int first = (tileZone > 0) ? tileZone : 1;
+        int last = (tileZone > 0) ? tileZone : numZones;
+        for (int zone = first; zone <= last; ++zone)
+        {
+            if (!localVotes[zone])
+                continue;
+
+            int total;
+            #pragma omp atomic capture
+            total = votes[zone] += localVotes[zone];
+
+            if (total >= minVotes[zone])
+                triggered.store(zone, memory_order_relaxed);
+        }
+    }
+
+    voteCount = 0;
+    for (int i = 0; i < numZones; ++i)
+    {
+        m_lastVotes[i] = votes[i + 1];
+        voteCount += votes[i + 1];
+    }
+    m_lastTriggered = triggered - 1;
+
+    return (triggered != 0);
+}
@@ -0,0 +1,70 @@
+#ifndef MOTIONZONES_H_
+#define MOTIONZONES_H_
+
+#include <string>
+#include <vector>
+#include <boost/thread/mutex.hpp>
+#include <opencv2/opencv.hpp>
+
+
+// Region of the frame with its own trigger rules, or a region to ignore entirely.
+// Coordinates are normalized (0..1) so zones survive capture size changes.
+struct MotionZone
+{
+    std::string name;
+    bool ignore = false;
+    int threshold = -1; // Per-sample difference threshold; -1 uses the detector's global threshold.
+    int minVotes = 1;   // Changed samples needed before the zone triggers.
+    std::vector<cv::Point2f> polygon;
+
+    // Parse e.g. "include name=door threshold=30 votes=50 rect=0.1,0.2,0.3,0.5"
+    // or "ignore name=tree poly=0.7,0,1,0,1,0.4". Rectangles are x,y,width,height.
+    static bool Parse(const std::string & spec, MotionZone & zone);
+};
+
+
+// Zone map for one detector, rasterized onto the reduced detection image.
+// Without include zones, whatever the ignore zones leave is one implicit zone, with the detector's threshold and
+// a single vote, so ignore zones alone mask out areas without changing detection elsewhere.
+// The image is evaluated in square tiles. A tile lying wholly inside one zone (the common case) is counted with
+// a single comparison per sample; mixed tiles look up the zone of each sample. Tiles are processed in parallel,
+// and evaluation stops as soon as any zone reaches its vote count.
+class MotionZones
+{
+    static constexpr int c_tileSize = 32;
+    static constexpr int c_maxZones = 254;
+    static constexpr short c_mixedTile = -1;
+
+    mutable boost::mutex m_mutex;
+    std::vector<MotionZone> m_zones;
+    bool m_dirty = true;
+    cv::Size m_size;
+    bool m_wholeFrame = false; // Rasterized with the implicit zone, which has index m_zones.size().
+    cv::Mat m_mask; // Zone index + 1 per sample; 0 = not in any zone (or ignored).
+    std::vector<short> m_tileZones; // Per tile: zone index + 1 if uniform, 0 if empty, c_mixedTile otherwise.
+    std::vector<int> m_lastVotes;
+    int m_lastTriggered = -1;
+
+public:
+    MotionZones() = default;
+
+    bool Load(const std::string & path);
+    bool Add(const MotionZone & zone);
+    void Clear();
+    bool IsEmpty() const;
+    void Output() const;
+
+    // Count samples exceeding each zone's threshold, either in a difference image (pReference null)
+    // or in |image - *pReference|. Returns true once any zone triggers; voteCount receives the votes seen
+    // up to that point.
+    bool Evaluate(const cv::Mat & image, const cv::Mat * pReference, int defaultThreshold, int & voteCount);
+
+    // Clear mask samples outside the include zones (or inside ignore zones), at the size last evaluated.
+    void MaskOut(cv::Mat & mask) const;
+
+private:
+    bool HasIncludeZones() const;
+    void Rasterize(cv::Size size);
+};
+
+#endif /* MOTIONZONES_H_ */
@@ -51,7 +51,8 @@ static size_t payload_source(char * ptr, size_t size, size_t nmemb, void * userp
 
 void NotificationMgr::update()
 {
-    // Limit notifications to once per c_suppressSeconds.
+    // Limit notifications to once per c_suppressSeconds, across all cameras.
+    boost::mutex::scoped_lock lock(m_mutex);
     const auto currTime = boost::posix_time::microsec_clock::local_time();
     const auto diff = currTime - m_lastNotif;
 
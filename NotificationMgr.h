@@ -2,6 +2,7 @@
 #define NOTIFICATIONMGR_H_
 
 #include <boost/date_time/posix_time/posix_time.hpp>
+#include <boost/thread/mutex.hpp>
 
 
 class NotificationMgr
@@ -9,6 +10,7 @@ class NotificationMgr
     static constexpr int c_suppressSeconds = 60;
 
     boost::posix_time::ptime m_lastNotif{boost::posix_time::min_date_time};
+    boost::mutex m_mutex; // Shared by all camera pipelines.
 
 public:
     NotificationMgr() = default;
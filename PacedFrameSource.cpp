@@ -0,0 +1,130 @@
+
+#include <errno.h>
+#include <iostream>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+#include "PacedFrameSource.h"
+
+
+using namespace std;
+
+
+PacedFrameSource::PacedFrameSource(const CaptureConfig & config) :
+    FrameSource(config)
+{
+}
+
+PacedFrameSource::~PacedFrameSource()
+{
+    if (m_fd != -1)
+        close(m_fd);
+}
+
+bool PacedFrameSource::Open(int numBuffers)
+{
+    if (!OpenContent())
+        return false;
+
+    // Allocate buffers on the heap - these play the role of the driver's mmap buffers.
+    m_storage.resize(numBuffers);
+    for (int i = 0; i < numBuffers; ++i)
+    {
+        m_storage[i].resize(GetBufferSize());
+        m_buffers.push_back({m_storage[i].data(), m_storage[i].size()});
+    }
+
+    // Paced sources are driven by a periodic timer.
+    // Unpaced sources use a semaphore eventfd counting free buffers, so they poll readable exactly when a frame can be produced.
+    if (m_config.fps > 0)
+        m_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+    else
+        m_fd = eventfd(0, EFD_NONBLOCK | EFD_SEMAPHORE);
+
+    if (m_fd == -1)
+    {
+        cout << "Error creating frame pacing descriptor" << endl;
+        return false;
+    }
+
+    return true;
+}
+
+void PacedFrameSource::Close()
+{
+    if (m_fd != -1)
+    {
+        close(m_fd);
+        m_fd = -1;
+    }
+
+    m_buffers.clear();
+    m_storage.clear();
+    m_freeQueue = {};
+
+    CloseContent();
+}
+
+bool PacedFrameSource::Start()
+{
+    for (size_t i = 0; i < m_buffers.size(); ++i)
+    {
+        if (!Enqueue(i))
+            return false;
+    }
+
+    if (m_config.fps > 0)
+    {
+        struct itimerspec spec = {};
+        long long periodNs = 1000000000LL / m_config.fps;
+        spec.it_interval.tv_sec = periodNs / 1000000000LL;
+        spec.it_interval.tv_nsec = periodNs % 1000000000LL;
+        spec.it_value = spec.it_interval;
+        if (timerfd_settime(m_fd, 0, &spec, nullptr) == -1)
+        {
+            cout << "Error arming frame pacing timer" << endl;
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool PacedFrameSource::Dequeue(int & index)
+{
+    // Consume timer expirations (late ticks are collapsed into a single frame, as a camera would),
+    // or take one count from the free buffer semaphore.
+    uint64_t value;
+    if (read(m_fd, &value, sizeof(value)) != sizeof(value))
+        return false;
+
+    if (m_freeQueue.empty())
+    {
+        errno = EAGAIN;
+        return false;
+    }
+
+    index = m_freeQueue.front();
+    m_freeQueue.pop();
+
+    FillFrame(static_cast<unsigned char *>(m_buffers[index].start), m_frameNumber++);
+    return true;
+}
+
+bool PacedFrameSource::Enqueue(int index)
+{
+    m_freeQueue.push(index);
+
+    if (m_config.fps == 0)
+    {
+        uint64_t value = 1;
+        if (write(m_fd, &value, sizeof(value)) != sizeof(value))
+        {
+            cout << "Error signalling free buffer" << endl;
+            return false;
+        }
+    }
+
+    return true;
+}
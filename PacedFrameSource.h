@@ -0,0 +1,41 @@
+#ifndef PACEDFRAMESOURCE_H_
+#define PACEDFRAMESOURCE_H_
+
+#include <cstdint>
+#include <queue>
+#include <vector>
+
+#include "FrameSource.h"
+
+
+// Base for software frame sources that fill heap buffers at a fixed rate (timerfd) or as fast as possible.
+class PacedFrameSource : public FrameSource
+{
+    std::vector<std::vector<unsigned char> > m_storage;
+    std::vector<RawBuffer> m_buffers;
+    std::queue<int> m_freeQueue;
+    int m_fd = -1;
+    uint64_t m_frameNumber = 0;
+
+public:
+    PacedFrameSource(const CaptureConfig & config);
+    ~PacedFrameSource();
+
+    bool Open(int numBuffers) override;
+    void Close() override;
+    bool Start() override;
+    int GetFd() const override { return m_fd; }
+    const RawBuffer & GetBuffer(int index) const override { return m_buffers[index]; }
+    bool Dequeue(int & index) override;
+    bool Enqueue(int index) override;
+
+protected:
+    size_t GetBufferSize() const { return GetFrameSize(m_config.pixelFormat, m_stride, m_config.height); }
+
+    // Derived class hooks for acquiring content and producing a single frame.
+    virtual bool OpenContent() = 0;
+    virtual void CloseContent() = 0;
+    virtual void FillFrame(unsigned char * pData, uint64_t frameNumber) = 0;
+};
+
+#endif /* PACEDFRAMESOURCE_H_ */
@@ -1,36 +1,83 @@
+
 #include <cstdlib>
 #include <fstream>
 
 #include "PiMgr.h"
-#include "MotionDetector.h"
+#include "CameraPipeline.h"
+#include "FrameCodec.h"
 #include "NotificationMgr.h"
-#include "Profiling.h"
+#include "ProcessingStage.h"
 #include "SocketMgr.h"
-#include "VideoCaptureMgr.h"
+#include "ThreadUtil.h"
+#include "Tracer.h"
 
 
 using namespace std;
 using namespace cv;
 
 
-const char * const PiMgr::c_imageProcModeNames[] = {"None", "MotionDetect", "Gray", "Blur"};
-const char * const PiMgr::c_imageProcStageNames[] = {"MotionDetect", "Gray", "Blur", "Send", "Total"};
+// Cycled by the mode key.
+const char * const PiMgr::c_chainPresets[c_numChainPresets] = {"bgr", "motion", "gray", "grayblur", "bgr regions"};
+
 
+Config PiMgr::GetDefaultConfig()
+{
+    Config config(c_defKernelSize, c_defThreshold, c_defBackgroundModel, c_defLearningShift, c_defDetectionMode);
+    config.chainSpec = GetDefaultChain();
+    config.codecSpec = c_defCodec;
+    return config;
+}
 
-PiMgr::PiMgr() :
-    m_motionDetector(new MotionDetector(c_defThreshold)),
+PiMgr::PiMgr(const vector<CaptureConfig> & captureConfigs, const Config & config) :
     m_notificationMgr(new NotificationMgr()),
-    m_config(Config(c_defKernelSize, c_defThreshold))
+    m_config(config)
 {
-    m_pSocketMgr = new SocketMgr(this);
+    m_chainPreset = FindChainPreset(m_config.chainSpec);
+    m_pSocketMgr = new SocketMgr(this, (int)captureConfigs.size());
+
+    for (size_t i = 0; i < captureConfigs.size(); ++i)
+    {
+        CaptureConfig captureConfig = captureConfigs[i];
+
+        // Spread multiple cameras over separate cores unless placement was given explicitly.
+        if ( (captureConfigs.size() > 1) && (captureConfig.cpu < 0) )
+            captureConfig.cpu = GetDefaultCpu((int)i);
+
+        m_pipelines.emplace_back(new CameraPipeline(this, (int)i, captureConfig, m_config));
+    }
 }
 
 PiMgr::~PiMgr()
 {
     delete m_pSocketMgr;
 
-    if (m_thread.joinable())
-        m_thread.join();
+    // Pipelines join their worker threads on destruction.
+    m_pipelines.clear();
+}
+
+eBDErrorCode PiMgr::GetErrorCode() const
+{
+    if (m_errorCode)
+        return m_errorCode;
+
+    for (const auto & pipeline : m_pipelines)
+    {
+        if (pipeline->GetErrorCode())
+            return pipeline->GetErrorCode();
+    }
+
+    return EC_NONE;
+}
+
+bool PiMgr::IsRunning() const
+{
+    for (const auto & pipeline : m_pipelines)
+    {
+        if (pipeline->IsRunning())
+            return true;
+    }
+
+    return false;
 }
 
 bool PiMgr::Initialize()
@@ -42,307 +89,275 @@ bool PiMgr::Initialize()
         return false;
     }
 
-    m_running = true;
-    m_thread = boost::thread(&PiMgr::WorkerFunc, this);
+    // Load zones before starting anything, so a bad zone file aborts cleanly.
+    for (auto & pipeline : m_pipelines)
+    {
+        if (!pipeline->LoadZones())
+        {
+            m_errorCode = EC_ZONELOADFAIL;
+            return false;
+        }
+    }
+
+    DisplayCurrentParamPage();
+
+    for (auto & pipeline : m_pipelines)
+        pipeline->Start();
+
     return true;
 }
 
 void PiMgr::Terminate()
 {
-    m_thread.interrupt();
+    for (auto & pipeline : m_pipelines)
+        pipeline->Terminate();
 }
 
-void PiMgr::UpdateIPM()
+void PiMgr::CycleChainPreset()
 {
-    m_ipm = (eBDImageProcMode)(((int)m_ipm + 1) % IPM_MAX);
-    cout << "Image processing mode: " << c_imageProcModeNames[m_ipm] << endl;
+    m_chainPreset = (m_chainPreset + 1) % c_numChainPresets;
+    UpdateProcessingChain(c_chainPresets[m_chainPreset]);
 }
 
-void PiMgr::OutputStatus()
+void PiMgr::UpdateProcessingChain(const string & spec)
 {
-    cout << endl << "Statistics" << endl;
-
-    cout << "  Total Frames=" << m_status.numFrames;
-    cout << "\tDelayed Frames=" << m_status.numDroppedFrames;
-
-    if (m_status.numFrames == 0)
-    {
-        cout << endl;
+    // Validate once here so a bad spec leaves every camera on its current chain.
+    ProcessingChain chain;
+    if (!ProcessingChain::Parse(spec, chain))
         return;
-    }
 
-    cout << "\tAverage FPS=" << (m_status.numFrames / m_diff.total_seconds()) << endl;
+    m_config.chainSpec = spec;
+    m_chainPreset = FindChainPreset(spec);
+
+    for (auto & pipeline : m_pipelines)
+        pipeline->SetProcessingChain(spec);
+    cout << "Processing chain: " << spec << endl;
+}
 
-    cout << "  Processing times:" << endl;
-    for (int i = IPS_MOTIONDETECT; i < IPS_MAX; ++i)
+int PiMgr::FindChainPreset(const string & spec)
+{
+    for (int i = 0; i < c_numChainPresets; ++i)
     {
-        cout << "    " << c_imageProcStageNames[i] <<
-                ": curr=" << m_status.currProcessUs[i] <<
-                ", avg=" << (m_status.totalProcessUs[i] / m_status.numFrames) <<
-                ", max=" << m_status.maxProcessUs[i] << endl;
+        if (spec == c_chainPresets[i])
+            return i;
     }
+    return -1;
 }
 
-void PiMgr::OutputConfig()
+void PiMgr::OutputStages()
 {
-    cout << endl << "Configuration" << endl;
-    cout << "  Image Processing Mode=" << c_imageProcModeNames[m_ipm] << endl;
-    cout << "  Current Parameter Page=" << m_paramPage << endl;
-    cout << "  Kernel Size=" << (int)m_config.kernelSize << endl;
-    cout << "  Threshold=" << (int)m_config.threshold << endl;
+    ProcessingStage::OutputRegistered();
 }
 
-void PiMgr::UpdatePage()
+void PiMgr::OutputStatus()
 {
-    m_paramPage = (eBDParamPage)((m_paramPage + 1) % PP_MAX);
-    DisplayCurrentParamPage();
+    for (auto & pipeline : m_pipelines)
+        pipeline->OutputStatus();
 }
 
-void PiMgr::UpdateParam(int param, bool up)
+void PiMgr::OutputConfig()
 {
-    switch (m_paramPage)
-    {
-    case PP_BLUR:
-        if ( up && (m_config.kernelSize < 15) )
-            m_config.kernelSize += 2;
-        else if (!up && (m_config.kernelSize > 1))
-            m_config.kernelSize -= 2;
-        break;
-
-    case PP_THRESHOLD:
-        if ( up && (m_config.threshold < 100) )
-            m_config.threshold += 1;
-        else if (!up && (m_config.threshold > 1))
-            m_config.threshold -= 1;
-
-        // Notify "subscribers":
-        m_motionDetector->setThreshold(m_config.threshold);
-        break;
-    }
+    cout << endl << "Configuration" << endl;
+    cout << "  Processing Chain=" << m_config.chainSpec << endl;
+    cout << "  Current Parameter Page=" << m_paramPage << endl;
+    cout << "  Kernel Size=" << (int)m_config.kernelSize << endl;
+    cout << "  Threshold=" << (int)m_config.threshold << endl;
+    cout << "  Detection Mode=" << MotionPyramid::c_modeNames[m_config.detectionMode] << endl;
+    cout << "  Background Model=" << BackgroundModel::c_modelNames[m_config.backgroundModel] << endl;
+    cout << "  Learning Rate=1/" << (1 << m_config.learningShift) << endl;
+    cout << "  Motion Events=" << m_config.eventConfig.ToString() << endl;
+    cout << "  Frame Queue=" << m_config.frameQueueConfig.ToString() << endl;
+    cout << "  Recording=" << m_config.recordingConfig.ToString() << endl;
+    cout << "  Codec=" << m_config.codecSpec << endl;
+    cout << "  Rate Control=" << m_config.rateConfig.ToString() << endl;
+    cout << "  Selected Camera=" << m_selectedCamera << endl;
+
+    for (auto & pipeline : m_pipelines)
+        pipeline->OutputCaptureConfig();
 }
 
-void PiMgr::WorkerFunc()
+void PiMgr::SelectCamera(int camera)
 {
-    // Initialize video.
-    VideoCaptureMgr vcMgr(this);
-    if (!vcMgr.Initialize())
+    if ( (camera < 0) || (camera >= GetNumCameras()) )
     {
-        cerr << "Error: Failed to open video capture." << endl;
-        m_errorCode = EC_CAPTUREOPENFAIL;
-        m_running = false;
+        cerr << "Error: No camera " << camera << "." << endl;
         return;
     }
 
-    m_status = Status();
-
-    DisplayCurrentParamPage();
+    m_selectedCamera = camera;
+    cout << "Selected camera: " << camera << endl;
+}
 
-    // Continually process frames.
-    Mat * frame;
-    int nextFrame = c_frameSkip;
-    while (true)
-    {
-        //PROFILE_START;
+void PiMgr::CycleCamera()
+{
+    SelectCamera((m_selectedCamera + 1) % GetNumCameras());
+}
 
-        // Retrieve frame.
-        int skippedFrames;
-        do
-        {
-            if ( (skippedFrames = vcMgr.GetLatest(frame)) < 0 )
-            {
-                if (m_interrupted)
-                {
-                    cout << "Interrupted while waiting for frame - shutting down server..." << endl;
-                    m_errorCode = EC_INTERRUPT;
-                }
-                else
-                {
-                    cerr << "Error: Failed to read a frame." << endl;
-                    m_errorCode = EC_CAPTUREGRABFAIL;
-                }
-                break;
-            }
-            nextFrame -= skippedFrames + 1;
-            //PROFILE_LOG(read);
-        } while (nextFrame > 0);
-        if (m_errorCode)
-            break;
-        nextFrame += c_frameSkip;
-        if (nextFrame < c_frameBacklogMin)
-            nextFrame = c_frameBacklogMin;
+void PiMgr::OutputCaptureModes()
+{
+    m_pipelines[m_selectedCamera]->OutputCaptureModes();
+}
 
-        if (m_status.SuppressionProcessing())
-            m_startTime = boost::posix_time::microsec_clock::local_time();
+void PiMgr::UpdateCaptureConfig(const string & spec)
+{
+    m_pipelines[m_selectedCamera]->UpdateCaptureConfig(spec);
+}
 
-        //PROFILE_LOG(read);
+void PiMgr::OutputZones()
+{
+    m_pipelines[m_selectedCamera]->OutputZones();
+}
 
-        if (!m_status.IsSuppressed())
-        {
-            if (nextFrame != c_frameSkip)
-            {
-                m_status.numDroppedFrames++;
-
-                // Not possible to "catch up" on backlog when running full speed - just move on.
-                if (c_frameSkip == 1)
-                    nextFrame = 1;
-            }
-            m_status.numFrames++;
-        }
+void PiMgr::AddZone(const string & spec)
+{
+    m_pipelines[m_selectedCamera]->AddZone(spec);
+}
 
-        ProcessFrame(*frame);
+void PiMgr::ClearZones()
+{
+    m_pipelines[m_selectedCamera]->ClearZones();
+}
 
-        m_diff = boost::posix_time::microsec_clock::local_time() - m_startTime;
+void PiMgr::UpdateEventConfig(const string & spec)
+{
+    if (!MotionEventConfig::Parse(spec, m_config.eventConfig))
+        return;
 
-        try
-        {
-            boost::this_thread::interruption_point();
-        }
-        catch (boost::thread_interrupted&)
-        {
-            cout << "Interrupted after processing frame - shutting down server..." << endl;
-            m_errorCode = EC_INTERRUPT;
-            break;
-        }
-    }
+    cout << "Motion events: " << m_config.eventConfig.ToString() << endl;
 
-    m_running = false;
+    for (auto & pipeline : m_pipelines)
+        pipeline->SetEventConfig(m_config.eventConfig);
 }
 
-void PiMgr::ProcessFrame(Mat & frame)
+void PiMgr::UpdateFrameQueueConfig(const string & spec)
 {
-    Mat * pFrameFinal = nullptr;
-    eBDImageProcMode ipm = m_ipm;
-    int processUs[IPS_MAX];
-    memset(processUs, 0, sizeof(processUs));
+    if (!FrameQueueConfig::Parse(spec, m_config.frameQueueConfig))
+        return;
 
-    PROFILE_START;
+    cout << "Frame queue: " << m_config.frameQueueConfig.ToString() << endl;
 
-    bool motionDetected = m_motionDetector->update(frame);
-    processUs[IPS_MOTIONDETECT] = PROFILE_DIFF;
-    PROFILE_START;
+    for (auto & pipeline : m_pipelines)
+        pipeline->SetFrameQueueConfig(m_config.frameQueueConfig);
+}
 
-    if (motionDetected)
-    {
-        m_notificationMgr->update();
+void PiMgr::UpdateCodec(const string & spec)
+{
+    // Validate once here so a bad spec leaves every camera on its current codec.
+    unique_ptr<FrameCodec> pCodec(FrameCodec::Create(spec));
+    if (!pCodec)
+        return;
 
-        // Use processing pipeline based on selected IPM.
-        switch (ipm)
-        {
-        case IPM_NONE:
-            pFrameFinal = &frame;
-            break;
+    m_config.codecSpec = pCodec->GetSpec();
+    cout << "Codec: " << m_config.codecSpec << endl;
 
-        case IPM_MOTIONDETECT:
-            pFrameFinal = &m_motionDetector->getFrame();
-            break;
+    for (auto & pipeline : m_pipelines)
+        pipeline->SetCodec(m_config.codecSpec);
+}
 
-        case IPM_GRAY:
-            // Convert to grayscale image.
-            cvtColor(frame, m_frameGray, COLOR_BGR2GRAY);
-            processUs[IPS_GRAY] = PROFILE_DIFF;
-            PROFILE_START;
+void PiMgr::UpdateRecordingConfig(const string & spec)
+{
+    if (!RecordingConfig::Parse(spec, m_config.recordingConfig))
+        return;
 
-            pFrameFinal = &m_frameGray;
-            break;
+    cout << "Recording: " << m_config.recordingConfig.ToString() << endl;
 
-        case IPM_BLUR:
-            // Convert to grayscale image and apply gaussian blur.
-            cvtColor(frame, m_frameGray, COLOR_BGR2GRAY);
-            processUs[IPS_GRAY] = PROFILE_DIFF;
-            PROFILE_START;
+    for (auto & pipeline : m_pipelines)
+        pipeline->SetRecordingConfig(m_config.recordingConfig);
+}
 
-            GaussianBlur(m_frameGray, m_frameFilter, Size(m_config.kernelSize, m_config.kernelSize), 0, 0);
-            processUs[IPS_BLUR] = PROFILE_DIFF;
-            PROFILE_START;
+void PiMgr::UpdateRateConfig(const string & spec)
+{
+    if (!RateConfig::Parse(spec, m_config.rateConfig))
+        return;
 
-            pFrameFinal = &m_frameFilter;
-            break;
-        }
+    cout << "Rate control: " << m_config.rateConfig.ToString() << endl;
 
-        {
-            unique_lock<mutex> lock(m_frameQueueMutex);
-            m_frameQueue.push(CompressFrame(pFrameFinal));
-        }
-    }
+    for (auto & pipeline : m_pipelines)
+        pipeline->SetRateConfig(m_config.rateConfig);
+}
 
-    // Compress and transmit the frame if the client is ready.
-    if (m_pSocketMgr->IsReady())
+void PiMgr::UpdateTracing(const string & spec)
+{
+    if ( (spec == "on") || (spec == "off") )
     {
-        CompressFramePtr compressedFrame;
-        {
-            unique_lock<mutex> lock(m_frameQueueMutex);
-
-            if (!m_frameQueue.empty())
-            {
-                compressedFrame = move(m_frameQueue.front());
-                m_frameQueue.pop();
-            }
-        }
-
-        m_pSocketMgr->SendFrame(move(compressedFrame));
-        processUs[IPS_SENT] = PROFILE_DIFF;
+        Tracer::Enable(spec == "on");
+        cout << "Tracing " << spec << "." << endl;
     }
-
-    // Update status.
-    if (!m_status.IsSuppressed())
+    else if ( (spec == "dump") || (spec.compare(0, 5, "dump ") == 0) )
     {
-        for (int i = IPS_MOTIONDETECT; i < IPS_MAX; ++i)
-        {
-            if (processUs[i])
-            {
-                if (i < IPS_TOTAL)
-                    processUs[IPS_TOTAL] += processUs[i];
-                m_status.currProcessUs[i] = processUs[i];
-                m_status.totalProcessUs[i] += processUs[i];
-                if (processUs[i] > m_status.maxProcessUs[i])
-                    m_status.maxProcessUs[i] = processUs[i];
-            }
-            else
-            {
-                m_status.currProcessUs[i] = 0;
-            }
-        }
+        string path = (spec.size() > 5) ? spec.substr(5) : c_tracePath;
+        if (Tracer::Dump(path))
+            cout << "Trace written to " << path << "." << endl;
     }
+    else
+        cerr << "Error: Invalid trace command '" << spec << "'; expected on, off or dump [<path>]." << endl;
 }
 
-PiMgr::CompressFramePtr PiMgr::CompressFrame(Mat * pFrame) const
+void PiMgr::ToggleTracing()
 {
-    // Encode as PNG with fast compression.
-    vector<int> compression_params;
-    compression_params.push_back(IMWRITE_PNG_COMPRESSION);
-    compression_params.push_back(1);
-
-    // Parallel processing for PNG encoding.
-    // Break image into segments and independently encode them.
-    vector<uchar> buffers[c_numTxSegments];
-    int segmentHeight = pFrame->rows / c_numTxSegments;
-
-    #pragma omp parallel for
-    for (int i = 0; i < c_numTxSegments; ++i)
+    // Turning tracing off writes out what it caught.
+    if (Tracer::IsEnabled())
     {
-        Mat mat = (*pFrame)(Rect(0, segmentHeight * i, pFrame->cols, segmentHeight));
-        imencode(".png", mat, buffers[i], compression_params);
+        UpdateTracing("off");
+        UpdateTracing("dump");
     }
+    else
+        UpdateTracing("on");
+}
+
+void PiMgr::UpdatePage()
+{
+    m_paramPage = (eBDParamPage)((m_paramPage + 1) % PP_MAX);
+    DisplayCurrentParamPage();
+}
 
-    // Concatenate length-value pairs of buffers.
-    size_t bufferSize = c_numTxSegments * sizeof(int32_t);
-    for (int i = 0; i < c_numTxSegments; ++i)
+void PiMgr::UpdateParam(int param, bool up)
+{
+    switch (m_paramPage)
     {
-        bufferSize += buffers[i].size();
-    }
+    case PP_BLUR:
+        if ( up && (m_config.kernelSize < 15) )
+            m_config.kernelSize += 2;
+        else if (!up && (m_config.kernelSize > 1))
+            m_config.kernelSize -= 2;
+        break;
 
-    auto pBuf = make_unique<vector<uchar> >();
-    pBuf->reserve(bufferSize);
+    case PP_THRESHOLD:
+        if (param == 2)
+        {
+            m_config.detectionMode = (eBDDetectionMode)((m_config.detectionMode + (up ? 1 : DTM_MAX - 1)) % DTM_MAX);
+            cout << "Detection mode: " << MotionPyramid::c_modeNames[m_config.detectionMode] << endl;
 
-    for (int i = 0; i < c_numTxSegments; ++i)
-    {
-        int32_t size = buffers[i].size();
-        uchar * sizeData = reinterpret_cast<uchar *>(&size);
-        pBuf->insert(pBuf->end(), sizeData, sizeData + sizeof(int32_t));
-        pBuf->insert(pBuf->end(), buffers[i].begin(), buffers[i].end());
-    }
+            for (auto & pipeline : m_pipelines)
+                pipeline->SetDetectionMode(m_config.detectionMode);
+            break;
+        }
+
+        if ( up && (m_config.threshold < 100) )
+            m_config.threshold += 1;
+        else if (!up && (m_config.threshold > 1))
+            m_config.threshold -= 1;
+
+        // Notify "subscribers":
+        for (auto & pipeline : m_pipelines)
+            pipeline->SetThreshold(m_config.threshold);
+        break;
+
+    case PP_BACKGROUND:
+        if (param == 1)
+            m_config.backgroundModel = (eBDBackgroundModel)((m_config.backgroundModel + (up ? 1 : BGM_MAX - 1)) % BGM_MAX);
+        else if ( up && (m_config.learningShift < BackgroundModel::c_maxLearningShift) )
+            m_config.learningShift += 1;
+        else if (!up && (m_config.learningShift > BackgroundModel::c_minLearningShift))
+            m_config.learningShift -= 1;
 
-    return pBuf;
+        cout << "Background model: " << BackgroundModel::c_modelNames[m_config.backgroundModel] <<
+                ", learning rate 1/" << (1 << m_config.learningShift) << endl;
+
+        for (auto & pipeline : m_pipelines)
+            pipeline->SetBackgroundModel(m_config.backgroundModel, m_config.learningShift);
+        break;
+    }
 }
 
 void PiMgr::DisplayCurrentParamPage()
@@ -356,6 +371,12 @@ void PiMgr::DisplayCurrentParamPage()
 
     case PP_THRESHOLD:
         cout << "  1) Threshold" << endl;
+        cout << "  2) Detection Mode" << endl;
+        break;
+
+    case PP_BACKGROUND:
+        cout << "  1) Background Model" << endl;
+        cout << "  2) Learning Rate" << endl;
         break;
     }
 }
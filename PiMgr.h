@@ -2,6 +2,7 @@
 #define PIMGR_H_
 
 #include <algorithm>
+#include <atomic>
 #include <limits>
 #include <memory>
 #include <mutex>
@@ -13,6 +14,15 @@
 #include <boost/thread/mutex.hpp>
 #include <opencv2/opencv.hpp>
 
+#include "BackgroundModel.h"
+#include "FrameQueue.h"
+#include "FrameSource.h"
+#include "LatencyHistogram.h"
+#include "MotionEvent.h"
+#include "MotionPyramid.h"
+#include "RateController.h"
+#include "Recorder.h"
+
 #define STATUS_SUPPRESS_DELAY 10
 
 
@@ -24,25 +34,20 @@ enum eBDErrorCode
     EC_CAPTUREOPENFAIL,
     EC_CAPTUREGRABFAIL,
     EC_RELEASEFAIL,
+    EC_ZONELOADFAIL,
     EC_INTERRUPT
 };
 
-enum eBDImageProcMode
-{
-    IPM_NONE,
-    IPM_MOTIONDETECT,
-    IPM_GRAY,
-    IPM_BLUR,
-    IPM_MAX
-};
-
 enum eBDImageProcStage
 {
     IPS_MOTIONDETECT,
-    IPS_GRAY,
-    IPS_BLUR,
+    IPS_SNAPSHOT, // Copy of the capture buffer handed to the process stage.
+    IPS_REGIONS,
+    IPS_PROCESS,  // Whole processing chain; each chain stage also keeps its own times.
+    IPS_ENCODE,
     IPS_SENT,
     IPS_TOTAL,
+    IPS_HANDOFF, // Capture-to-consumer latency; not part of the processing total.
     IPS_MAX
 };
 
@@ -50,28 +55,33 @@ enum eBDParamPage
 {
     PP_BLUR,
     PP_THRESHOLD,
+    PP_BACKGROUND,
     PP_MAX
 };
 
 struct Status
 {
-    unsigned char suppressDelay;
+    std::atomic<unsigned char> suppressDelay;
     int numFrames;
     int numDroppedFrames;
-    int currProcessUs[IPS_MAX];
-    int totalProcessUs[IPS_MAX];
-    int maxProcessUs[IPS_MAX];
+    int numEvents;
+    LatencyHistogram processUs[IPS_MAX]; // Recorded lock-free from each stage's thread.
 
 public:
-    Status() : suppressDelay(STATUS_SUPPRESS_DELAY), numFrames(0), numDroppedFrames(0)
+    Status() { Reset(); }
+
+    // Suppression comes back first, so stage threads stop recording while the histograms are cleared.
+    void Reset()
     {
+        suppressDelay = STATUS_SUPPRESS_DELAY;
+        numFrames = numDroppedFrames = numEvents = 0;
         for (int i = 0; i < IPS_MAX; ++i)
         {
-            currProcessUs[i] = totalProcessUs[i] = maxProcessUs[i] = 0;
+            processUs[i].Reset();
         }
     }
 
-    bool IsSuppressed() const { return suppressDelay; }
+    bool IsSuppressed() const { return (suppressDelay != 0); }
 
     bool SuppressionProcessing()
     {
@@ -90,76 +100,107 @@ struct Config
 {
     unsigned char kernelSize; // Gaussian kernel size used for preliminary blur op.
     unsigned char threshold;
-
-    Config(unsigned char _kernelSize, unsigned char _threshold) :
+    eBDBackgroundModel backgroundModel;
+    unsigned char learningShift; // Background learning rate is 1 / 2^learningShift per frame.
+    eBDDetectionMode detectionMode;
+    MotionEventConfig eventConfig;
+    FrameQueueConfig frameQueueConfig;
+    RecordingConfig recordingConfig;
+    RateConfig rateConfig;
+    std::string chainSpec; // Processing chain, e.g. "grayblur scale:0.5".
+    std::string codecSpec; // Frame codec, e.g. "jpeg:80".
+
+    Config(unsigned char _kernelSize, unsigned char _threshold, eBDBackgroundModel _backgroundModel,
+           unsigned char _learningShift, eBDDetectionMode _detectionMode) :
         kernelSize(_kernelSize),
-        threshold(_threshold)
+        threshold(_threshold),
+        backgroundModel(_backgroundModel),
+        learningShift(_learningShift),
+        detectionMode(_detectionMode)
     {}
 };
 
 
-class SocketMgr;
-class MotionDetector;
+class CameraPipeline;
 class NotificationMgr;
+class SocketMgr;
 
 
+// Owns the camera pipelines and the state they share: client sockets, notifications and processing configuration.
 class PiMgr
 {
-    static const char * const c_imageProcModeNames[];
-    static const char * const c_imageProcStageNames[];
-    static constexpr int c_frameSkip = 2;
-    static constexpr int c_frameBacklogMin = -5;
+    static const char * const c_chainPresets[];
+    static constexpr int c_numChainPresets = 5;
     static constexpr int c_defKernelSize = 5;
     static constexpr int c_defThreshold = 40;
-    static constexpr int c_numTxSegments = 4;
-
-    using CompressFramePtr = std::unique_ptr<std::vector<uchar>>;
+    static constexpr eBDBackgroundModel c_defBackgroundModel = BGM_GAUSSIAN;
+    static constexpr int c_defLearningShift = 5;
+    static constexpr eBDDetectionMode c_defDetectionMode = DTM_HALF;
+    static constexpr int c_defChainPreset = 3;
+    static constexpr const char * c_defCodec = "png:1";
 
     eBDErrorCode m_errorCode = EC_NONE;
     SocketMgr * m_pSocketMgr;
-    std::unique_ptr<MotionDetector> m_motionDetector;
     std::unique_ptr<NotificationMgr> m_notificationMgr;
-    boost::thread m_thread;
-    volatile bool m_running = false;
+    std::vector<std::unique_ptr<CameraPipeline>> m_pipelines;
+    std::atomic<int> m_selectedCamera{0}; // Target of per-camera commands.
     bool m_interrupted = false;
-    eBDImageProcMode m_ipm = IPM_BLUR;
-    Status m_status;
+    int m_chainPreset = -1; // Last preset selected, or -1 for a custom chain.
     Config m_config;
     eBDParamPage m_paramPage = PP_BLUR;
-    boost::posix_time::ptime m_startTime;
-    boost::posix_time::time_duration m_diff;
-    cv::Mat m_frameGray;
-    cv::Mat m_frameFilter;
     bool m_debugMode = false;
-    std::queue<CompressFramePtr> m_frameQueue;
-    mutable std::mutex m_frameQueueMutex;
 
 public:
-    PiMgr();
+    static constexpr const char * c_tracePath = "/tmp/pi-server-trace.json"; // Default for trace dumps.
+
+    static const char * GetDefaultChain() { return c_chainPresets[c_defChainPreset]; }
+
+    static Config GetDefaultConfig();
+
+    PiMgr(const std::vector<CaptureConfig> & captureConfigs, const Config & config);
     ~PiMgr();
 
-    eBDErrorCode GetErrorCode() const { return m_errorCode; }
-    bool IsRunning() const { return m_running; }
+    eBDErrorCode GetErrorCode() const;
+    bool IsRunning() const;
     bool IsInterrupted() const { return m_interrupted; }
     void SetInterrupted() { m_interrupted = true; }
 
+    const Config & GetConfig() const { return m_config; }
+    SocketMgr & GetSocketMgr() { return *m_pSocketMgr; }
+    NotificationMgr & GetNotificationMgr() { return *m_notificationMgr; }
+    int GetNumCameras() const { return (int)m_pipelines.size(); }
+
     bool Initialize();
     void Terminate();
 
-    void UpdateIPM();
+    void CycleChainPreset();
+    void UpdateProcessingChain(const std::string & spec);
+    void OutputStages();
     void OutputStatus();
     void OutputConfig();
     void UpdatePage();
     void UpdateParam(int param, bool up);
     void ToggleDebugMode() { m_debugMode = !m_debugMode; }
+    void SelectCamera(int camera);
+    void CycleCamera();
+    void OutputCaptureModes();
+    void UpdateCaptureConfig(const std::string & spec);
+    void OutputZones();
+    void AddZone(const std::string & spec);
+    void ClearZones();
+    void UpdateEventConfig(const std::string & spec);
+    void UpdateFrameQueueConfig(const std::string & spec);
+    void UpdateRecordingConfig(const std::string & spec);
+    void UpdateCodec(const std::string & spec);
+    void UpdateRateConfig(const std::string & spec);
+    // "on", "off", or "dump [<path>]".
+    void UpdateTracing(const std::string & spec);
+    void ToggleTracing();
 
 private:
-    void WorkerFunc();
-    void ProcessFrame(cv::Mat & frame);
-    CompressFramePtr CompressFrame(cv::Mat * pFrame) const;
+    static int FindChainPreset(const std::string & spec);
     void DisplayCurrentParamPage();
 
 };
 
 #endif /* PIMGR_H_ */
-
@@ -0,0 +1,358 @@
+
+#include <cstdlib>
+#include <iostream>
+#include <sstream>
+
+#include "GrayBlur.h"
+#include "ProcessingStage.h"
+#include "Tracer.h"
+#include "VideoFrame.h"
+
+
+using namespace std;
+using namespace cv;
+
+
+const Mat & StageContext::GetImage()
+{
+    if (!pImage)
+        pImage = &pFrame->GetBgr();
+    return *pImage;
+}
+
+
+// Built-in stages.
+
+// Colour frame; converts a gray image back to three channels.
+class BgrStage : public ProcessingStage
+{
+    Mat m_output;
+
+public:
+    void Apply(StageContext & context) override
+    {
+        if ( context.pImage && (context.pImage->channels() == 1) )
+        {
+            cvtColor(*context.pImage, m_output, COLOR_GRAY2BGR);
+            context.SetOutput(m_output);
+        }
+        else
+            context.GetImage();
+    }
+};
+
+// Grayscale; free for YUV capture formats when applied to the frame itself.
+class GrayStage : public ProcessingStage
+{
+    Mat m_output;
+
+public:
+    void Apply(StageContext & context) override
+    {
+        if (!context.pImage)
+            context.pImage = &context.pFrame->GetGray();
+        else if (context.pImage->channels() == 3)
+        {
+            cvtColor(*context.pImage, m_output, COLOR_BGR2GRAY);
+            context.SetOutput(m_output);
+        }
+    }
+};
+
+// The reduced image or difference plane the motion detector worked on.
+class MotionStage : public ProcessingStage
+{
+public:
+    void Apply(StageContext & context) override
+    {
+        context.pImage = context.pDetectorImage;
+        context.stageOwned = false;
+    }
+};
+
+class BlurStage : public ProcessingStage
+{
+    int m_kernelSize; // 0 follows the blur parameter page.
+    Mat m_output;
+
+public:
+    BlurStage(int kernelSize) : m_kernelSize(kernelSize) {}
+
+    void Apply(StageContext & context) override
+    {
+        int kernelSize = (m_kernelSize ? m_kernelSize : context.defaultKernelSize);
+        GaussianBlur(context.GetImage(), m_output, Size(kernelSize, kernelSize), 0, 0);
+        context.SetOutput(m_output);
+    }
+};
+
+// Gray and blur in one pass over the image (see GrayBlur). Applied to the frame itself, it reads the capture buffer
+// directly, so YUYV and BGR frames never produce a full-size gray image first.
+class GrayBlurStage : public ProcessingStage
+{
+    eBDBlurMethod m_method;
+    int m_kernelSize; // 0 follows the blur parameter page.
+    std::unique_ptr<GrayBlur> m_pBlur;
+    Mat m_output;
+
+public:
+    GrayBlurStage(eBDBlurMethod method, int kernelSize) : m_method(method), m_kernelSize(kernelSize) {}
+
+    void Apply(StageContext & context) override
+    {
+        int kernelSize = (m_kernelSize ? m_kernelSize : context.defaultKernelSize);
+        if ( !m_pBlur || (m_pBlur->GetKernelSize() != kernelSize) )
+            m_pBlur.reset(new GrayBlur(m_method, kernelSize));
+
+        const Mat * pInput = context.pImage;
+        if (!pInput)
+            pInput = (context.pFrame->GetFormat() == PXF_NV12) ? &context.pFrame->GetGray() : &context.pFrame->GetRaw();
+
+        m_pBlur->Apply(*pInput, m_output);
+        context.SetOutput(m_output);
+    }
+};
+
+// Median filter; removes sensor speckle while keeping edges.
+class DenoiseStage : public ProcessingStage
+{
+    int m_kernelSize;
+    Mat m_output;
+
+public:
+    DenoiseStage(int kernelSize) : m_kernelSize(kernelSize) {}
+
+    void Apply(StageContext & context) override
+    {
+        medianBlur(context.GetImage(), m_output, m_kernelSize);
+        context.SetOutput(m_output);
+    }
+};
+
+// Region of interest in normalized coordinates; a view, so nothing is copied.
+class CropStage : public ProcessingStage
+{
+    Rect2d m_rect;
+    Mat m_output;
+
+public:
+    CropStage(const Rect2d & rect) : m_rect(rect) {}
+
+    void Apply(StageContext & context) override
+    {
+        const Mat & image = context.GetImage();
+        Rect rect(cvRound(m_rect.x * image.cols), cvRound(m_rect.y * image.rows),
+                  cvRound(m_rect.width * image.cols), cvRound(m_rect.height * image.rows));
+        rect &= Rect(0, 0, image.cols, image.rows);
+        if (rect.empty())
+            return;
+
+        m_output = image(rect);
+        context.SetOutput(m_output);
+    }
+};
+
+class ScaleStage : public ProcessingStage
+{
+    double m_factor;
+    Mat m_output;
+
+public:
+    ScaleStage(double factor) : m_factor(factor) {}
+
+    void Apply(StageContext & context) override
+    {
+        resize(context.GetImage(), m_output, Size(), m_factor, m_factor, (m_factor < 1.0) ? INTER_AREA : INTER_LINEAR);
+        context.SetOutput(m_output);
+    }
+};
+
+// Marker: send only the regions that changed (plus periodic full reference frames) instead of the whole image.
+class RegionsStage : public ProcessingStage
+{
+public:
+    void Apply(StageContext &) override {}
+};
+
+
+static void RegisterBuiltinStages()
+{
+    ProcessingStage::Register("bgr", "bgr", ProcessingStage::SF_NONE,
+        [](const vector<double> & args) -> ProcessingStage * { return args.empty() ? new BgrStage() : nullptr; });
+    ProcessingStage::Register("gray", "gray", ProcessingStage::SF_NONE,
+        [](const vector<double> & args) -> ProcessingStage * { return args.empty() ? new GrayStage() : nullptr; });
+    ProcessingStage::Register("motion", "motion", ProcessingStage::SF_DETECTOR_IMAGE,
+        [](const vector<double> & args) -> ProcessingStage * { return args.empty() ? new MotionStage() : nullptr; });
+    ProcessingStage::Register("blur", "blur[:<odd kernel size>]", ProcessingStage::SF_NONE,
+        [](const vector<double> & args) -> ProcessingStage *
+        {
+            if (args.empty())
+                return new BlurStage(0);
+            int size = (int)args[0];
+            bool valid = ( (args.size() == 1) && (size == args[0]) && (size > 0) && (size % 2) );
+            return valid ? new BlurStage(size) : nullptr;
+        });
+    for (eBDBlurMethod method : {BLM_GAUSSIAN, BLM_BOX})
+    {
+        string name = (method == BLM_GAUSSIAN) ? "grayblur" : "graybox";
+        ProcessingStage::Register(name, name + "[:<odd kernel size, up to 99>]", ProcessingStage::SF_NONE,
+            [method](const vector<double> & args) -> ProcessingStage *
+            {
+                if (args.empty())
+                    return new GrayBlurStage(method, 0);
+                int size = (int)args[0];
+                bool valid = ( (args.size() == 1) && (size == args[0]) && (size > 0) && (size % 2) &&
+                               (size <= GrayBlur::c_maxKernelSize) );
+                return valid ? new GrayBlurStage(method, size) : nullptr;
+            });
+    }
+    ProcessingStage::Register("denoise", "denoise[:<3|5>]", ProcessingStage::SF_NONE,
+        [](const vector<double> & args) -> ProcessingStage *
+        {
+            if (args.empty())
+                return new DenoiseStage(3);
+            bool valid = ( (args.size() == 1) && ((args[0] == 3) || (args[0] == 5)) );
+            return valid ? new DenoiseStage((int)args[0]) : nullptr;
+        });
+    ProcessingStage::Register("crop", "crop:<x>,<y>,<width>,<height> (0..1)", ProcessingStage::SF_NONE,
+        [](const vector<double> & args) -> ProcessingStage *
+        {
+            if (args.size() != 4)
+                return nullptr;
+            for (double arg : args)
+            {
+                if ( (arg < 0.0) || (arg > 1.0) )
+                    return nullptr;
+            }
+            return new CropStage(Rect2d(args[0], args[1], args[2], args[3]));
+        });
+    ProcessingStage::Register("scale", "scale:<factor>", ProcessingStage::SF_NONE,
+        [](const vector<double> & args) -> ProcessingStage *
+        {
+            return ( (args.size() == 1) && (args[0] > 0.0) && (args[0] <= 4.0) ) ? new ScaleStage(args[0]) : nullptr;
+        });
+    ProcessingStage::Register("regions", "regions", ProcessingStage::SF_REGIONS,
+        [](const vector<double> & args) -> ProcessingStage * { return args.empty() ? new RegionsStage() : nullptr; });
+}
+
+
+vector<ProcessingStage::Registration> & ProcessingStage::GetRegistry()
+{
+    static vector<Registration> registry;
+    static bool initialized = false;
+    if (!initialized)
+    {
+        initialized = true;
+        RegisterBuiltinStages();
+    }
+    return registry;
+}
+
+void ProcessingStage::Register(const string & name, const string & usage, int flags, Factory factory)
+{
+    GetRegistry().push_back({name, usage, flags, factory});
+}
+
+void ProcessingStage::OutputRegistered()
+{
+    cout << endl << "Processing stages" << endl;
+    for (const auto & registration : GetRegistry())
+        cout << "  " << registration.usage << endl;
+}
+
+
+bool ProcessingChain::Parse(const string & spec, ProcessingChain & chain)
+{
+    ProcessingChain newChain;
+    newChain.m_spec = spec;
+
+    stringstream ss(spec);
+    string item;
+    while (ss >> item)
+    {
+        size_t pos = item.find(':');
+        string name = item.substr(0, pos);
+
+        vector<double> args;
+        if (pos != string::npos)
+        {
+            stringstream argStream(item.substr(pos + 1));
+            string arg;
+            while (getline(argStream, arg, ','))
+            {
+                char * pEnd;
+                double value = strtod(arg.c_str(), &pEnd);
+                if ( (pEnd == arg.c_str()) || (*pEnd != '\0') )
+                {
+                    cerr << "Error: Invalid argument '" << arg << "' for stage '" << name << "'." << endl;
+                    return false;
+                }
+                args.push_back(value);
+            }
+        }
+
+        const ProcessingStage::Registration * pRegistration = nullptr;
+        for (const auto & registration : ProcessingStage::GetRegistry())
+        {
+            if (registration.name == name)
+                pRegistration = &registration;
+        }
+        if (!pRegistration)
+        {
+            cerr << "Error: Unknown processing stage '" << name << "'." << endl;
+            return false;
+        }
+
+        Entry entry;
+        entry.spec = item;
+        entry.traceName = Tracer::Intern(item);
+        entry.pStage.reset(pRegistration->factory(args));
+        if (!entry.pStage)
+        {
+            cerr << "Error: Invalid arguments for stage '" << item << "'; usage: " << pRegistration->usage << endl;
+            return false;
+        }
+
+        newChain.m_flags |= pRegistration->flags;
+        newChain.m_entries.push_back(move(entry));
+    }
+
+    chain = move(newChain);
+    return true;
+}
+
+const Mat & ProcessingChain::Run(VideoFrame & frame, const Mat * pDetectorImage, int defaultKernelSize,
+                                 bool & stageOwned)
+{
+    StageContext context;
+    context.pFrame = &frame;
+    context.pDetectorImage = pDetectorImage;
+    context.defaultKernelSize = defaultKernelSize;
+
+    for (auto & entry : m_entries)
+    {
+        TraceSpan span(entry.traceName);
+        entry.pStage->Apply(context);
+        int us = span.End();
+
+        entry.currUs = us;
+        entry.totalUs += us;
+        entry.maxUs = max(entry.maxUs, us);
+        ++entry.runs;
+    }
+
+    // An empty chain (or one of markers only) sends the colour frame.
+    const Mat & image = context.GetImage();
+    stageOwned = context.stageOwned;
+    return image;
+}
+
+void ProcessingChain::OutputTimes() const
+{
+    for (const auto & entry : m_entries)
+    {
+        cout << "    " << entry.spec << ": curr=" << entry.currUs <<
+                ", avg=" << (entry.runs ? entry.totalUs / entry.runs : 0) <<
+                ", max=" << entry.maxUs << endl;
+    }
+}
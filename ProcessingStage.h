@@ -0,0 +1,102 @@
+#ifndef PROCESSINGSTAGE_H_
+#define PROCESSINGSTAGE_H_
+
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+#include <opencv2/opencv.hpp>
+
+
+class VideoFrame;
+
+
+// What a stage works on: the captured frame, the detector's view of it, and the image produced so far.
+struct StageContext
+{
+    VideoFrame * pFrame = nullptr;
+    const cv::Mat * pDetectorImage = nullptr;
+    const cv::Mat * pImage = nullptr; // Null until a stage produces an image.
+    bool stageOwned = false;          // pImage lives in a stage's buffer (or is a view of one).
+    int defaultKernelSize = 5;
+
+    // The current image, starting from the colour frame if no stage has produced one yet.
+    const cv::Mat & GetImage();
+    void SetOutput(const cv::Mat & output)
+    {
+        pImage = &output;
+        stageOwned = true;
+    }
+};
+
+
+// One step of a processing chain. Stages write into output buffers they own and keep across frames,
+// or just point the context at a view of their input, so a steady-state chain does not allocate.
+class ProcessingStage
+{
+public:
+    enum eBDStageFlags
+    {
+        SF_NONE = 0,
+        SF_DETECTOR_IMAGE = 1, // Reads the detector's image, which must be snapshot for the process stage.
+        SF_REGIONS = 2         // Frame is sent as changed regions rather than whole.
+    };
+
+    // Builds a stage from its arguments, or returns null if they are invalid.
+    using Factory = std::function<ProcessingStage * (const std::vector<double> & args)>;
+
+    virtual ~ProcessingStage() = default;
+    virtual void Apply(StageContext & context) = 0;
+
+    static void Register(const std::string & name, const std::string & usage, int flags, Factory factory);
+    static void OutputRegistered();
+
+private:
+    friend class ProcessingChain;
+
+    struct Registration
+    {
+        std::string name;
+        std::string usage;
+        int flags;
+        Factory factory;
+    };
+
+    static std::vector<Registration> & GetRegistry();
+};
+
+
+// Ordered list of stages built from a spec such as "gray blur:5 scale:0.5", each timed as it runs.
+class ProcessingChain
+{
+    struct Entry
+    {
+        std::string spec;
+        const char * traceName = ""; // The spec, interned, as traces outlive the chain.
+        std::unique_ptr<ProcessingStage> pStage;
+        int currUs = 0;
+        int maxUs = 0;
+        long long totalUs = 0;
+        long long runs = 0;
+    };
+
+    std::string m_spec;
+    std::vector<Entry> m_entries;
+    int m_flags = 0;
+
+public:
+    ProcessingChain() = default;
+
+    // Stages are separated by spaces; arguments follow a colon, separated by commas.
+    static bool Parse(const std::string & spec, ProcessingChain & chain);
+
+    const std::string & GetSpec() const { return m_spec; }
+    int GetFlags() const { return m_flags; }
+
+    // Run every stage and return the final image. If stageOwned is set, the image is in a stage's buffer and is only
+    // valid until the chain runs again.
+    const cv::Mat & Run(VideoFrame & frame, const cv::Mat * pDetectorImage, int defaultKernelSize, bool & stageOwned);
+    void OutputTimes() const;
+};
+
+#endif /* PROCESSINGSTAGE_H_ */
@@ -0,0 +1,194 @@
+
+#include <algorithm>
+#include <cstdlib>
+#include <iostream>
+#include <sstream>
+
+#include "RateController.h"
+
+
+using namespace std;
+
+
+// Quality goes first, then resolution, and frame rate last.
+const RateSettings RateController::c_levels[] =
+{
+    {0, 1.0, 0},
+    {1, 1.0, 0},
+    {2, 1.0, 0},
+    {2, 0.75, 0},
+    {3, 0.5, 0},
+    {3, 0.5, 1},
+    {3, 0.5, 2}
+};
+
+const int RateController::c_numLevels = sizeof(c_levels) / sizeof(c_levels[0]);
+
+
+bool RateConfig::Parse(const string & spec, RateConfig & config)
+{
+    RateConfig newConfig = config;
+
+    stringstream ss(spec);
+    string item;
+    while (getline(ss, item, ','))
+    {
+        size_t pos = item.find('=');
+        if (pos == string::npos)
+        {
+            cerr << "Error: Malformed rate option '" << item << "'." << endl;
+            return false;
+        }
+
+        string key = item.substr(0, pos);
+        string value = item.substr(pos + 1);
+
+        if (key == "adapt")
+        {
+            if ( (value != "on") && (value != "off") )
+            {
+                cerr << "Error: Invalid rate adapt '" << value << "'; expected on or off." << endl;
+                return false;
+            }
+            newConfig.adapt = (value == "on");
+            continue;
+        }
+
+        int * pField;
+        if (key == "fps")
+            pField = &newConfig.targetFps;
+        else if (key == "kbps")
+            pField = &newConfig.targetKbps;
+        else
+        {
+            cerr << "Error: Unknown rate option '" << key << "'." << endl;
+            return false;
+        }
+
+        if ( value.empty() || (value.find_first_not_of("0123456789") != string::npos) )
+        {
+            cerr << "Error: Invalid rate " << key << " '" << value << "'." << endl;
+            return false;
+        }
+        *pField = atoi(value.c_str());
+    }
+
+    config = newConfig;
+    return true;
+}
+
+string RateConfig::ToString() const
+{
+    stringstream ss;
+    ss << "adapt=" << (adapt ? "on" : "off") << ",fps=" << targetFps << ",kbps=" << targetKbps;
+    return ss.str();
+}
+
+
+void RateController::SetConfig(const RateConfig & config)
+{
+    lock_guard<mutex> lock(m_mutex);
+    m_config = config;
+    m_level = min(m_config.adapt ? m_level : 0, GetMaxLevel());
+    m_clearWindows = 0;
+}
+
+RateConfig RateController::GetConfig() const
+{
+    lock_guard<mutex> lock(m_mutex);
+    return m_config;
+}
+
+void RateController::Reset()
+{
+    lock_guard<mutex> lock(m_mutex);
+    m_level = 0;
+    m_clearWindows = 0;
+    m_windowStart = boost::posix_time::ptime();
+    m_stats = RateStats();
+}
+
+void RateController::OnSent(size_t bytes)
+{
+    lock_guard<mutex> lock(m_mutex);
+    ++m_windowFrames;
+    m_windowBytes += bytes;
+}
+
+void RateController::Update(const FrameQueueStats & queueStats)
+{
+    lock_guard<mutex> lock(m_mutex);
+
+    boost::posix_time::ptime now = boost::posix_time::microsec_clock::universal_time();
+    if (m_windowStart.is_not_a_date_time())
+    {
+        m_windowStart = now;
+        m_windowFrames = m_windowBytes = 0;
+        m_queueDropped = queueStats.dropped;
+        return;
+    }
+
+    long long windowMs = (now - m_windowStart).total_milliseconds();
+    if (windowMs < c_windowMs)
+        return;
+
+    double seconds = windowMs / 1000.0;
+    long long drops = queueStats.dropped - m_queueDropped;
+    m_stats.fps = m_windowFrames / seconds;
+    m_stats.kbps = m_windowBytes * 8 / 1000.0 / seconds;
+    m_stats.dropsPerSecond = drops / seconds;
+    bool idle = ( (m_windowFrames == 0) && (drops == 0) );
+
+    m_windowStart = now;
+    m_windowFrames = m_windowBytes = 0;
+    m_queueDropped = queueStats.dropped;
+
+    // Without motion nothing is sent, which says nothing about the link.
+    if ( !m_config.adapt || idle )
+        return;
+
+    // Below the target frame rate only counts while frames are waiting; otherwise there was just less to send.
+    bool congested = ( (drops > 0) ||
+                       (m_config.targetKbps && (m_stats.kbps > m_config.targetKbps)) ||
+                       (m_config.targetFps && (m_stats.fps < 0.9 * m_config.targetFps) && (queueStats.frames > 0)) );
+    bool clear = ( (queueStats.frames <= 1) && (!m_config.targetKbps || (m_stats.kbps < 0.7 * m_config.targetKbps)) );
+
+    if (congested)
+    {
+        m_level = min(m_level + 1, GetMaxLevel());
+        m_clearWindows = 0;
+    }
+    else if ( clear && (m_level > 0) && (++m_clearWindows >= c_recoverWindows) )
+    {
+        --m_level;
+        m_clearWindows = 0;
+    }
+    else if (!clear)
+        m_clearWindows = 0;
+}
+
+RateSettings RateController::GetSettings() const
+{
+    lock_guard<mutex> lock(m_mutex);
+    return c_levels[m_level];
+}
+
+RateStats RateController::GetStats() const
+{
+    lock_guard<mutex> lock(m_mutex);
+    RateStats stats = m_stats;
+    stats.level = m_level;
+    return stats;
+}
+
+int RateController::GetMaxLevel() const
+{
+    // A frame rate target rules out the levels that skip frames.
+    int maxLevel = c_numLevels - 1;
+    if (m_config.targetFps)
+    {
+        while ( (maxLevel > 0) && c_levels[maxLevel].skip )
+            --maxLevel;
+    }
+    return maxLevel;
+}
@@ -0,0 +1,82 @@
+#ifndef RATECONTROLLER_H_
+#define RATECONTROLLER_H_
+
+#include <mutex>
+#include <string>
+#include <boost/date_time/posix_time/posix_time.hpp>
+
+#include "FrameQueue.h"
+
+
+struct RateConfig
+{
+    bool adapt = false; // Otherwise the stream always goes at full quality.
+    int targetFps = 0;  // Frame rate to hold by lowering quality rather than skipping frames; 0 for none.
+    int targetKbps = 0; // Bit rate not to exceed; 0 for none.
+
+    // Parse e.g. "adapt=on,fps=10,kbps=2000", updating only the keys given.
+    static bool Parse(const std::string & spec, RateConfig & config);
+    std::string ToString() const;
+};
+
+
+// How much the stream is degraded at a level.
+struct RateSettings
+{
+    int codecStep = 0;   // Passed to FrameCodec::CreateReduced; 0 for the configured codec.
+    double scale = 1.0;  // Applied to whole frames before encoding.
+    int skip = 0;        // Frames skipped after each one sent.
+};
+
+
+struct RateStats
+{
+    int level = 0;
+    double fps = 0.0;  // Measured over the last window.
+    double kbps = 0.0;
+    double dropsPerSecond = 0.0;
+};
+
+
+// Adapts one camera's stream to what the link to the client actually carries.
+// The send thread reports each frame handed to the socket manager; once per window the controller compares the
+// throughput, the frames the queue had to drop and the targets, then steps one level down a ladder of quality, scale
+// and frame skip settings if the link is congested, or back up after a few clear windows.
+class RateController
+{
+    static constexpr int c_windowMs = 1000;
+    static constexpr int c_recoverWindows = 3; // Clear windows in a row before a step back up.
+    static const RateSettings c_levels[];
+    static const int c_numLevels;
+
+    mutable std::mutex m_mutex;
+    RateConfig m_config;
+    int m_level = 0;
+    int m_clearWindows = 0;
+    boost::posix_time::ptime m_windowStart;
+    long long m_windowFrames = 0;
+    long long m_windowBytes = 0;
+    long long m_queueDropped = 0; // Queue drop count at the start of the window.
+    RateStats m_stats;
+
+public:
+    RateController(const RateConfig & config) : m_config(config) {}
+
+    void SetConfig(const RateConfig & config);
+    RateConfig GetConfig() const;
+
+    // Start over at full quality, e.g. for a new client.
+    void Reset();
+    void OnSent(size_t bytes);
+    // Called by the send thread before each frame it waits for; acts once a window has passed.
+    void Update(const FrameQueueStats & queueStats);
+
+    RateSettings GetSettings() const;
+    RateStats GetStats() const;
+    static int GetNumLevels() { return c_numLevels; }
+
+private:
+    int GetMaxLevel() const;
+};
+
+#endif /* RATECONTROLLER_H_ */
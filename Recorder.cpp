@@ -0,0 +1,398 @@
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <unistd.h>
+#include <boost/date_time/c_local_time_adjustor.hpp>
+
+#include "Recorder.h"
+#include "Tracer.h"
+
+
+using namespace std;
+
+
+bool RecordingConfig::Parse(const string & spec, RecordingConfig & config)
+{
+    RecordingConfig newConfig = config;
+
+    stringstream ss(spec);
+    string item;
+    while (getline(ss, item, ','))
+    {
+        size_t pos = item.find('=');
+        if (pos == string::npos)
+        {
+            cerr << "Error: Malformed recording option '" << item << "'." << endl;
+            return false;
+        }
+
+        string key = item.substr(0, pos);
+        string value = item.substr(pos + 1);
+
+        if (key == "dir")
+        {
+            newConfig.dir = value;
+            continue;
+        }
+
+        int * pField;
+        int minValue = 1;
+        if (key == "preroll")
+        {
+            pField = &newConfig.preRollSeconds;
+            minValue = 0;
+        }
+        else if (key == "kb")
+            pField = &newConfig.preRollKB;
+        else if (key == "fps")
+            pField = &newConfig.preRollFps;
+        else if (key == "segment")
+            pField = &newConfig.segmentSeconds;
+        else
+        {
+            cerr << "Error: Unknown recording option '" << key << "'." << endl;
+            return false;
+        }
+
+        int n = atoi(value.c_str());
+        if ( (n < minValue) || value.empty() || (value.find_first_not_of("0123456789") != string::npos) )
+        {
+            cerr << "Error: Invalid recording " << key << " '" << value << "'." << endl;
+            return false;
+        }
+        *pField = n;
+    }
+
+    config = newConfig;
+    return true;
+}
+
+string RecordingConfig::ToString() const
+{
+    stringstream ss;
+    ss << "dir=" << (dir.empty() ? "(off)" : dir) << ",preroll=" << preRollSeconds << ",kb=" << preRollKB <<
+          ",fps=" << preRollFps << ",segment=" << segmentSeconds;
+    return ss.str();
+}
+
+
+Recorder::Recorder(int streamId, const RecordingConfig & config) :
+    m_streamId(streamId),
+    m_config(config)
+{
+    // Block-aligned staging buffer, so the file is written in whole, aligned blocks.
+    void * pBuffer = nullptr;
+    if (posix_memalign(&pBuffer, c_writeAlignment, c_writeBlockSize) == 0)
+        m_pWriteBuffer = (unsigned char *)pBuffer;
+}
+
+Recorder::~Recorder()
+{
+    if (m_writerThread.joinable())
+        m_writerThread.join();
+    free(m_pWriteBuffer);
+}
+
+void Recorder::Start()
+{
+    m_writerThread = boost::thread(&Recorder::WriterFunc, this);
+}
+
+void Recorder::Terminate()
+{
+    m_writerThread.interrupt();
+}
+
+void Recorder::SetConfig(const RecordingConfig & config)
+{
+    boost::mutex::scoped_lock lock(m_configMutex);
+    m_config = config;
+}
+
+RecordingConfig Recorder::GetConfig() const
+{
+    boost::mutex::scoped_lock lock(m_configMutex);
+    return m_config;
+}
+
+bool Recorder::IsEnabled() const
+{
+    boost::mutex::scoped_lock lock(m_configMutex);
+    return !m_config.dir.empty();
+}
+
+void Recorder::Add(eBDFrameType type, eBDCodec codec, boost::posix_time::ptime timestamp,
+                   shared_ptr<const vector<unsigned char>> pBuf, bool inEvent)
+{
+    Record record;
+    record.type = type;
+    record.codec = codec;
+    record.timestamp = timestamp;
+    record.pBuf = move(pBuf);
+
+    if (inEvent)
+    {
+        // The pre-roll becomes the start of the clip.
+        if (!m_inClip)
+        {
+            m_inClip = true;
+            ++m_clip;
+            for (auto & preRollRecord : m_preRoll)
+            {
+                preRollRecord.clip = m_clip;
+                Enqueue(move(preRollRecord));
+            }
+            m_preRoll.clear();
+            m_preRollBytes = 0;
+        }
+
+        record.clip = m_clip;
+        Enqueue(move(record));
+    }
+    else
+    {
+        if (m_inClip)
+        {
+            m_inClip = false;
+            Record endRecord;
+            endRecord.clip = m_clip;
+            endRecord.endOfClip = true;
+            Enqueue(move(endRecord));
+        }
+
+        m_preRollBytes += record.pBuf->size();
+        m_preRoll.push_back(move(record));
+        TrimPreRoll(timestamp);
+    }
+
+    boost::mutex::scoped_lock lock(m_mutex);
+    m_stats.preRollFrames = m_preRoll.size();
+    m_stats.preRollBytes = m_preRollBytes;
+}
+
+RecorderStats Recorder::GetStats() const
+{
+    boost::mutex::scoped_lock lock(m_mutex);
+    RecorderStats stats = m_stats;
+    stats.backlogBytes = m_backlogBytes;
+    return stats;
+}
+
+void Recorder::TrimPreRoll(boost::posix_time::ptime now)
+{
+    RecordingConfig config = GetConfig();
+    size_t maxBytes = (size_t)config.preRollKB * 1024;
+    boost::posix_time::time_duration maxAge = boost::posix_time::seconds(config.preRollSeconds);
+
+    while ( !m_preRoll.empty() &&
+            ((m_preRollBytes > maxBytes) || (now - m_preRoll.front().timestamp > maxAge) ||
+             (m_preRoll.front().type != FRT_FULL)) )
+    {
+        m_preRollBytes -= m_preRoll.front().pBuf->size();
+        m_preRoll.pop_front();
+    }
+}
+
+void Recorder::Enqueue(Record record)
+{
+    {
+        boost::mutex::scoped_lock lock(m_mutex);
+        size_t size = (record.pBuf ? record.pBuf->size() : 0);
+        if (m_backlogBytes + size > c_maxBacklogBytes)
+        {
+            ++m_stats.droppedFrames;
+            return;
+        }
+
+        m_backlogBytes += size;
+        m_backlog.push_back(move(record));
+    }
+    m_notEmpty.notify_one();
+}
+
+void Recorder::WriterFunc()
+{
+    Tracer::SetThreadName("camera " + to_string(m_streamId) + " recorder");
+
+    try
+    {
+        while (true)
+        {
+            Record record;
+            {
+                boost::mutex::scoped_lock lock(m_mutex);
+                while (m_backlog.empty())
+                    m_notEmpty.wait(lock);
+
+                record = move(m_backlog.front());
+                m_backlog.pop_front();
+                m_backlogBytes -= (record.pBuf ? record.pBuf->size() : 0);
+            }
+
+            TraceSpan span("WriteRecord");
+            WriteRecord(record);
+        }
+    }
+    catch (boost::thread_interrupted&)
+    {
+    }
+
+    // Finish what was queued before shutdown, so clips are not cut short.
+    while (true)
+    {
+        Record record;
+        {
+            boost::mutex::scoped_lock lock(m_mutex);
+            if (m_backlog.empty())
+                break;
+
+            record = move(m_backlog.front());
+            m_backlog.pop_front();
+            m_backlogBytes -= (record.pBuf ? record.pBuf->size() : 0);
+        }
+
+        WriteRecord(record);
+    }
+
+    CloseSegment();
+}
+
+void Recorder::WriteRecord(const Record & record)
+{
+    if (record.endOfClip)
+    {
+        if (record.clip == m_fileClip)
+            CloseSegment();
+        return;
+    }
+
+    RecordingConfig config = GetConfig();
+    if (record.clip != m_fileClip)
+    {
+        CloseSegment();
+        m_fileClip = record.clip;
+        m_segment = 0;
+        m_clipFailed = false;
+
+        // Named after the local time of the clip's first frame.
+        string time = boost::posix_time::to_iso_string(
+            boost::date_time::c_local_adjustor<boost::posix_time::ptime>::utc_to_local(record.timestamp));
+        m_clipName = "cam" + to_string(m_streamId) + "-" + time.substr(0, time.find('.'));
+    }
+    else if ( (m_fd >= 0) && (record.type == FRT_FULL) &&
+              (record.timestamp - m_segmentStart >= boost::posix_time::seconds(config.segmentSeconds)) )
+    {
+        CloseSegment();
+        ++m_segment;
+    }
+
+    // Segments start with a full frame, since region frames only make sense pasted over one.
+    if ( (m_fd < 0) && (m_clipFailed || (record.type != FRT_FULL) || !OpenSegment(record, config.dir)) )
+        return;
+
+    RecordHeader header = {};
+    header.magic = c_recordMagic;
+    header.streamId = (uint8_t)m_streamId;
+    header.frameType = (uint8_t)record.type;
+    header.codec = (uint8_t)record.codec;
+    header.timestampUs = (record.timestamp - boost::posix_time::ptime(boost::gregorian::date(1970, 1, 1)))
+                             .total_microseconds();
+    header.length = (uint32_t)record.pBuf->size();
+
+    if ( !Write(&header, sizeof(header)) || !Write(record.pBuf->data(), record.pBuf->size()) )
+    {
+        CloseSegment();
+        m_clipFailed = true;
+    }
+}
+
+bool Recorder::OpenSegment(const Record & record, const string & dir)
+{
+    if ( dir.empty() || !m_pWriteBuffer )
+        return false;
+
+    stringstream path;
+    path << dir << "/" << m_clipName << "-" << setw(3) << setfill('0') << m_segment << ".pir";
+    m_fd = open(path.str().c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (m_fd < 0)
+    {
+        cerr << "Error: Cannot open recording file '" << path.str() << "': " << strerror(errno) << endl;
+        m_clipFailed = true;
+
+        boost::mutex::scoped_lock lock(m_mutex);
+        ++m_stats.writeErrors;
+        return false;
+    }
+
+    cout << "Camera " << m_streamId << ": recording to " << path.str() << endl;
+    m_segmentStart = record.timestamp;
+    m_writeBufferUsed = 0;
+
+    boost::mutex::scoped_lock lock(m_mutex);
+    ++m_stats.segments;
+    if (m_segment == 0)
+        ++m_stats.clips;
+    return true;
+}
+
+void Recorder::CloseSegment()
+{
+    if (m_fd < 0)
+        return;
+
+    FlushWriteBuffer();
+    close(m_fd);
+    m_fd = -1;
+}
+
+bool Recorder::Write(const void * pData, size_t size)
+{
+    // Stage into the aligned buffer and write it out a whole block at a time.
+    const unsigned char * pSrc = (const unsigned char *)pData;
+    while (size)
+    {
+        size_t n = min(size, c_writeBlockSize - m_writeBufferUsed);
+        memcpy(m_pWriteBuffer + m_writeBufferUsed, pSrc, n);
+        m_writeBufferUsed += n;
+        pSrc += n;
+        size -= n;
+
+        if ( (m_writeBufferUsed == c_writeBlockSize) && !FlushWriteBuffer() )
+            return false;
+    }
+    return true;
+}
+
+bool Recorder::FlushWriteBuffer()
+{
+    size_t written = 0;
+    while (written < m_writeBufferUsed)
+    {
+        ssize_t n = write(m_fd, m_pWriteBuffer + written, m_writeBufferUsed - written);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+
+            cerr << "Error: Recording write failed: " << strerror(errno) << endl;
+            m_writeBufferUsed = 0;
+
+            boost::mutex::scoped_lock lock(m_mutex);
+            ++m_stats.writeErrors;
+            return false;
+        }
+        written += n;
+    }
+
+    m_writeBufferUsed = 0;
+
+    boost::mutex::scoped_lock lock(m_mutex);
+    m_stats.writtenBytes += written;
+    return true;
+}
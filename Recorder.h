@@ -0,0 +1,142 @@
+#ifndef RECORDER_H_
+#define RECORDER_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <string>
+#include <vector>
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <boost/thread.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+
+#include "SocketMgr.h"
+
+
+struct RecordingConfig
+{
+    std::string dir;         // Recording is off while empty.
+    int preRollSeconds = 3;  // Footage kept from before an event starts.
+    int preRollKB = 8192;    // Memory budget for the pre-roll ring.
+    int preRollFps = 5;      // Frames per second encoded for the pre-roll while there is no event.
+    int segmentSeconds = 60; // Clips are split into files of about this length.
+
+    // Parse e.g. "dir=/mnt/clips,preroll=5,kb=4096,fps=5,segment=30", updating only the keys given.
+    static bool Parse(const std::string & spec, RecordingConfig & config);
+    std::string ToString() const;
+};
+
+
+struct RecorderStats
+{
+    size_t preRollFrames = 0;
+    size_t preRollBytes = 0;
+    size_t backlogBytes = 0;
+    int clips = 0;
+    int segments = 0;
+    long long writtenBytes = 0;
+    long long droppedFrames = 0; // Lost because the writer fell too far behind.
+    int writeErrors = 0;
+};
+
+
+// Motion-triggered recording for one camera.
+// Encoded frames from outside an event go into a pre-roll ring bounded by age and size. When an event frame
+// arrives, the ring and then the event's frames are queued for a writer thread, which appends them to segment
+// files in large block-aligned writes. Add never touches the disk and never waits on the writer: if the writer's
+// backlog exceeds its budget, frames are dropped instead.
+//
+// File format: a sequence of records, each a RecordHeader followed by the encoded frame. Region frames paste over
+// the last full frame; every segment starts with a full frame.
+class Recorder
+{
+public:
+    struct RecordHeader
+    {
+        uint32_t magic;       // c_recordMagic.
+        uint8_t streamId;
+        uint8_t frameType;    // eBDFrameType.
+        uint8_t codec;        // eBDCodec.
+        uint8_t reserved;
+        int64_t timestampUs;  // Capture time, microseconds since the Unix epoch (UTC).
+        uint32_t length;      // Bytes of encoded frame that follow.
+        uint32_t reserved2;
+    };
+
+    static constexpr uint32_t c_recordMagic = 0x31524950; // "PIR1"
+
+private:
+    static constexpr size_t c_writeBlockSize = 1 << 20;   // Bytes per write() call.
+    static constexpr size_t c_writeAlignment = 4096;
+    static constexpr size_t c_maxBacklogBytes = 16 << 20; // Writer backlog before frames are dropped.
+
+    struct Record
+    {
+        int clip = 0;
+        bool endOfClip = false;
+        eBDFrameType type = FRT_FULL;
+        eBDCodec codec = CDC_PNG;
+        boost::posix_time::ptime timestamp;
+        std::shared_ptr<const std::vector<unsigned char>> pBuf;
+    };
+
+    int m_streamId;
+
+    // Producer side, touched only by the encode thread.
+    mutable boost::mutex m_configMutex;
+    RecordingConfig m_config;
+    std::deque<Record> m_preRoll;
+    size_t m_preRollBytes = 0;
+    int m_clip = 0;
+    bool m_inClip = false;
+
+    // Shared with the writer thread.
+    mutable boost::mutex m_mutex;
+    boost::condition_variable m_notEmpty;
+    std::deque<Record> m_backlog;
+    size_t m_backlogBytes = 0;
+    RecorderStats m_stats;
+    boost::thread m_writerThread;
+
+    // Writer side.
+    int m_fd = -1;
+    int m_fileClip = 0;
+    int m_segment = 0;
+    bool m_clipFailed = false;
+    std::string m_clipName;
+    boost::posix_time::ptime m_segmentStart;
+    unsigned char * m_pWriteBuffer = nullptr;
+    size_t m_writeBufferUsed = 0;
+
+public:
+    Recorder(int streamId, const RecordingConfig & config);
+    ~Recorder();
+
+    void Start();
+    void Terminate();
+
+    void SetConfig(const RecordingConfig & config);
+    RecordingConfig GetConfig() const;
+    bool IsEnabled() const;
+
+    // Called with every encoded frame. Event frames open a clip (preceded by the pre-roll), and the first frame
+    // after the event closes it.
+    void Add(eBDFrameType type, eBDCodec codec, boost::posix_time::ptime timestamp,
+             std::shared_ptr<const std::vector<unsigned char>> pBuf, bool inEvent);
+
+    RecorderStats GetStats() const;
+
+private:
+    void TrimPreRoll(boost::posix_time::ptime now);
+    void Enqueue(Record record);
+    void WriterFunc();
+    void WriteRecord(const Record & record);
+    bool OpenSegment(const Record & record, const std::string & dir);
+    void CloseSegment();
+    bool Write(const void * pData, size_t size);
+    bool FlushWriteBuffer();
+};
+
+#endif /* RECORDER_H_ */
@@ -1,3 +1,4 @@
+#include <cstring>
 #include <iostream>
 #include <sys/socket.h>
 #include <arpa/inet.h>
@@ -79,13 +80,16 @@ bool Socket::AcceptConnection()
     return true;
 }
 
-bool Socket::TransmitSizedMessage(unsigned char * pRawData, int size)
+bool Socket::TransmitSizedMessage(const void * pHeader, int headerSize, const unsigned char * pRawData, int size)
 {
-    if (!IsConnected())
+    if ( !IsConnected() || (headerSize > c_maxHeaderSize) )
         return false;
 
-    // Send length of frame to client.
-    if (send(m_connfd, &size, sizeof(size), MSG_NOSIGNAL) < 0)
+    // Send length of frame followed by its header to client in a single segment.
+    unsigned char prefix[sizeof(size) + c_maxHeaderSize];
+    memcpy(prefix, &size, sizeof(size));
+    memcpy(prefix + sizeof(size), pHeader, headerSize);
+    if (send(m_connfd, prefix, sizeof(size) + headerSize, MSG_NOSIGNAL) < 0)
     {
         cout << "Remote client disconnected." << endl;
         return false;
@@ -10,6 +10,7 @@ class SocketMgr;
 class Socket
 {
     static constexpr int c_recvBufferSize = 100;
+    static constexpr int c_maxHeaderSize = 32;
 
     SocketMgr * m_pSocketMgr;
     int m_port;
@@ -28,7 +29,8 @@ public:
 
     bool EstablishListener();
     bool AcceptConnection();
-    bool TransmitSizedMessage(unsigned char * pRawData, int size);
+    // Message on the wire: int32 payload size, header bytes, payload.
+    bool TransmitSizedMessage(const void * pHeader, int headerSize, const unsigned char * pRawData, int size);
     char * ReceiveCommand();
     bool Shutdown();
     void Close();
@@ -9,14 +9,17 @@
 
 #include "SocketMgr.h"
 #include "PiMgr.h"
-#include "Profiling.h"
+#include "Tracer.h"
 
 
 using namespace std;
 
 
-SocketMgr::SocketMgr(PiMgr * owner) :
-    m_owner(owner)
+SocketMgr::SocketMgr(PiMgr * owner, int numStreams) :
+    m_owner(owner),
+    m_pendingBuffers(numStreams),
+    m_pendingTypes(numStreams, FRT_FULL),
+    m_pendingCodecs(numStreams, CDC_PNG)
 {
 }
 
@@ -75,21 +78,27 @@ void SocketMgr::Close()
     cout << "Command socket released..." << endl;
 }
 
-void SocketMgr::SendFrame(unique_ptr<vector<unsigned char> > pBuf)
+void SocketMgr::WaitStreamIdle(int streamId)
 {
     boost::mutex::scoped_lock lock(m_monitorMutex);
-    if (!m_pCurrBuffer)
-        m_pCurrBuffer = move(pBuf);
-    else
-    {
-        ++m_droppedFrames;
+    while ( !m_authorized || m_pendingBuffers[streamId] )
+        m_streamIdle.wait(lock);
+}
 
-        cout << "DEBUG: Dropped frames=" << m_droppedFrames << endl;
-    }
+void SocketMgr::SendFrame(int streamId, eBDFrameType frameType, eBDCodec codec,
+                          shared_ptr<const vector<unsigned char> > pBuf)
+{
+    boost::mutex::scoped_lock lock(m_monitorMutex);
+    m_pendingBuffers[streamId] = move(pBuf);
+    m_pendingTypes[streamId] = frameType;
+    m_pendingCodecs[streamId] = codec;
+    m_framePending.notify_one();
 }
 
 void SocketMgr::ClientConnectionWorker()
 {
+    Tracer::SetThreadName("monitor socket");
+
     // Handle client connections.
     // Exit only in response to an error condition or interruption (user cancellation request).
     bool done = false;
@@ -135,12 +144,46 @@ void SocketMgr::ClientConnectionWorker()
             continue;
         }
 
-        // Transmit frames to client for monitoring as they become available.
+        // Wake the send threads for the new client. Taking the lock first means none can be between checking
+        // m_authorized and waiting.
+        ++m_connectionId;
+        {
+            boost::mutex::scoped_lock lock(m_monitorMutex);
+        }
+        m_streamIdle.notify_all();
+
+        // Transmit frames to client for monitoring as soon as they are handed over. Taking a frame frees its stream's
+        // slot, so the send thread can hand over the next one (e.g. the next band) while this one is on the wire.
         while (true)
         {
+            shared_ptr<const vector<unsigned char> > pBuf;
+            FrameHeader header = {};
+
             try
             {
-                boost::this_thread::sleep(boost::posix_time::milliseconds(5));
+                boost::this_thread::interruption_point();
+
+                // Take the next pending frame, starting after the stream served last.
+                boost::mutex::scoped_lock lock(m_monitorMutex);
+                while (!pBuf)
+                {
+                    int numStreams = (int)m_pendingBuffers.size();
+                    for (int i = 0; i < numStreams; ++i)
+                    {
+                        int streamId = (m_nextStream + i) % numStreams;
+                        if (m_pendingBuffers[streamId])
+                        {
+                            pBuf = move(m_pendingBuffers[streamId]);
+                            header.streamId = (uint8_t)streamId;
+                            header.frameType = (uint8_t)m_pendingTypes[streamId];
+                            header.codec = (uint8_t)m_pendingCodecs[streamId];
+                            m_nextStream = (streamId + 1) % numStreams;
+                            break;
+                        }
+                    }
+                    if (!pBuf)
+                        m_framePending.wait(lock);
+                }
             }
             catch (boost::thread_interrupted&)
             {
@@ -149,24 +192,12 @@ void SocketMgr::ClientConnectionWorker()
                 done = true;
                 break;
             }
-
-            unique_ptr<vector<unsigned char> > pBuf;
-
-            {
-                boost::mutex::scoped_lock lock(m_monitorMutex);
-                if (!m_pCurrBuffer)
-                    continue;
-                else
-                    pBuf = move(m_pCurrBuffer);
-            }
-
-            PROFILE_START;
+            m_streamIdle.notify_all();
 
             // Delegate to the monitor socket.
-            if (!m_pSocketMon->TransmitSizedMessage(&(*pBuf)[0], pBuf->size()))
+            TraceSpan span("Transmit");
+            if (!m_pSocketMon->TransmitSizedMessage(&header, sizeof(header), &(*pBuf)[0], pBuf->size()))
                 break;
-
-            PROFILE_LOG(MSGOUT);
         }
 
         // Clean up connection.
@@ -181,7 +212,11 @@ void SocketMgr::ClientConnectionWorker()
 bool SocketMgr::WaitForConnection()
 {
     m_authorized = m_badauth = false;
-    m_droppedFrames = 0;
+    {
+        boost::mutex::scoped_lock lock(m_monitorMutex);
+        for (auto & pBuf : m_pendingBuffers)
+            pBuf.reset();
+    }
 
     // Start worker threads to accept a connection for each socket.
     if (!m_pSocketMon->AcceptConnection())
@@ -280,7 +315,11 @@ void SocketMgr::ReadCommandsWorker()
             else if (strcmp(recvBuffer, "config") == 0)
                 m_owner->OutputConfig();
             else if (strcmp(recvBuffer, "mode") == 0)
-                m_owner->UpdateIPM();
+                m_owner->CycleChainPreset();
+            else if (strncmp(recvBuffer, "chain ", 6) == 0)
+                m_owner->UpdateProcessingChain(recvBuffer + 6);
+            else if (strcmp(recvBuffer, "stages") == 0)
+                m_owner->OutputStages();
             else if (strcmp(recvBuffer, "page") == 0)
                 m_owner->UpdatePage();
             else if (strcmp(recvBuffer, "param1 up") == 0)
@@ -293,6 +332,30 @@ void SocketMgr::ReadCommandsWorker()
                 m_owner->UpdateParam(2, false);
             else if (strcmp(recvBuffer, "debugmode") == 0)
                 m_owner->ToggleDebugMode();
+            else if (strncmp(recvBuffer, "camera ", 7) == 0)
+                m_owner->SelectCamera(atoi(recvBuffer + 7));
+            else if (strcmp(recvBuffer, "caps") == 0)
+                m_owner->OutputCaptureModes();
+            else if (strncmp(recvBuffer, "capture ", 8) == 0)
+                m_owner->UpdateCaptureConfig(recvBuffer + 8);
+            else if (strcmp(recvBuffer, "zones") == 0)
+                m_owner->OutputZones();
+            else if (strcmp(recvBuffer, "zone clear") == 0)
+                m_owner->ClearZones();
+            else if (strncmp(recvBuffer, "zone ", 5) == 0)
+                m_owner->AddZone(recvBuffer + 5);
+            else if (strncmp(recvBuffer, "event ", 6) == 0)
+                m_owner->UpdateEventConfig(recvBuffer + 6);
+            else if (strncmp(recvBuffer, "queue ", 6) == 0)
+                m_owner->UpdateFrameQueueConfig(recvBuffer + 6);
+            else if (strncmp(recvBuffer, "record ", 7) == 0)
+                m_owner->UpdateRecordingConfig(recvBuffer + 7);
+            else if (strncmp(recvBuffer, "codec ", 6) == 0)
+                m_owner->UpdateCodec(recvBuffer + 6);
+            else if (strncmp(recvBuffer, "rate ", 5) == 0)
+                m_owner->UpdateRateConfig(recvBuffer + 5);
+            else if (strncmp(recvBuffer, "trace ", 6) == 0)
+                m_owner->UpdateTracing(recvBuffer + 6);
         }
     }
 
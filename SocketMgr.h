@@ -1,6 +1,8 @@
 #ifndef SOCKETMGR_H_
 #define SOCKETMGR_H_
 
+#include <atomic>
+#include <cstdint>
 #include <memory>
 #include <string>
 #include <vector>
@@ -10,6 +12,46 @@
 
 class PiMgr;
 
+enum eBDFrameType
+{
+    FRT_FULL,    // Whole image as length-prefixed encoded stripes, top to bottom.
+    FRT_REGIONS, // Changed regions only: per region int16 x, int16 y, then a length-prefixed encoded image.
+    FRT_DELTA,   // Inter-frame codec picture; decodes only after every frame since the last full frame.
+    FRT_BAND,    // One band of a whole image, sent as soon as it is encoded: BandHeader, then the encoded image.
+    FRT_MAX
+};
+
+// Encoding of each stripe or region image in a frame.
+enum eBDCodec
+{
+    CDC_PNG,
+    CDC_JPEG,
+    CDC_QOI, // qoiformat.org, always 3 channels.
+    CDC_LZ4, // uint16 width, uint16 height, then an LZ4 block of raw gray pixels.
+    CDC_H264, // Whole frame as Annex B NAL units; keyframes carry SPS/PPS.
+    CDC_MAX
+};
+
+// Prefix sent on the monitor socket after each message length, identifying the frame that follows.
+struct FrameHeader
+{
+    uint8_t streamId; // Index of the camera that produced the frame.
+    uint8_t frameType; // eBDFrameType; region frames are pasted over the last full (or banded) frame of the stream.
+    uint8_t codec; // eBDCodec.
+    uint8_t reserved;
+};
+
+// Start of each band frame. Bands can be drawn as they arrive; those of one image share frameSeq, but may arrive out
+// of order, and some may be missing if the queue dropped them.
+struct BandHeader
+{
+    uint32_t frameSeq; // Counts images per stream.
+    uint16_t band;     // 0 is the top band.
+    uint16_t numBands;
+    uint16_t top;      // First image row of the band.
+    uint16_t reserved;
+};
+
 class SocketMgr
 {
     friend class Socket;
@@ -25,26 +67,37 @@ class SocketMgr
 
     boost::mutex m_acceptMutex;
     boost::condition_variable m_condition;
-    boost::mutex m_monitorMutex;
+    mutable boost::mutex m_monitorMutex;
+    boost::condition_variable m_streamIdle; // A client was authorized or a pending frame was taken.
+    boost::condition_variable m_framePending; // A stream was given a frame to transmit.
 
     bool m_authorized = false;
     bool m_badauth = false;
+    std::atomic<int> m_connectionId{0}; // Incremented for each authorized client.
 
     boost::thread m_clientConnThread;
     boost::thread m_commandThread;
 
-    std::unique_ptr<std::vector<unsigned char> > m_pCurrBuffer;
-    int m_droppedFrames = 0;
+    // One pending frame per stream, transmitted round-robin so no camera can starve the others.
+    std::vector<std::shared_ptr<const std::vector<unsigned char> > > m_pendingBuffers;
+    std::vector<eBDFrameType> m_pendingTypes;
+    std::vector<eBDCodec> m_pendingCodecs;
+    int m_nextStream = 0;
 
 public:
-    SocketMgr(PiMgr * owner);
+    SocketMgr(PiMgr * owner, int numStreams);
     ~SocketMgr();
 
     bool Initialize();
     void Close();
 
     bool IsReady() const { return m_authorized; }
-    void SendFrame(std::unique_ptr<std::vector<unsigned char> > pBuf);
+    int GetConnectionId() const { return m_connectionId; }
+    // Blocks until a client is authorized and the stream has no pending frame; interruptible.
+    void WaitStreamIdle(int streamId);
+    // Only after WaitStreamIdle: each stream has a single pending frame, filled by its camera's send thread.
+    void SendFrame(int streamId, eBDFrameType frameType, eBDCodec codec,
+                   std::shared_ptr<const std::vector<unsigned char> > pBuf);
 
 private:
     void ClientConnectionWorker();
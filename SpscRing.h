@@ -0,0 +1,82 @@
+#ifndef SPSCRING_H_
+#define SPSCRING_H_
+
+#include <atomic>
+#include <cstddef>
+#include <type_traits>
+
+
+// Bounded lock-free ring for exactly one producer thread and one consumer thread.
+// Head and tail are free-running counters on separate cache lines; slot = counter % N.
+// The producer may also evict the oldest element when full (PushEvict), which is why
+// the head is advanced with compare-exchange rather than a plain store.
+template <typename T, size_t N>
+class SpscRing
+{
+    static_assert(std::is_trivially_copyable<T>::value, "SpscRing elements must be trivially copyable");
+    static_assert(N > 0, "SpscRing capacity must be nonzero");
+
+    alignas(64) std::atomic<size_t> m_head{0};
+    alignas(64) std::atomic<size_t> m_tail{0};
+    alignas(64) std::atomic<T> m_slots[N];
+
+public:
+    static constexpr size_t Capacity() { return N; }
+
+    size_t Size() const
+    {
+        return m_tail.load(std::memory_order_acquire) - m_head.load(std::memory_order_acquire);
+    }
+
+    // Producer only: append value, failing if the ring is full.
+    bool Push(T value)
+    {
+        size_t tail = m_tail.load(std::memory_order_relaxed);
+        if (tail - m_head.load(std::memory_order_acquire) == N)
+            return false;
+
+        m_slots[tail % N].store(value, std::memory_order_relaxed);
+        m_tail.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Producer only: append value, displacing the oldest element if the ring is full.
+    // Returns true and sets evicted if an element was displaced.
+    bool PushEvict(T value, T & evicted)
+    {
+        bool didEvict = false;
+        size_t tail = m_tail.load(std::memory_order_relaxed);
+        size_t head = m_head.load(std::memory_order_acquire);
+        while (tail - head == N)
+        {
+            evicted = m_slots[head % N].load(std::memory_order_relaxed);
+            if (m_head.compare_exchange_weak(head, head + 1, std::memory_order_acq_rel, std::memory_order_acquire))
+            {
+                didEvict = true;
+                break;
+            }
+        }
+
+        m_slots[tail % N].store(value, std::memory_order_relaxed);
+        m_tail.store(tail + 1, std::memory_order_release);
+        return didEvict;
+    }
+
+    // Consumer only: remove oldest element, failing if the ring is empty.
+    bool Pop(T & value)
+    {
+        size_t head = m_head.load(std::memory_order_acquire);
+        do
+        {
+            if (head == m_tail.load(std::memory_order_acquire))
+                return false;
+
+            // May read a slot the producer is concurrently evicting and refilling; the CAS then fails and we retry.
+            value = m_slots[head % N].load(std::memory_order_relaxed);
+        } while (!m_head.compare_exchange_weak(head, head + 1, std::memory_order_acq_rel, std::memory_order_acquire));
+
+        return true;
+    }
+};
+
+#endif /* SPSCRING_H_ */
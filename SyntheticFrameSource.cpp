@@ -0,0 +1,116 @@
+
+#include <cstring>
+
+#include "SyntheticFrameSource.h"
+
+
+using namespace std;
+using namespace cv;
+
+
+SyntheticFrameSource::SyntheticFrameSource(const CaptureConfig & config) :
+    PacedFrameSource(config)
+{
+}
+
+bool SyntheticFrameSource::OpenContent()
+{
+    // Horizontal/vertical colour gradient gives the encoders realistic, non-trivial content.
+    Mat bgr(m_config.height, m_config.width, CV_8UC3);
+    for (int y = 0; y < m_config.height; ++y)
+    {
+        uchar * pRow = bgr.ptr<uchar>(y);
+        for (int x = 0; x < m_config.width; ++x)
+        {
+            pRow[x * 3 + 0] = (uchar)(x * 255 / m_config.width);
+            pRow[x * 3 + 1] = (uchar)(y * 255 / m_config.height);
+            pRow[x * 3 + 2] = 128;
+        }
+    }
+
+    // Pre-convert the background to the delivered pixel format (BT.601, full range).
+    m_background.resize(GetBufferSize());
+    uchar * pY = m_background.data();
+    uchar * pUV = pY + (size_t)m_stride * m_config.height;
+    for (int y = 0; y < m_config.height; ++y)
+    {
+        const uchar * pSrc = bgr.ptr<uchar>(y);
+        uchar * pDst = pY + (size_t)m_stride * y;
+        for (int x = 0; x < m_config.width; ++x, pSrc += 3)
+        {
+            int b = pSrc[0], g = pSrc[1], r = pSrc[2];
+            uchar luma = (uchar)((77 * r + 150 * g + 29 * b) >> 8);
+            uchar u = (uchar)(((-43 * r - 85 * g + 128 * b) >> 8) + 128);
+            uchar v = (uchar)(((128 * r - 107 * g - 21 * b) >> 8) + 128);
+
+            switch (m_config.pixelFormat)
+            {
+            case PXF_YUYV:
+                pDst[x * 2] = luma;
+                pDst[x * 2 + 1] = (x & 1) ? v : u;
+                break;
+
+            case PXF_NV12:
+                pDst[x] = luma;
+                if (!(y & 1) && !(x & 1))
+                {
+                    uchar * pChroma = pUV + (size_t)m_stride * (y / 2) + x;
+                    pChroma[0] = u;
+                    pChroma[1] = v;
+                }
+                break;
+
+            default:
+                pDst[x * 3 + 0] = pSrc[0];
+                pDst[x * 3 + 1] = pSrc[1];
+                pDst[x * 3 + 2] = pSrc[2];
+                break;
+            }
+        }
+    }
+
+    return true;
+}
+
+void SyntheticFrameSource::CloseContent()
+{
+    m_background.clear();
+}
+
+void SyntheticFrameSource::FillFrame(unsigned char * pData, uint64_t frameNumber)
+{
+    memcpy(pData, m_background.data(), m_background.size());
+
+    // Even block coordinates keep chroma subsampling aligned.
+    int blockWidth = (m_config.width / 8) & ~1;
+    int blockHeight = (m_config.height / 8) & ~1;
+    int travel = max(m_config.width - blockWidth, 1);
+    int x0 = (int)((frameNumber * c_blockStep) % travel) & ~1;
+    int y0 = ((m_config.height - blockHeight) / 2) & ~1;
+
+    // Draw a white block.
+    for (int y = y0; y < y0 + blockHeight; ++y)
+    {
+        uchar * pRow = pData + (size_t)m_stride * y;
+        switch (m_config.pixelFormat)
+        {
+        case PXF_YUYV:
+            for (int x = x0; x < x0 + blockWidth; ++x)
+            {
+                pRow[x * 2] = 255;
+                pRow[x * 2 + 1] = 128;
+            }
+            break;
+
+        case PXF_NV12:
+            memset(pRow + x0, 255, blockWidth);
+            if (!(y & 1))
+                memset(pData + (size_t)m_stride * (m_config.height + y / 2) + x0, 128, blockWidth);
+            break;
+
+        default:
+            memset(pRow + x0 * 3, 255, blockWidth * 3);
+            break;
+        }
+    }
+}
@@ -0,0 +1,26 @@
+#ifndef SYNTHETICFRAMESOURCE_H_
+#define SYNTHETICFRAMESOURCE_H_
+
+#include <vector>
+#include <opencv2/opencv.hpp>
+
+#include "PacedFrameSource.h"
+
+
+// Generates a static gradient background with a block sweeping across it, so every frame contains motion.
+class SyntheticFrameSource : public PacedFrameSource
+{
+    static constexpr int c_blockStep = 4; // Pixels moved per frame.
+
+    std::vector<unsigned char> m_background; // Pre-rendered in the delivered pixel format.
+
+public:
+    SyntheticFrameSource(const CaptureConfig & config);
+
+protected:
+    bool OpenContent() override;
+    void CloseContent() override;
+    void FillFrame(unsigned char * pData, uint64_t frameNumber) override;
+};
+
+#endif /* SYNTHETICFRAMESOURCE_H_ */
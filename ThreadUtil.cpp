@@ -0,0 +1,32 @@
+
+#include <iostream>
+#include <pthread.h>
+#include <sched.h>
+
+#include "ThreadUtil.h"
+
+
+using namespace std;
+
+
+bool SetThreadAffinity(boost::thread & thread, int cpu)
+{
+    cpu_set_t cpuSet;
+    CPU_ZERO(&cpuSet);
+    CPU_SET(cpu, &cpuSet);
+
+    int ret = pthread_setaffinity_np(thread.native_handle(), sizeof(cpuSet), &cpuSet);
+    if (ret != 0)
+    {
+        cout << "Error pinning thread to CPU " << cpu << " (error code=" << ret << ")" << endl;
+        return false;
+    }
+
+    return true;
+}
+
+int GetDefaultCpu(int index)
+{
+    unsigned int numCpus = boost::thread::hardware_concurrency();
+    return (numCpus ? (int)(index % numCpus) : 0);
+}
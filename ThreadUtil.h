@@ -0,0 +1,13 @@
+#ifndef THREADUTIL_H_
+#define THREADUTIL_H_
+
+#include <boost/thread.hpp>
+
+
+// Restrict thread to run on a single core. Returns false (and leaves placement unchanged) on failure.
+bool SetThreadAffinity(boost::thread & thread, int cpu);
+
+// Default core for the n-th camera when none is configured: spread cameras round-robin over available cores.
+int GetDefaultCpu(int index);
+
+#endif /* THREADUTIL_H_ */
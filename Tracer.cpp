@@ -0,0 +1,203 @@
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <vector>
+
+#include "Tracer.h"
+
+
+using namespace std;
+
+
+namespace
+{
+    constexpr size_t c_ringSize = 16384; // Spans kept per thread.
+
+    struct TraceEvent
+    {
+        atomic<const char *> name;
+        atomic<int64_t> startNs;
+        atomic<int64_t> endNs;
+    };
+
+    // Written only by its thread. Spans are numbered from the thread's first, and span i goes in slot i % c_ringSize.
+    struct ThreadBuffer
+    {
+        int tid;
+        string name; // Guarded by g_buffersMutex.
+        atomic<uint64_t> head{0};    // Spans completely written.
+        atomic<uint64_t> claimed{0}; // Spans whose writing has begun; one ahead of head during Record.
+        TraceEvent events[c_ringSize];
+    };
+
+    atomic<bool> g_enabled{false};
+    atomic<int64_t> g_enabledNs{0};
+
+    // Buffers outlive their threads, so spans from threads that have since exited still get dumped.
+    mutex g_buffersMutex;
+    vector<shared_ptr<ThreadBuffer> > g_buffers;
+
+    mutex g_namesMutex;
+    set<string> g_names;
+
+    thread_local ThreadBuffer * t_pBuffer = nullptr;
+    thread_local string t_threadName;
+
+    ThreadBuffer * GetThreadBuffer()
+    {
+        if (!t_pBuffer)
+        {
+            lock_guard<mutex> lock(g_buffersMutex);
+            shared_ptr<ThreadBuffer> pBuffer = make_shared<ThreadBuffer>();
+            pBuffer->tid = (int)g_buffers.size() + 1;
+            pBuffer->name = t_threadName;
+            g_buffers.push_back(pBuffer);
+            t_pBuffer = pBuffer.get();
+        }
+        return t_pBuffer;
+    }
+
+    void WriteJsonString(ostream & os, const string & s)
+    {
+        os << '"';
+        for (char c : s)
+        {
+            if ( (c == '"') || (c == '\\') )
+                os << '\\';
+            os << c;
+        }
+        os << '"';
+    }
+}
+
+
+void Tracer::Enable(bool enable)
+{
+    if (enable && !g_enabled)
+        g_enabledNs = Now();
+    g_enabled = enable;
+}
+
+bool Tracer::IsEnabled()
+{
+    return g_enabled.load(memory_order_relaxed);
+}
+
+void Tracer::SetThreadName(const string & name)
+{
+    t_threadName = name;
+    if (t_pBuffer)
+    {
+        lock_guard<mutex> lock(g_buffersMutex);
+        t_pBuffer->name = name;
+    }
+}
+
+bool Tracer::Dump(const string & path)
+{
+    ofstream ofs(path);
+    if (!ofs.is_open())
+    {
+        cerr << "Error: Cannot open trace file '" << path << "'." << endl;
+        return false;
+    }
+
+    lock_guard<mutex> lock(g_buffersMutex);
+    int64_t sinceNs = g_enabledNs;
+    ofs << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[" << fixed << setprecision(3);
+    bool first = true;
+    for (const auto & pBuffer : g_buffers)
+    {
+        if (!pBuffer->name.empty())
+        {
+            ofs << (first ? "\n" : ",\n") << "{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":1,\"tid\":" << pBuffer->tid <<
+                   ",\"args\":{\"name\":";
+            WriteJsonString(ofs, pBuffer->name);
+            ofs << "}}";
+            first = false;
+        }
+
+        // The owning thread keeps recording meanwhile. Copy what the ring holds, then keep only the spans whose
+        // slots had not been claimed for newer ones by the time copying finished.
+        uint64_t head = pBuffer->head.load(memory_order_acquire);
+        uint64_t begin = (head > c_ringSize) ? head - c_ringSize : 0;
+        vector<const char *> names;
+        vector<int64_t> starts, ends;
+        for (uint64_t i = begin; i < head; ++i)
+        {
+            const TraceEvent & event = pBuffer->events[i % c_ringSize];
+            names.push_back(event.name.load(memory_order_relaxed));
+            starts.push_back(event.startNs.load(memory_order_relaxed));
+            ends.push_back(event.endNs.load(memory_order_relaxed));
+        }
+        atomic_thread_fence(memory_order_acquire);
+        uint64_t claimed = pBuffer->claimed.load(memory_order_relaxed);
+        uint64_t valid = (claimed > c_ringSize) ? max(begin, claimed - c_ringSize) : begin;
+
+        for (uint64_t i = valid; i < head; ++i)
+        {
+            size_t j = i - begin;
+            if (starts[j] < sinceNs)
+                continue;
+
+            ofs << (first ? "\n" : ",\n") << "{\"ph\":\"X\",\"name\":";
+            WriteJsonString(ofs, names[j]);
+            ofs << ",\"pid\":1,\"tid\":" << pBuffer->tid << ",\"ts\":" << starts[j] / 1000.0 <<
+                   ",\"dur\":" << (ends[j] - starts[j]) / 1000.0 << "}";
+            first = false;
+        }
+    }
+    ofs << "\n]}\n";
+
+    if (!ofs.good())
+    {
+        cerr << "Error: Failed to write trace file '" << path << "'." << endl;
+        return false;
+    }
+    return true;
+}
+
+int64_t Tracer::Now()
+{
+    return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void Tracer::Record(const char * name, int64_t startNs, int64_t endNs)
+{
+    ThreadBuffer * pBuffer = GetThreadBuffer();
+    uint64_t head = pBuffer->head.load(memory_order_relaxed);
+    pBuffer->claimed.store(head + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+
+    TraceEvent & event = pBuffer->events[head % c_ringSize];
+    event.name.store(name, memory_order_relaxed);
+    event.startNs.store(startNs, memory_order_relaxed);
+    event.endNs.store(endNs, memory_order_relaxed);
+    pBuffer->head.store(head + 1, memory_order_release);
+}
+
+const char * Tracer::Intern(const string & name)
+{
+    lock_guard<mutex> lock(g_namesMutex);
+    return g_names.insert(name).first->c_str();
+}
+
+
+int TraceSpan::End()
+{
+    if (!m_open)
+        return 0;
+    m_open = false;
+
+    int64_t endNs = Tracer::Now();
+    if (Tracer::IsEnabled())
+        Tracer::Record(m_name, m_startNs, endNs);
+    return (int)((endNs - m_startNs) / 1000);
+}
@@ -0,0 +1,50 @@
+#ifndef TRACER_H_
+#define TRACER_H_
+
+#include <cstdint>
+#include <string>
+
+
+// Timeline of what every thread was doing, written out in Chrome's trace event format for chrome://tracing or
+// ui.perfetto.dev. Spans go into a ring per thread that only that thread writes, so recording takes no locks; once
+// a ring fills, its oldest spans are overwritten. Tracing is off until enabled, and a span then costs two clock
+// reads and a relaxed load.
+class Tracer
+{
+public:
+    static void Enable(bool enable);
+    static bool IsEnabled();
+    // Label for the calling thread on the timeline.
+    static void SetThreadName(const std::string & name);
+    // Write the spans recorded since tracing was last enabled.
+    static bool Dump(const std::string & path);
+
+    // Steady clock, in nanoseconds.
+    static int64_t Now();
+    // name must outlive the tracer, e.g. a string literal or one from Intern.
+    static void Record(const char * name, int64_t startNs, int64_t endNs);
+    // A copy of name that lives as long as the program, for span names built at run time.
+    static const char * Intern(const std::string & name);
+};
+
+
+// Traces the scope it lives in. End closes it early and returns its length, so a span can double as the
+// stopwatch behind the status timings.
+class TraceSpan
+{
+    const char * m_name;
+    int64_t m_startNs;
+    bool m_open = true;
+
+public:
+    explicit TraceSpan(const char * name) : m_name(name), m_startNs(Tracer::Now()) {}
+    ~TraceSpan() { End(); }
+
+    TraceSpan(const TraceSpan &) = delete;
+    TraceSpan & operator=(const TraceSpan &) = delete;
+
+    // Microseconds since the span opened; 0 if already ended.
+    int End();
+};
+
+#endif /* TRACER_H_ */
@@ -0,0 +1,350 @@
+
+#include <cstring>
+#include <iostream>
+
+#include "V4L2FrameSource.h"
+
+
+using namespace std;
+
+
+const uint32_t V4L2FrameSource::c_fourccs[] = {V4L2_PIX_FMT_BGR24, V4L2_PIX_FMT_YUYV, V4L2_PIX_FMT_NV12};
+
+
+V4L2FrameSource::V4L2FrameSource(const CaptureConfig & config) :
+    FrameSource(config)
+{
+}
+
+V4L2FrameSource::~V4L2FrameSource()
+{
+    Close();
+}
+
+bool V4L2FrameSource::Open(int numBuffers)
+{
+    // Open device for non-blocking operation.
+    m_fd = v4l2_open(m_config.path.c_str(), O_RDWR | O_NONBLOCK);
+    if (m_fd == -1)
+    {
+        cout << "Error opening video device" << endl;
+        return false;
+    }
+
+    // Set up image format first - available frame intervals depend on it.
+    if (!SetImageFormat())
+        return false;
+
+    // Configure frame rate.
+    if (!SetFrameRate(m_config.fps))
+        return false;
+
+    // Initialize necessary video buffers.
+    if (!AllocateVideoMemory(numBuffers))
+        return false;
+
+    return true;
+}
+
+void V4L2FrameSource::Close()
+{
+    if (m_fd == -1)
+        return;
+
+    DeAllocateVideoMemory();
+
+    v4l2_close(m_fd);
+    m_fd = -1;
+}
+
+void V4L2FrameSource::EnumerateModes(vector<CaptureMode> & modes) const
+{
+    // Walk formats, then frame sizes per format, then frame intervals per size.
+    struct v4l2_fmtdesc desc = {};
+    desc.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    for (desc.index = 0; xioctl(m_fd, VIDIOC_ENUM_FMT, &desc) == 0; ++desc.index)
+    {
+        int format;
+        for (format = 0; format < PXF_NATIVE; ++format)
+        {
+            if (c_fourccs[format] == desc.pixelformat)
+                break;
+        }
+        if (format == PXF_NATIVE)
+            continue;
+
+        struct v4l2_frmsizeenum size = {};
+        size.pixel_format = desc.pixelformat;
+        for (size.index = 0; xioctl(m_fd, VIDIOC_ENUM_FRAMESIZES, &size) == 0; ++size.index)
+        {
+            if (size.type == V4L2_FRMSIZE_TYPE_DISCRETE)
+            {
+                CaptureMode mode = {(eBDPixelFormat)format, (int)size.discrete.width, (int)size.discrete.height, {}};
+                EnumerateFrameRates(desc.pixelformat, mode.width, mode.height, mode.fps);
+                modes.push_back(mode);
+            }
+            else
+            {
+                // Stepwise/continuous range - report its extremes.
+                CaptureMode minMode = {(eBDPixelFormat)format, (int)size.stepwise.min_width, (int)size.stepwise.min_height, {}};
+                CaptureMode maxMode = {(eBDPixelFormat)format, (int)size.stepwise.max_width, (int)size.stepwise.max_height, {}};
+                EnumerateFrameRates(desc.pixelformat, minMode.width, minMode.height, minMode.fps);
+                EnumerateFrameRates(desc.pixelformat, maxMode.width, maxMode.height, maxMode.fps);
+                modes.push_back(minMode);
+                modes.push_back(maxMode);
+                break;
+            }
+        }
+    }
+}
+
+void V4L2FrameSource::EnumerateFrameRates(uint32_t fourcc, int width, int height, vector<int> & fps) const
+{
+    struct v4l2_frmivalenum ival = {};
+    ival.pixel_format = fourcc;
+    ival.width = width;
+    ival.height = height;
+    for (ival.index = 0; xioctl(m_fd, VIDIOC_ENUM_FRAMEINTERVALS, &ival) == 0; ++ival.index)
+    {
+        if (ival.type == V4L2_FRMIVAL_TYPE_DISCRETE)
+        {
+            if (ival.discrete.numerator)
+                fps.push_back(ival.discrete.denominator / ival.discrete.numerator);
+        }
+        else
+        {
+            // Continuous/stepwise interval range - report fastest and slowest rates.
+            if (ival.stepwise.min.numerator)
+                fps.push_back(ival.stepwise.min.denominator / ival.stepwise.min.numerator);
+            if (ival.stepwise.max.numerator)
+                fps.push_back(ival.stepwise.max.denominator / ival.stepwise.max.numerator);
+            break;
+        }
+    }
+}
+
+bool V4L2FrameSource::Start()
+{
+    // Enqueue all buffers that we've allocated.
+    for (size_t i = 0; i < m_buffers.size(); ++i)
+    {
+        if (!Enqueue(i))
+            return false;
+    }
+
+    // Activate the video stream.
+    enum v4l2_buf_type bufType = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    if (-1 == xioctl(m_fd, VIDIOC_STREAMON, &bufType))
+    {
+        cout << "Error activating stream" << endl;
+        return false;
+    }
+
+    m_streaming = true;
+    return true;
+}
+
+bool V4L2FrameSource::Dequeue(int & index)
+{
+    struct v4l2_buffer buf = {};
+    buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    buf.memory = V4L2_MEMORY_MMAP;
+    if (-1 == xioctl(m_fd, VIDIOC_DQBUF, &buf))
+        return false;
+
+    index = buf.index;
+    return true;
+}
+
+bool V4L2FrameSource::Enqueue(int index)
+{
+    struct v4l2_buffer buf = {};
+    buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    buf.memory = V4L2_MEMORY_MMAP;
+    buf.index = index;
+    if (-1 == xioctl(m_fd, VIDIOC_QBUF, &buf))
+    {
+        cout << "Error enqueueing buffer" << endl;
+        return false;
+    }
+
+    return true;
+}
+
+bool V4L2FrameSource::SetImageFormat()
+{
+    if ( (m_config.pixelFormat == PXF_NATIVE) && !ResolveNativeFormat() )
+        return false;
+
+    const uint32_t fourcc = c_fourccs[m_config.pixelFormat];
+
+    struct v4l2_format fmt = {};
+    fmt.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    fmt.fmt.pix.width = m_config.width;
+    fmt.fmt.pix.height = m_config.height;
+    fmt.fmt.pix.pixelformat = fourcc;
+    fmt.fmt.pix.field = V4L2_FIELD_NONE;
+    if (-1 == xioctl(m_fd, VIDIOC_S_FMT, &fmt))
+    {
+        cout << "Error setting image format" << endl;
+        return false;
+    }
+    if (fmt.fmt.pix.pixelformat != fourcc)
+    {
+        cout << "Requested pixel format rejected" << endl;
+        return false;
+    }
+
+    // Driver may adjust the frame size to the nearest supported one.
+    if ( ((int)fmt.fmt.pix.width != m_config.width) || ((int)fmt.fmt.pix.height != m_config.height) )
+    {
+        cout << "Frame size adjusted by driver to " << fmt.fmt.pix.width << "x" << fmt.fmt.pix.height << endl;
+        m_config.width = fmt.fmt.pix.width;
+        m_config.height = fmt.fmt.pix.height;
+    }
+
+    m_stride = fmt.fmt.pix.bytesperline ? (int)fmt.fmt.pix.bytesperline :
+                                          GetDefaultStride(m_config.pixelFormat, m_config.width);
+    return true;
+}
+
+bool V4L2FrameSource::ResolveNativeFormat()
+{
+    // Prefer formats the camera produces directly - libv4l2 flags the ones it would convert in software.
+    bool haveYUYV = false;
+    bool haveNV12 = false;
+
+    struct v4l2_fmtdesc desc = {};
+    desc.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    for (desc.index = 0; xioctl(m_fd, VIDIOC_ENUM_FMT, &desc) == 0; ++desc.index)
+    {
+        if (desc.flags & V4L2_FMT_FLAG_EMULATED)
+            continue;
+
+        if (desc.pixelformat == V4L2_PIX_FMT_NV12)
+            haveNV12 = true;
+        else if (desc.pixelformat == V4L2_PIX_FMT_YUYV)
+            haveYUYV = true;
+    }
+
+    if (haveNV12)
+        m_config.pixelFormat = PXF_NV12;
+    else if (haveYUYV)
+        m_config.pixelFormat = PXF_YUYV;
+    else
+    {
+        cout << "No native YUV format available - falling back to BGR24" << endl;
+        m_config.pixelFormat = PXF_BGR24;
+    }
+
+    return true;
+}
+
+bool V4L2FrameSource::SetFrameRate(int fps)
+{
+    struct v4l2_streamparm streamparm;
+    memset (&streamparm, 0, sizeof (streamparm));
+    streamparm.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+
+    if (v4l2_ioctl(m_fd, VIDIOC_G_PARM, &streamparm) != 0)
+    {
+        cout << "Error getting stream parameters." << endl;
+        return false;
+    }
+
+    if (!(streamparm.parm.capture.capability & V4L2_CAP_TIMEPERFRAME))
+    {
+        cout << "Device does not support frame rate selection - using its default." << endl;
+        return true;
+    }
+
+    streamparm.parm.capture.capturemode |= V4L2_CAP_TIMEPERFRAME;
+    struct v4l2_fract * pFract = &streamparm.parm.capture.timeperframe;
+    pFract->numerator = 1;
+    pFract->denominator = fps;
+    if (v4l2_ioctl(m_fd, VIDIOC_S_PARM, &streamparm) != 0)
+    {
+        cout << "Error setting frame rate." << endl;
+        return false;
+    }
+
+    // Driver rounds to the nearest supported interval.
+    if (pFract->numerator && ((int)(pFract->denominator / pFract->numerator) != fps))
+    {
+        m_config.fps = pFract->denominator / pFract->numerator;
+        cout << "Frame rate adjusted by driver to " << m_config.fps << endl;
+    }
+
+    return true;
+}
+
+bool V4L2FrameSource::AllocateVideoMemory(int numBuffers)
+{
+    // Request buffers from driver.
+    struct v4l2_requestbuffers req = {};
+    req.count = numBuffers;
+    req.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    req.memory = V4L2_MEMORY_MMAP;
+    if ( (-1 == xioctl(m_fd, VIDIOC_REQBUFS, &req)) || ((int)req.count != numBuffers) )
+    {
+        cout << "Error requesting buffers" << endl;
+        return false;
+    }
+
+    // Map each buffer into memory and track them in m_buffers.
+    for (int i = 0; i < numBuffers; ++i)
+    {
+        struct v4l2_buffer buf = {};
+        buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+        buf.memory = V4L2_MEMORY_MMAP;
+        buf.index = i;
+
+        if (-1 == xioctl(m_fd, VIDIOC_QUERYBUF, &buf))
+        {
+            cout << "Error querying buffers" << endl;
+            return false;
+        }
+
+        RawBuffer rawBuffer;
+        rawBuffer.length = buf.length;
+        rawBuffer.start = v4l2_mmap(NULL, buf.length, PROT_READ | PROT_WRITE,
+                                    MAP_SHARED, m_fd, buf.m.offset);
+
+        if (MAP_FAILED == rawBuffer.start)
+        {
+            cout << "Error mapping buffers" << endl;
+            return false;
+        }
+
+        m_buffers.push_back(rawBuffer);
+    }
+
+    return true;
+}
+
+void V4L2FrameSource::DeAllocateVideoMemory()
+{
+    if (m_streaming)
+    {
+        enum v4l2_buf_type type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+        xioctl(m_fd, VIDIOC_STREAMOFF, &type);
+        m_streaming = false;
+    }
+
+    for (size_t i = 0; i < m_buffers.size(); ++i)
+        v4l2_munmap(m_buffers[i].start, m_buffers[i].length);
+    m_buffers.clear();
+}
+
+int V4L2FrameSource::xioctl(int fd, int request, void * arg)
+{
+    // Helper function to ignore EINTR.
+    int r;
+
+    do
+    {
+        r = v4l2_ioctl(fd, request, arg);
+    } while (-1 == r && EINTR == errno);
+
+    return r;
+}
@@ -0,0 +1,49 @@
+#ifndef V4L2FRAMESOURCE_H_
+#define V4L2FRAMESOURCE_H_
+
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/videodev2.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <libv4l2.h>
+#include <vector>
+
+#include "FrameSource.h"
+
+
+// Frame source backed by a V4L2 capture device using mmap streaming I/O.
+class V4L2FrameSource : public FrameSource
+{
+    static const uint32_t c_fourccs[]; // Indexed by eBDPixelFormat.
+
+    int m_fd = -1;
+    std::vector<RawBuffer> m_buffers;
+    bool m_streaming = false;
+
+public:
+    V4L2FrameSource(const CaptureConfig & config);
+    ~V4L2FrameSource();
+
+    bool Open(int numBuffers) override;
+    void Close() override;
+    void EnumerateModes(std::vector<CaptureMode> & modes) const override;
+    bool Start() override;
+    int GetFd() const override { return m_fd; }
+    const RawBuffer & GetBuffer(int index) const override { return m_buffers[index]; }
+    bool Dequeue(int & index) override;
+    bool Enqueue(int index) override;
+
+private:
+    bool SetImageFormat();
+    bool ResolveNativeFormat();
+    bool SetFrameRate(int fps);
+    bool AllocateVideoMemory(int numBuffers);
+    void DeAllocateVideoMemory();
+
+    void EnumerateFrameRates(uint32_t fourcc, int width, int height, std::vector<int> & fps) const;
+
+    static int xioctl(int fd, int request, void * arg);
+};
+
+#endif /* V4L2FRAMESOURCE_H_ */
@@ -1,352 +1,464 @@
 #include <iostream>
+#include <poll.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <time.h>
+#include <unistd.h>
 
 #include "VideoCaptureMgr.h"
-#include "PiMgr.h"
-#include "Profiling.h"
+#include "CameraPipeline.h"
+#include "ThreadUtil.h"
+#include "Tracer.h"
 
 
 using namespace std;
 using namespace cv;
 
 
-VideoCaptureMgr::VideoCaptureMgr(PiMgr * owner) :
-    m_owner(owner)
+VideoCaptureMgr::VideoCaptureMgr(CameraPipeline * owner, const CaptureConfig & config) :
+    m_owner(owner),
+    m_source(FrameSource::Create(config)),
+    m_readyEvent(eventfd(0, 0)),
+    m_wakeEvent(eventfd(0, EFD_NONBLOCK))
 {
 }
 
 VideoCaptureMgr::~VideoCaptureMgr()
 {
-    if (m_capturing)
+    if (m_thread.joinable())
     {
-        m_thread.interrupt();
+        RequestStop();
         m_thread.join();
     }
 
-    if (m_fd != -1)
-        v4l2_close(m_fd);
+    m_source.reset();
+
+    if (m_readyEvent != -1)
+        close(m_readyEvent);
+
+    if (m_wakeEvent != -1)
+        close(m_wakeEvent);
 
     cout << "Video capture manager released." << endl;
 }
 
 bool VideoCaptureMgr::Initialize()
 {
-    // Open device for non-blocking operation.
-    m_fd = v4l2_open("/dev/video0", O_RDWR | O_NONBLOCK);
-    if (m_fd == -1)
+    if ( (m_readyEvent == -1) || (m_wakeEvent == -1) )
     {
-        cout << "Error opening video device" << endl;
+        cout << "Error creating capture events" << endl;
         return false;
     }
-    FD_ZERO(&m_fds);
-    FD_SET(m_fd, &m_fds);
-
-    // Configure frame rate.
-    if (!SetFrameRate(30))
-        return false;
-
-    // Set up image format.
-    if (!SetImageFormat())
-        return false;
 
-    // Initialize necessary video buffers.
-    if (!AllocateVideoMemory())
+    if (!m_source || !OpenSource())
         return false;
 
     // Kick off capture thread.
     m_capturing = true;
     m_thread = boost::thread(&VideoCaptureMgr::DoCapture, this);
+    if (m_activeConfig.cpu >= 0)
+        SetThreadAffinity(m_thread, m_activeConfig.cpu);
     return true;
 }
 
-int VideoCaptureMgr::GetLatest(Mat *& image)
+FrameLease::FrameLease(FrameLease && other) :
+    m_pMgr(other.m_pMgr), m_index(other.m_index)
 {
-    //PROFILE_START;
-
-    if (!m_capturing)
-        return -1;
+    other.m_pMgr = nullptr;
+    other.m_index = -1;
+}
 
-    int numDroppedFrames;
+FrameLease & FrameLease::operator=(FrameLease && other)
+{
+    if (this != &other)
+    {
+        Release();
+        m_pMgr = other.m_pMgr;
+        m_index = other.m_index;
+        other.m_pMgr = nullptr;
+        other.m_index = -1;
+    }
+    return *this;
+}
 
-    // Free up current image and put buffer on the free queue.
-    if (m_currIndex != -1)
+void FrameLease::Release()
+{
+    if (m_pMgr)
     {
-        delete m_pCurrImage;
-        m_pCurrImage = nullptr;
+        m_pMgr->ReleaseBuffer(m_index);
+        m_pMgr = nullptr;
+        m_index = -1;
+    }
+}
+
+VideoFrame & FrameLease::operator*() const
+{
+    return *m_pMgr->m_frames[m_index];
+}
+
+VideoFrame * FrameLease::operator->() const
+{
+    return m_pMgr->m_frames[m_index].get();
+}
+
+
+CaptureConfig VideoCaptureMgr::GetConfig() const
+{
+    boost::mutex::scoped_lock lock(m_configMutex);
+    return m_activeConfig;
+}
 
-        boost::mutex::scoped_lock lock(m_freeQueueMutex);
-        m_freeQueue.push(m_currIndex);
+vector<CaptureMode> VideoCaptureMgr::GetModes() const
+{
+    boost::mutex::scoped_lock lock(m_configMutex);
+    return m_modes;
+}
+
+void VideoCaptureMgr::RequestReconfigure(const CaptureConfig & config)
+{
+    {
+        boost::mutex::scoped_lock lock(m_configMutex);
+        m_pendingConfig = config;
     }
+    m_reconfigRequested = true;
+    SignalWake();
+}
+
+int VideoCaptureMgr::GetLatest(FrameLease & lease, int & handoffUs)
+{
+    // Free up current frame and put buffer on the free ring.
+    lease.Release();
 
-    //PROFILE_LOG(FREE1);
+    if (!m_capturing)
+        return -1;
 
     // Block until a new frame is available and then grab it.
     // Also, flush any extra, older queued frames.
+    int currIndex = -1;
+    int numReady = 0;
+    try
     {
-        boost::mutex::scoped_lock lock(m_readyQueueMutex);
-        try
+        while (true)
         {
-            while (m_readyQueue.size() == 0)
-                m_condition.wait(lock);
-            //PROFILE_LOG(READY);
-        }
-        catch (boost::thread_interrupted&)
-        {
-            m_owner->SetInterrupted();
-            return -1;
-        }
-
-        numDroppedFrames = m_readyQueue.size() - 1;
+            int index;
+            while (m_readyRing.Pop(index))
+            {
+                if (currIndex != -1)
+                    ReleaseBuffer(currIndex);
+                currIndex = index;
+                ++numReady;
+            }
 
-        {
-            boost::mutex::scoped_lock lockFree(m_freeQueueMutex);
-            while (m_readyQueue.size() > 1)
+            // While a reconfigure is pending, ready frames are handed back rather than out, so the capture thread
+            // can reclaim every buffer through the free ring.
+            if ( (currIndex != -1) && m_reconfigRequested )
             {
-                m_freeQueue.push(m_readyQueue.front());
-                m_readyQueue.pop();
+                ReleaseBuffer(currIndex);
+                currIndex = -1;
+                numReady = 0;
             }
-            //PROFILE_LOG(FREE2);
-        }
+            if (numReady)
+                break;
 
-        m_currIndex = m_readyQueue.front();
-        m_readyQueue.pop();
+            boost::this_thread::interruption_point();
+            if (!m_capturing)
+                return -1;
+
+            WaitReady();
+        }
     }
+    catch (boost::thread_interrupted&)
+    {
+        m_owner->SetInterrupted();
+        return -1;
+    }
+
+    handoffUs = (int)((GetTimestampNs() - m_readyTimeNs[currIndex]) / 1000);
 
-    // Build new Mat from latest returned buffer.
-    image = m_pCurrImage = new Mat(Size(640, 480), CV_8UC3, m_buffers[m_currIndex].start, Mat::AUTO_STEP);
-    //PROFILE_LOG(DONE);
-    return numDroppedFrames;
+    // Hand out the prebuilt frame view for this buffer.
+    m_frames[currIndex]->Invalidate();
+    lease = FrameLease(this, currIndex);
+    return (numReady - 1);
 }
 
-bool VideoCaptureMgr::SetImageFormat()
+void VideoCaptureMgr::Interrupt()
 {
-    struct v4l2_format fmt = {};
-    fmt.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-    fmt.fmt.pix.width = 640;
-    fmt.fmt.pix.height = 480;
-    fmt.fmt.pix.pixelformat = V4L2_PIX_FMT_BGR24;
-    fmt.fmt.pix.field = V4L2_FIELD_NONE;
-    if (-1 == xioctl(m_fd, VIDIOC_S_FMT, &fmt))
+    // Wake consumer so it can observe the pending thread interruption.
+    SignalReady();
+}
+
+void VideoCaptureMgr::DoCapture()
+{
+    Tracer::SetThreadName("camera " + to_string(m_owner->GetId()) + " capture");
+
+    // Enqueue all buffers and activate the source.
+    if (!m_source->Start())
     {
-        cout << "Error setting image format" << endl;
-        return false;
+        StopCapturing();
+        return;
     }
-    if (fmt.fmt.pix.pixelformat != V4L2_PIX_FMT_BGR24)
+
+    // Wait on the source descriptor and the wake event together.
+    int epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (epfd == -1)
     {
-        cout << "Requested pixel format rejected" << endl;
-        return false;
+        cout << "Error creating capture epoll instance" << endl;
+        StopCapturing();
+        return;
     }
 
-    return true;
+    struct epoll_event ev = {};
+    ev.events = EPOLLIN;
+    ev.data.fd = m_source->GetFd();
+    bool registered = (epoll_ctl(epfd, EPOLL_CTL_ADD, ev.data.fd, &ev) == 0);
+    ev.data.fd = m_wakeEvent;
+    registered = registered && (epoll_ctl(epfd, EPOLL_CTL_ADD, ev.data.fd, &ev) == 0);
+
+    if (registered)
+        CaptureLoop(epfd);
+    else
+        cout << "Error registering capture descriptors" << endl;
+
+    // Source is closed by the destructor, once the consumer can no longer hold a buffer.
+    close(epfd);
+    StopCapturing();
 }
 
-bool VideoCaptureMgr::SetFrameRate(int fps)
+void VideoCaptureMgr::CaptureLoop(int epfd)
 {
-    // TODO: Test for capability first.
-    struct v4l2_streamparm streamparm;
-    memset (&streamparm, 0, sizeof (streamparm));
-    streamparm.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    // Main loop for processing incoming frames.
+    // Returns on stop request or error.
+    struct epoll_event events[c_numEvents];
+    while (true)
+    {
+        int n = epoll_wait(epfd, events, c_numEvents, -1);
+        if (n == -1)
+        {
+            if (errno == EINTR)
+                continue;
+
+            cout << "Error waiting for frame" << endl;
+            return;
+        }
 
-    if (v4l2_ioctl(m_fd, VIDIOC_G_PARM, &streamparm) != 0)
+        for (int i = 0; i < n; ++i)
+        {
+            if (events[i].data.fd == m_wakeEvent)
+            {
+                uint64_t value;
+                if (read(m_wakeEvent, &value, sizeof(value)) != sizeof(value))
+                    cout << "Error reading capture wake event" << endl;
+
+                if (m_stopRequested)
+                {
+                    cout << "Stop requested - shutting down video capture manager..." << endl;
+                    return;
+                }
+
+                if (m_reconfigRequested && !Reconfigure(epfd))
+                    return;
+            }
+            else if (!ProcessReadyBuffers())
+                return;
+        }
+    }
+}
+
+bool VideoCaptureMgr::ProcessReadyBuffers()
+{
+    // Return any buffers released by the consumer to the source.
+    // The ready ring headspace guarantees the source always keeps some buffers, so it will wake us again.
+    int index;
+    while (m_freeRing.Pop(index))
     {
-        cout << "Error getting stream parameters." << endl;
-        return false;
+        --m_numOutstanding;
+        if (!ReEnqueue(index))
+            return false;
     }
 
-    streamparm.parm.capture.capturemode |= V4L2_CAP_TIMEPERFRAME;
-    struct v4l2_fract * pFract = &streamparm.parm.capture.timeperframe;
-    pFract->numerator = 1;
-    pFract->denominator = fps;
-    if (v4l2_ioctl(m_fd, VIDIOC_S_PARM, &streamparm) != 0)
+    // Dequeue every frame the source has ready in one batch.
+    TraceSpan span("Dequeue");
+    // Bounded, so an unpaced source immediately refilling evicted buffers cannot hold the thread here.
+    int numDequeued = 0;
+    int bufIndex;
+    bool dequeued = false;
+    while ( (numDequeued < c_numBuffers) && (dequeued = m_source->Dequeue(bufIndex)) )
     {
-        cout << "Error setting frame rate." << endl;
+        ++numDequeued;
+
+        // Add to the ready ring, displacing oldest record if necessary.
+        m_readyTimeNs[bufIndex] = GetTimestampNs();
+        if (m_readyRing.PushEvict(bufIndex, index))
+        {
+            if (!ReEnqueue(index))
+                return false;
+        }
+        else
+            ++m_numOutstanding;
+    }
+    if (!dequeued && (errno != EAGAIN))
+    {
+        cout << "Error dequeueing buffer" << endl;
         return false;
     }
 
+    // Notify main thread once per batch.
+    if (numDequeued)
+        SignalReady();
+
     return true;
 }
-bool VideoCaptureMgr::AllocateVideoMemory()
+
+bool VideoCaptureMgr::Reconfigure(int epfd)
 {
-    // Request buffers from driver.
-    struct v4l2_requestbuffers req = {};
-    req.count = c_numBuffers;
-    req.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-    req.memory = V4L2_MEMORY_MMAP;
-    if ( (-1 == xioctl(m_fd, VIDIOC_REQBUFS, &req)) || (req.count != c_numBuffers) )
+    CaptureConfig config;
     {
-        cout << "Error requesting buffers" << endl;
-        return false;
+        boost::mutex::scoped_lock lock(m_configMutex);
+        config = m_pendingConfig;
     }
+    cout << "Reconfiguring video capture..." << endl;
 
-    // Map each buffer into memory and track them in m_buffers.
-    for (size_t i = 0; i < c_numBuffers; ++i)
+    // Reclaim every buffer before the old ones are unmapped. Only the consumer pops the ready ring: it returns the
+    // frame it holds and any still ready (see GetLatest), signalling the wake event while a reconfigure is pending.
+    int index;
+    while (true)
     {
-        struct v4l2_buffer buf = {};
-        buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-        buf.memory = V4L2_MEMORY_MMAP;
-        buf.index = i;
+        while (m_freeRing.Pop(index))
+            --m_numOutstanding;
+        if (m_numOutstanding == 0)
+            break;
 
-        if (-1 == xioctl(m_fd, VIDIOC_QUERYBUF, &buf))
+        if (!WaitWake())
         {
-            cout << "Error querying buffers" << endl;
+            cout << "Stop requested during reconfiguration - shutting down video capture manager..." << endl;
             return false;
         }
+    }
 
-        m_buffers[i].length = buf.length;
-        m_buffers[i].start = v4l2_mmap(NULL, buf.length, PROT_READ | PROT_WRITE,
-                                       MAP_SHARED, m_fd, buf.m.offset);
-
-        if (MAP_FAILED == m_buffers[i].start)
-        {
-            cout << "Error mapping buffers" << endl;
+    // Replace the source; a device must be closed before it can be reopened with new buffers.
+    // On failure fall back to the previous (already negotiated) settings.
+    const CaptureConfig previous = m_source->GetConfig();
+    epoll_ctl(epfd, EPOLL_CTL_DEL, m_source->GetFd(), nullptr);
+    m_source = FrameSource::Create(config);
+    if (!m_source || !OpenSource())
+    {
+        cout << "Error reconfiguring video capture - restoring previous settings" << endl;
+        m_source = FrameSource::Create(previous);
+        if (!OpenSource())
             return false;
-        }
+    }
+    m_reconfigRequested = false;
+
+    if (!m_source->Start())
+        return false;
+
+    struct epoll_event ev = {};
+    ev.events = EPOLLIN;
+    ev.data.fd = m_source->GetFd();
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, ev.data.fd, &ev) == -1)
+    {
+        cout << "Error registering capture descriptor" << endl;
+        return false;
     }
 
     return true;
 }
 
-void VideoCaptureMgr::DeAllocateVideoMemory()
+bool VideoCaptureMgr::OpenSource()
 {
-    enum v4l2_buf_type type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-    xioctl(m_fd, VIDIOC_STREAMOFF, &type);
-    for (size_t i = 0; i < c_numBuffers; ++i)
-        v4l2_munmap(m_buffers[i].start, m_buffers[i].length);
-}
+    // Open frame source, negotiate format, and initialize necessary video buffers.
+    if (!m_source->Open(c_numBuffers))
+        return false;
 
-void VideoCaptureMgr::DoCapture()
-{
-    // Enqueue all buffers that we've allocated.
+    // Build frame views once per buffer.
     for (int i = 0; i < c_numBuffers; ++i)
     {
-        struct v4l2_buffer buf = {};
-        buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-        buf.memory = V4L2_MEMORY_MMAP;
-        buf.index = i;
-        if (-1 == xioctl(m_fd, VIDIOC_QBUF, &buf))
-        {
-            cout << "Error enqueueing buffers" << endl;
-            m_capturing = false;
-            return;
-        }
+        m_frames[i].reset(new VideoFrame(m_source->GetPixelFormat(), m_source->GetWidth(), m_source->GetHeight(),
+                                         m_source->GetBuffer(i).start, m_source->GetStride()));
     }
 
-    // Activate the video stream.
-    enum v4l2_buf_type bufType = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-    if (-1 == xioctl(m_fd, VIDIOC_STREAMON, &bufType))
     {
-        cout << "Error activating stream" << endl;
-        m_capturing = false;
-        return;
+        boost::mutex::scoped_lock lock(m_configMutex);
+        m_activeConfig = m_source->GetConfig();
+        m_modes.clear();
+        m_source->EnumerateModes(m_modes);
     }
 
-    // Main loop for processing incoming frames.
-    struct timeval tv = {};
-    do
-    {
-        // Wait for a frame to be available.
-        int r;
-        do
-        {
-            tv.tv_sec = 2;
-            tv.tv_usec = 0;
-            r = select(m_fd + 1, &m_fds, nullptr, nullptr, &tv);
-        } while ( (r == -1) && (errno == EINTR) );
-        if (r == -1)
-        {
-            cout << "Error or timeout during select" << endl;
-            m_capturing = false;
-            return;
-        }
+    cout << "Capturing from " << FrameSource::c_sourceTypeNames[m_source->GetConfig().sourceType] <<
+            " source at " << m_source->GetWidth() << "x" << m_source->GetHeight() <<
+            " (" << FrameSource::c_pixelFormatNames[m_source->GetPixelFormat()] << "), " <<
+            m_source->GetConfig().fps << " fps" << endl;
+    return true;
+}
 
-        // Dequeue the buffer containing the frame.
-        struct v4l2_buffer buf = {};
-        buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-        buf.memory = V4L2_MEMORY_MMAP;
-        do
-        {
-            r = xioctl(m_fd, VIDIOC_DQBUF, &buf);
+void VideoCaptureMgr::RequestStop()
+{
+    m_stopRequested = true;
+    SignalWake();
+}
 
-            // Give main thread an opportunity to shut this thread down.
-            try
-            {
-                boost::this_thread::interruption_point();
-            }
-            catch (boost::thread_interrupted&)
-            {
-                cout << "Interrupted after dequeueing frame - shutting down video capture manager..." << endl;
-                DeAllocateVideoMemory();
-                m_capturing = false;
-                return;
-            }
-        } while (EAGAIN == errno);
-        if (r == -1)
-        {
-            cout << "Error dequeueing buffer" << endl;
-            m_capturing = false;
-            return;
-        }
+void VideoCaptureMgr::SignalWake()
+{
+    uint64_t value = 1;
+    if (write(m_wakeEvent, &value, sizeof(value)) != sizeof(value))
+        cout << "Error signalling capture wake event" << endl;
+}
 
-        // Free any returned queue elements.
-        queue<int> localQueue;
+bool VideoCaptureMgr::WaitWake()
+{
+    struct pollfd pfd = {};
+    pfd.fd = m_wakeEvent;
+    pfd.events = POLLIN;
+    while ( (poll(&pfd, 1, -1) == -1) && (errno == EINTR) )
+        ;
 
-        // Critical section begin
-        {
-            boost::mutex::scoped_lock lock(m_freeQueueMutex);
-            if (!m_freeQueue.empty())
-            {
-                swap(m_freeQueue, localQueue);
-            }
-        }
-        // Critical section end
+    uint64_t value;
+    if (read(m_wakeEvent, &value, sizeof(value)) != sizeof(value))
+        cout << "Error reading capture wake event" << endl;
 
-        int index;
-        while (!localQueue.empty())
-        {
-            index = localQueue.front();
-            localQueue.pop();
-            if (!ReEnqueue(index))
-            {
-                m_capturing = false;
-                return;
-            }
-        }
+    return !m_stopRequested;
+}
 
-        // Add to the ready queue and notify main thread.
-        // Dequeue oldest record if necessary.
-        index = -1;
+void VideoCaptureMgr::ReleaseBuffer(int index)
+{
+    m_freeRing.Push(index);
 
-        // Critical section begin
-        {
-            boost::mutex::scoped_lock lock(m_readyQueueMutex);
-            if (m_readyQueue.size() == (c_numBuffers - c_minQueueHeadspace))
-            {
-                index = m_readyQueue.front();
-                m_readyQueue.pop();
-            }
-            m_readyQueue.push(buf.index);
-            m_condition.notify_one();
-        }
-        // Critical section end
+    // Capture thread only needs waking for returned buffers while it is reclaiming them for a reconfigure.
+    atomic_thread_fence(memory_order_seq_cst);
+    if (m_reconfigRequested)
+        SignalWake();
+}
 
-        if (index != -1)
-        {
-            if (!ReEnqueue(index))
-            {
-                m_capturing = false;
-                return;
-            }
-        }
+void VideoCaptureMgr::StopCapturing()
+{
+    m_capturing = false;
+    SignalReady();
+}
+
+void VideoCaptureMgr::SignalReady()
+{
+    uint64_t value = 1;
+    if (write(m_readyEvent, &value, sizeof(value)) != sizeof(value))
+        cout << "Error signalling frame ready" << endl;
+}
 
-    } while (true);
+void VideoCaptureMgr::WaitReady()
+{
+    uint64_t value;
+    while ( (read(m_readyEvent, &value, sizeof(value)) == -1) && (errno == EINTR) )
+        ;
+}
+
+int64_t VideoCaptureMgr::GetTimestampNs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
 }
 
 bool VideoCaptureMgr::ReEnqueue(int index)
 {
-    struct v4l2_buffer buf = {};
-    buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-    buf.memory = V4L2_MEMORY_MMAP;
-    buf.index = index;
-    if (-1 == xioctl(m_fd, VIDIOC_QBUF, &buf))
+    if (!m_source->Enqueue(index))
     {
         cout << "Error re-enqueueing buffer" << endl;
         return false;
@@ -354,16 +466,3 @@ bool VideoCaptureMgr::ReEnqueue(int index)
 
     return true;
 }
-
-int VideoCaptureMgr::xioctl(int fd, int request, void * arg)
-{
-    // Helper function to ignore EINTR.
-    int r;
-
-    do
-    {
-        r = v4l2_ioctl(fd, request, arg);
-    } while (-1 == r && EINTR == errno);
-
-    return r;
-}
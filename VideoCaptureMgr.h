@@ -1,63 +1,108 @@
 #ifndef VIDEOCAPTUREMGR_H_
 #define VIDEOCAPTUREMGR_H_
 
-#include <errno.h>
-#include <fcntl.h>
-#include <linux/videodev2.h>
-#include <sys/ioctl.h>
-#include <sys/mman.h>
-#include <libv4l2.h>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <vector>
 #include <boost/thread.hpp>
-#include <boost/thread/mutex.hpp>
 #include <opencv2/opencv.hpp>
-#include <queue>
 
+#include "FrameSource.h"
+#include "SpscRing.h"
+#include "VideoFrame.h"
 
-struct RawBuffer
+
+class CameraPipeline;
+class VideoCaptureMgr;
+
+
+// Move-only borrow of a captured frame.
+// The buffer goes back to the capture thread when the lease is released, reassigned or destroyed,
+// so a frame cannot be used after its buffer has been re-enqueued.
+// Must be released on the thread that calls VideoCaptureMgr::GetLatest.
+class FrameLease
 {
-    void * start;
-    size_t length;
-};
+    friend class VideoCaptureMgr;
 
+    VideoCaptureMgr * m_pMgr = nullptr;
+    int m_index = -1;
+
+    FrameLease(VideoCaptureMgr * pMgr, int index) : m_pMgr(pMgr), m_index(index) {}
+
+public:
+    FrameLease() = default;
+    FrameLease(const FrameLease &) = delete;
+    FrameLease & operator=(const FrameLease &) = delete;
+    FrameLease(FrameLease && other);
+    FrameLease & operator=(FrameLease && other);
+    ~FrameLease() { Release(); }
+
+    explicit operator bool() const { return (m_pMgr != nullptr); }
+    VideoFrame & operator*() const;
+    VideoFrame * operator->() const;
+
+    void Release();
+};
 
-class PiMgr;
 
 class VideoCaptureMgr
 {
+    friend class FrameLease;
+
     static constexpr int c_numBuffers = 10;
     static constexpr int c_minQueueHeadspace = 3; // User-owned buffer, Just captured buffer, and filling buffer
+    static constexpr int c_numEvents = 2; // Source descriptor and wake event.
 
-    PiMgr * m_owner;
-    int m_fd = -1;
-    fd_set m_fds;
-    RawBuffer m_buffers[c_numBuffers];
+    CameraPipeline * m_owner;
+    std::unique_ptr<FrameSource> m_source;
     boost::thread m_thread;
     volatile bool m_capturing = false;
-    std::queue<int> m_readyQueue;
-    std::queue<int> m_freeQueue;
-    boost::mutex m_readyQueueMutex;
-    boost::mutex m_freeQueueMutex;
-    boost::condition_variable m_condition;
-    cv::Mat * m_pCurrImage = nullptr;
-    int m_currIndex = -1;
+    std::atomic<bool> m_stopRequested{false};
+    std::atomic<bool> m_reconfigRequested{false};
+    mutable boost::mutex m_configMutex;                            // Guards configuration shared with other threads.
+    CaptureConfig m_activeConfig;
+    CaptureConfig m_pendingConfig;
+    std::vector<CaptureMode> m_modes;
+    int m_numOutstanding = 0;                                      // Buffers in ready ring or held by consumer.
+    SpscRing<int, c_numBuffers - c_minQueueHeadspace> m_readyRing; // Capture thread -> consumer.
+    SpscRing<int, c_numBuffers> m_freeRing;                        // Consumer -> capture thread.
+    int m_readyEvent;                                              // eventfd the consumer blocks on.
+    int m_wakeEvent;                                               // eventfd waking the capture thread.
+    int64_t m_readyTimeNs[c_numBuffers] = {};                      // When each buffer was made ready.
+    std::unique_ptr<VideoFrame> m_frames[c_numBuffers];            // Prebuilt view of each buffer.
 
 public:
-    VideoCaptureMgr(PiMgr * owner);
+    VideoCaptureMgr(CameraPipeline * owner, const CaptureConfig & config);
     ~VideoCaptureMgr();
 
     bool Initialize();
     bool IsCapturing() const { return m_capturing; }
-    int GetLatest(cv::Mat *& image);
+    int GetLatest(FrameLease & lease, int & handoffUs);
+    void Interrupt();
+
+    CaptureConfig GetConfig() const;
+    std::vector<CaptureMode> GetModes() const;
+
+    // Switch format, size and/or rate without restarting. Applied by the capture thread once all frames are returned.
+    void RequestReconfigure(const CaptureConfig & config);
 
 private:
-    bool SetImageFormat();
-    bool SetFrameRate(int fps);
-    bool AllocateVideoMemory();
-    void DeAllocateVideoMemory();
     void DoCapture();
+    void CaptureLoop(int epfd);
+    bool ProcessReadyBuffers();
+    bool Reconfigure(int epfd);
+    bool OpenSource();
+    void ReleaseBuffer(int index);
+    void RequestStop();
+    void SignalWake();
+    bool WaitWake();
+    void StopCapturing();
+    void SignalReady();
+    void WaitReady();
     bool ReEnqueue(int index);
 
-    int xioctl(int fd, int request, void * arg);
+    static int64_t GetTimestampNs();
 };
 
 #endif /* VIDEOCAPTUREMGR_H_ */
@@ -0,0 +1,74 @@
+
+#include "VideoFrame.h"
+
+
+using namespace std;
+using namespace cv;
+
+
+VideoFrame::VideoFrame(eBDPixelFormat format, int width, int height, void * pData, size_t stride) :
+    m_format(format)
+{
+    switch (m_format)
+    {
+    case PXF_YUYV:
+        m_raw = Mat(height, width, CV_8UC2, pData, stride);
+        break;
+
+    case PXF_NV12:
+        // Single-planar NV12: Y plane immediately followed by interleaved UV plane of half height.
+        m_raw = Mat(height * 3 / 2, width, CV_8UC1, pData, stride);
+        m_gray = m_raw.rowRange(0, height);
+        break;
+
+    default:
+        m_raw = Mat(height, width, CV_8UC3, pData, stride);
+        m_bgr = m_raw;
+        break;
+    }
+
+    Invalidate();
+}
+
+void VideoFrame::Invalidate()
+{
+    // Views directly onto the buffer stay valid; converted images must be redone.
+    m_grayValid = (m_format == PXF_NV12);
+    m_bgrValid = (m_format == PXF_BGR24);
+}
+
+Size VideoFrame::GetSize() const
+{
+    if (m_format == PXF_NV12)
+        return Size(m_raw.cols, m_raw.rows * 2 / 3);
+
+    return m_raw.size();
+}
+
+const Mat & VideoFrame::GetGray()
+{
+    if (!m_grayValid)
+    {
+        if (m_format == PXF_YUYV)
+            cvtColor(m_raw, m_gray, COLOR_YUV2GRAY_YUYV); // Plain extraction of Y samples.
+        else
+            cvtColor(m_raw, m_gray, COLOR_BGR2GRAY);
+        m_grayValid = true;
+    }
+
+    return m_gray;
+}
+
+const Mat & VideoFrame::GetBgr()
+{
+    if (!m_bgrValid)
+    {
+        if (m_format == PXF_YUYV)
+            cvtColor(m_raw, m_bgr, COLOR_YUV2BGR_YUYV);
+        else
+            cvtColor(m_raw, m_bgr, COLOR_YUV2BGR_NV12);
+        m_bgrValid = true;
+    }
+
+    return m_bgr;
+}
@@ -0,0 +1,39 @@
+#ifndef VIDEOFRAME_H_
+#define VIDEOFRAME_H_
+
+#include <opencv2/opencv.hpp>
+
+#include "FrameSource.h"
+
+
+// View of a captured buffer in its native pixel format, built once per buffer.
+// Grayscale and BGR representations are produced lazily and at most once per frame, into scratch images
+// that persist across frames so steady-state capture does not allocate.
+// For NV12 the grayscale image is the Y plane itself (no copy); for BGR24 the BGR image is the buffer itself.
+class VideoFrame
+{
+    eBDPixelFormat m_format;
+    cv::Mat m_raw;
+    cv::Mat m_gray;
+    cv::Mat m_bgr;
+    bool m_grayValid = false;
+    bool m_bgrValid = false;
+
+public:
+    VideoFrame(eBDPixelFormat format, int width, int height, void * pData, size_t stride);
+
+    // Called when the underlying buffer has been refilled.
+    void Invalidate();
+
+    eBDPixelFormat GetFormat() const { return m_format; }
+    const cv::Mat & GetRaw() const { return m_raw; }
+    cv::Size GetSize() const;
+
+    // True if the luma plane can be obtained without colour conversion.
+    bool HasNativeLuma() const { return (m_format != PXF_BGR24); }
+
+    const cv::Mat & GetGray();
+    const cv::Mat & GetBgr();
+};
+
+#endif /* VIDEOFRAME_H_ */
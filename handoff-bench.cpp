@@ -0,0 +1,302 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/eventfd.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+#include "LatencyHistogram.h"
+#include "SpscRing.h"
+
+
+// Compares the capture-to-consumer buffer handoff used before VideoCaptureMgr moved to lock-free rings (two
+// mutex-guarded queues and a condition variable) with the current one (SpscRing plus eventfd). A producer thread
+// plays the capture thread, making a buffer ready once per frame interval; a consumer thread plays the detection
+// worker, always taking the latest buffer and handing back the rest. Latency is from the buffer being made ready
+// to the consumer holding it, as in the server's Handoff status line.
+
+using namespace std;
+
+
+namespace
+{
+    constexpr int c_numBuffers = 10;
+    constexpr int c_minQueueHeadspace = 3;
+    constexpr int c_readySize = c_numBuffers - c_minQueueHeadspace;
+
+    int64_t GetTimestampNs()
+    {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+    }
+
+    void SleepUntil(int64_t ns)
+    {
+        struct timespec ts;
+        ts.tv_sec = ns / 1000000000;
+        ts.tv_nsec = ns % 1000000000;
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, nullptr) != 0)
+            ;
+    }
+
+    // Stand-in for per-frame processing, so frames can arrive while the consumer is busy.
+    void Spin(int us)
+    {
+        int64_t endNs = GetTimestampNs() + (int64_t)us * 1000;
+        while (GetTimestampNs() < endNs)
+            ;
+    }
+
+
+    // The queues as they were: every push and pop takes a lock, and flushing stale frames takes both.
+    class MutexHandoff
+    {
+        queue<int> m_readyQueue;
+        queue<int> m_freeQueue;
+        mutex m_readyQueueMutex;
+        mutex m_freeQueueMutex;
+        condition_variable m_condition;
+        bool m_stopped = false;
+
+    public:
+        // Producer side. Returns the evicted buffer, or -1.
+        int MakeReady(int index)
+        {
+            int evicted = -1;
+            lock_guard<mutex> lock(m_readyQueueMutex);
+            if (m_readyQueue.size() == c_readySize)
+            {
+                evicted = m_readyQueue.front();
+                m_readyQueue.pop();
+            }
+            m_readyQueue.push(index);
+            m_condition.notify_one();
+            return evicted;
+        }
+
+        void ReclaimFree(vector<int> & available)
+        {
+            queue<int> localQueue;
+            {
+                lock_guard<mutex> lock(m_freeQueueMutex);
+                swap(m_freeQueue, localQueue);
+            }
+            while (!localQueue.empty())
+            {
+                available.push_back(localQueue.front());
+                localQueue.pop();
+            }
+        }
+
+        void Stop()
+        {
+            lock_guard<mutex> lock(m_readyQueueMutex);
+            m_stopped = true;
+            m_condition.notify_one();
+        }
+
+        // Consumer side. Returns the latest ready buffer, or -1 once stopped.
+        int GetLatest(int currIndex)
+        {
+            if (currIndex != -1)
+            {
+                lock_guard<mutex> lock(m_freeQueueMutex);
+                m_freeQueue.push(currIndex);
+            }
+
+            unique_lock<mutex> lock(m_readyQueueMutex);
+            while (m_readyQueue.empty() && !m_stopped)
+                m_condition.wait(lock);
+            if (m_readyQueue.empty())
+                return -1;
+
+            {
+                lock_guard<mutex> lockFree(m_freeQueueMutex);
+                while (m_readyQueue.size() > 1)
+                {
+                    m_freeQueue.push(m_readyQueue.front());
+                    m_readyQueue.pop();
+                }
+            }
+            int index = m_readyQueue.front();
+            m_readyQueue.pop();
+            return index;
+        }
+    };
+
+
+    // The handoff as VideoCaptureMgr does it now.
+    class RingHandoff
+    {
+        SpscRing<int, c_readySize> m_readyRing;
+        SpscRing<int, c_numBuffers> m_freeRing;
+        int m_readyEvent = eventfd(0, 0);
+        atomic<bool> m_stopped{false};
+
+        void SignalReady()
+        {
+            uint64_t value = 1;
+            if (write(m_readyEvent, &value, sizeof(value)) != sizeof(value))
+                perror("write");
+        }
+
+    public:
+        ~RingHandoff() { close(m_readyEvent); }
+
+        int MakeReady(int index)
+        {
+            int evicted;
+            bool didEvict = m_readyRing.PushEvict(index, evicted);
+            SignalReady();
+            return didEvict ? evicted : -1;
+        }
+
+        void ReclaimFree(vector<int> & available)
+        {
+            int index;
+            while (m_freeRing.Pop(index))
+                available.push_back(index);
+        }
+
+        void Stop()
+        {
+            m_stopped = true;
+            SignalReady();
+        }
+
+        int GetLatest(int currIndex)
+        {
+            if (currIndex != -1)
+                m_freeRing.Push(currIndex);
+
+            currIndex = -1;
+            while (true)
+            {
+                int index;
+                while (m_readyRing.Pop(index))
+                {
+                    if (currIndex != -1)
+                        m_freeRing.Push(currIndex);
+                    currIndex = index;
+                }
+                if ( (currIndex != -1) || m_stopped )
+                    return currIndex;
+
+                uint64_t value;
+                if (read(m_readyEvent, &value, sizeof(value)) != sizeof(value))
+                    perror("read");
+            }
+        }
+    };
+
+
+    template <typename Handoff>
+    void Run(const char * name, int numFrames, int intervalUs, int workUs)
+    {
+        Handoff handoff;
+        int64_t readyTimeNs[c_numBuffers] = {};
+        LatencyHistogram latency;
+        int starved = 0;
+
+        thread consumer([&]()
+        {
+            int index = -1;
+            while ( (index = handoff.GetLatest(index)) != -1 )
+            {
+                latency.Record((int)((GetTimestampNs() - readyTimeNs[index]) / 1000));
+                Spin(workUs);
+            }
+        });
+
+        vector<int> available;
+        for (int i = 0; i < c_numBuffers; ++i)
+            available.push_back(i);
+
+        int64_t nextNs = GetTimestampNs();
+        for (int i = 0; i < numFrames; ++i)
+        {
+            nextNs += (int64_t)intervalUs * 1000;
+            SleepUntil(nextNs);
+
+            handoff.ReclaimFree(available);
+            if (available.empty())
+            {
+                ++starved;
+                continue;
+            }
+            int index = available.back();
+            available.pop_back();
+
+            // Published by the ready queue's lock or the ring's release store, like m_readyTimeNs.
+            readyTimeNs[index] = GetTimestampNs();
+            int evicted = handoff.MakeReady(index);
+            if (evicted != -1)
+                available.push_back(evicted);
+        }
+        handoff.Stop();
+        consumer.join();
+
+        printf("%-6s %s", name, latency.GetTotal().ToString().c_str());
+        if (starved)
+            printf(", starved=%d", starved);
+        printf("\n");
+    }
+}
+
+
+void usage(const char * prog)
+{
+    fprintf(stderr, "Usage: %s [-n <frames>] [-i <interval us>] [-w <consumer work us>]\n", prog);
+    fprintf(stderr, "  Times the capture-to-consumer handoff, in microseconds, for the old mutex/condition variable\n");
+    fprintf(stderr, "  queues and the current SpscRing/eventfd rings (defaults: 20000 frames, 1000us apart, no work).\n");
+}
+
+int main(int argc, char * argv[])
+{
+    int numFrames = 20000;
+    int intervalUs = 1000;
+    int workUs = 0;
+
+    int opt;
+    while ( (opt = getopt(argc, argv, "n:i:w:")) != -1 )
+    {
+        switch (opt)
+        {
+        case 'n':
+            numFrames = atoi(optarg);
+            break;
+
+        case 'i':
+            intervalUs = atoi(optarg);
+            break;
+
+        case 'w':
+            workUs = atoi(optarg);
+            break;
+
+        default:
+            usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    if ( (numFrames <= 0) || (intervalUs < 0) || (workUs < 0) )
+    {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    // Alternate, so neither design consistently gets the warmer machine.
+    for (int round = 0; round < 2; ++round)
+    {
+        Run<MutexHandoff>("mutex", numFrames, intervalUs, workUs);
+        Run<RingHandoff>("ring", numFrames, intervalUs, workUs);
+    }
+    return EXIT_SUCCESS;
+}
@@ -1,7 +1,12 @@
 #include <stdio.h>
+#include <stdlib.h>
 #include <termios.h>
+#include <unistd.h>
 
+#include "FrameCodec.h"
 #include "PiMgr.h"
+#include "ProcessingStage.h"
+#include "Tracer.h"
 
 
 void config_canonical_mode(bool enable)
@@ -39,9 +44,139 @@ bool kbhit()
     return (FD_ISSET(STDIN_FILENO, &fds) != 0);
 }
 
-int main()
+void usage(const char * prog)
 {
-    PiMgr piMgr;
+    fprintf(stderr, "Usage: %s [-c <capture options>]... [-e <event options>] [-q <queue options>]\n"
+                    "       [-r <recording options>] [-p <processing chain>] [-x <codec>] [-a <rate options>] [-t]\n", prog);
+    fprintf(stderr, "  Each -c adds a camera; capture options are a comma-separated list of:\n");
+    fprintf(stderr, "    source=v4l2|file|synthetic  Frame source (default v4l2)\n");
+    fprintf(stderr, "    path=<path>                 Video device or raw frame file (default /dev/video0)\n");
+    fprintf(stderr, "    format=bgr24|yuyv|nv12|native  Pixel format; native picks the camera's own YUV format (default bgr24)\n");
+    fprintf(stderr, "    size=<width>x<height>       Frame size (default 640x480)\n");
+    fprintf(stderr, "    fps=<n>                     Frame rate, 0 for unpaced file/synthetic (default 30)\n");
+    fprintf(stderr, "    cpu=<n>                     Core for this camera's threads (default: spread across cores when\n");
+    fprintf(stderr, "                                more than one camera is configured)\n");
+    fprintf(stderr, "    zones=<file>                Motion zones, one per line, e.g.\n");
+    fprintf(stderr, "                                  include name=door threshold=30 votes=50 rect=0.1,0.2,0.3,0.5\n");
+    fprintf(stderr, "                                  ignore name=tree poly=0.7,0,1,0,1,0.4\n");
+    fprintf(stderr, "  Event options control when frame-level motion becomes an event (comma-separated):\n");
+    fprintf(stderr, "    enter=<votes>               Votes a frame needs to count towards an event (default 1)\n");
+    fprintf(stderr, "    exit=<score>                Event ends when the mean vote count drops below this (default 1)\n");
+    fprintf(stderr, "    window=<frames>             Frames averaged into the score (default 4)\n");
+    fprintf(stderr, "    duration=<frames>           Consecutive frames needed to start an event (default 2)\n");
+    fprintf(stderr, "    cooldown=<frames>           Frames after an event before another may start (default 15)\n");
+    fprintf(stderr, "  Queue options bound the compressed frames waiting for the client (comma-separated):\n");
+    fprintf(stderr, "    policy=drop-oldest|drop-newest|keep-latest  Which frames give way when full (default drop-oldest)\n");
+    fprintf(stderr, "    frames=<n>                  Most frames queued per camera (default 8)\n");
+    fprintf(stderr, "    kb=<n>                      Most kilobytes queued per camera (default 4096)\n");
+    fprintf(stderr, "    latest=<n>                  Frames keep-latest keeps, besides the last full frame (default 2)\n");
+    fprintf(stderr, "    send=frames|bands           Send whole images at once, or each band as soon as it is encoded\n");
+    fprintf(stderr, "  Recording options enable motion-triggered clips with pre-roll (comma-separated):\n");
+    fprintf(stderr, "    dir=<path>                  Directory for clip files; recording is off without it\n");
+    fprintf(stderr, "    preroll=<seconds>           Footage kept from before each event (default 3)\n");
+    fprintf(stderr, "    kb=<n>                      Memory for the pre-roll per camera (default 8192)\n");
+    fprintf(stderr, "    fps=<n>                     Frame rate of the pre-roll (default 5)\n");
+    fprintf(stderr, "    segment=<seconds>           Length of each clip file (default 60)\n");
+    fprintf(stderr, "  The processing chain is a space-separated list of stages applied to each frame before encoding,\n");
+    fprintf(stderr, "  arguments after a colon (default \"%s\"), e.g. -p \"gray denoise crop:0.25,0,0.5,1 scale:0.5\"\n",
+            PiMgr::GetDefaultChain());
+    fprintf(stderr, "    bgr, gray, motion, blur[:<k>], denoise[:<3|5>], crop:<x>,<y>,<w>,<h>, scale:<f>, regions\n");
+    fprintf(stderr, "    grayblur[:<k>]              Gray and Gaussian blur fused in one pass (k odd, up to 99)\n");
+    fprintf(stderr, "    graybox[:<k>]               As grayblur, approximated by box blurs; faster for large kernels\n");
+    fprintf(stderr, "  The codec encodes transmitted and recorded frames (default png:1):\n");
+    fprintf(stderr, "    png[:<level 0-9>]           Lossless, slow\n");
+    fprintf(stderr, "    jpeg[:<quality 1-100>]      Lossy, fast and small (default quality 80)\n");
+    fprintf(stderr, "    qoi                         Lossless, fast\n");
+    fprintf(stderr, "    lz4                         Raw gray pixels, LZ4 compressed (debugging)\n");
+    fprintf(stderr, "    h264[:<options>]            Inter-frame video; whole frames, regions are ignored\n");
+    fprintf(stderr, "      preset=<x264 preset>      Speed/size trade-off (default veryfast)\n");
+    fprintf(stderr, "      gop=<n>                   Most frames between keyframes (default 60)\n");
+    fprintf(stderr, "      crf=<0-51>                Quality, lower is better (default 26)\n");
+    fprintf(stderr, "  Rate options adapt the stream to the link to the client (comma-separated):\n");
+    fprintf(stderr, "    adapt=on|off                Trade quality, size, then frame rate for a steady stream (default off)\n");
+    fprintf(stderr, "    fps=<n>                     Frame rate to hold; frames are then never skipped (default 0, none)\n");
+    fprintf(stderr, "    kbps=<n>                    Bit rate not to exceed (default 0, none)\n");
+    fprintf(stderr, "  -t starts with tracing on; 't' at the keyboard toggles it, writing the trace to %s\n",
+            PiMgr::c_tracePath);
+    fprintf(stderr, "  when turned off, for chrome://tracing or ui.perfetto.dev\n");
+}
+
+int main(int argc, char * argv[])
+{
+    std::vector<CaptureConfig> captureConfigs;
+    Config config = PiMgr::GetDefaultConfig();
+    int opt;
+    while ( (opt = getopt(argc, argv, "a:c:e:p:q:r:tx:")) != -1 )
+    {
+        switch (opt)
+        {
+        case 'c':
+        {
+            CaptureConfig captureConfig;
+            if (!CaptureConfig::Parse(optarg, captureConfig))
+                return EXIT_FAILURE;
+            captureConfigs.push_back(captureConfig);
+            break;
+        }
+
+        case 'e':
+            if (!MotionEventConfig::Parse(optarg, config.eventConfig))
+                return EXIT_FAILURE;
+            break;
+
+        case 'q':
+            if (!FrameQueueConfig::Parse(optarg, config.frameQueueConfig))
+                return EXIT_FAILURE;
+            break;
+
+        case 'r':
+            if (!RecordingConfig::Parse(optarg, config.recordingConfig))
+                return EXIT_FAILURE;
+            break;
+
+        case 'a':
+            if (!RateConfig::Parse(optarg, config.rateConfig))
+                return EXIT_FAILURE;
+            break;
+
+        case 't':
+            Tracer::Enable(true);
+            break;
+
+        case 'p':
+        {
+            ProcessingChain chain;
+            if (!ProcessingChain::Parse(optarg, chain))
+                return EXIT_FAILURE;
+            config.chainSpec = optarg;
+            break;
+        }
+
+        case 'x':
+        {
+            std::unique_ptr<FrameCodec> pCodec(FrameCodec::Create(optarg));
+            if (!pCodec)
+                return EXIT_FAILURE;
+            config.codecSpec = pCodec->GetSpec();
+            break;
+        }
+
+        default:
+            usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (captureConfigs.empty())
+        captureConfigs.push_back(CaptureConfig());
+
+    if (captureConfigs.size() > std::numeric_limits<uint8_t>::max() + 1u)
+    {
+        fprintf(stderr, "Too many cameras.\n");
+        return EXIT_FAILURE;
+    }
+
+    PiMgr piMgr(captureConfigs, config);
     if (!piMgr.Initialize())
         return piMgr.GetErrorCode();
 
@@ -62,7 +197,7 @@ int main()
             else if (c == 'c')
                 piMgr.OutputConfig();
             else if (c == 'm')
-                piMgr.UpdateIPM();
+                piMgr.CycleChainPreset();
             else if (c == 'p')
                 piMgr.UpdatePage();
             else if (c == '[')
@@ -75,6 +210,10 @@ int main()
                 piMgr.UpdateParam(2, true);
             else if (c == '*')
                 piMgr.ToggleDebugMode();
+            else if (c == 'n')
+                piMgr.CycleCamera();
+            else if (c == 't')
+                piMgr.ToggleTracing();
         }
 
         boost::this_thread::sleep(boost::posix_time::milliseconds(5));